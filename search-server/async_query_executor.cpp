@@ -0,0 +1,73 @@
+#include <algorithm>
+#include "async_query_executor.h"
+
+AsyncQueryExecutor::AsyncQueryExecutor(size_t thread_count, size_t queue_capacity)
+    : tasks_(std::max<size_t>(1, queue_capacity))
+{
+    if (thread_count == 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+        threads_.emplace_back([this] { WorkerLoop(); });
+    }
+}
+
+AsyncQueryExecutor::~AsyncQueryExecutor() {
+    {
+        std::lock_guard lock(mutex_);
+        is_stopping_ = true;
+    }
+    has_tasks_.notify_all();
+    for (std::thread& thread : threads_) {
+        thread.join();
+    }
+}
+
+AsyncQueryExecutor& AsyncQueryExecutor::GetDefault() {
+    static AsyncQueryExecutor executor;
+    return executor;
+}
+
+bool AsyncQueryExecutor::TrySubmit(std::function<void()> task) {
+    {
+        std::lock_guard lock(mutex_);
+        if (task_count_ == tasks_.size() || is_stopping_) {
+            return false;
+        }
+        tasks_[(first_task_ + task_count_) % tasks_.size()] = std::move(task);
+        ++task_count_;
+    }
+    has_tasks_.notify_one();
+    return true;
+}
+
+size_t AsyncQueryExecutor::GetThreadCount() const {
+    return threads_.size();
+}
+
+size_t AsyncQueryExecutor::GetQueueCapacity() const {
+    return tasks_.size();
+}
+
+size_t AsyncQueryExecutor::GetQueuedCount() const {
+    std::lock_guard lock(mutex_);
+    return task_count_;
+}
+
+void AsyncQueryExecutor::WorkerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock lock(mutex_);
+            has_tasks_.wait(lock, [this] { return task_count_ > 0 || is_stopping_; });
+            if (task_count_ == 0) {
+                return;
+            }
+            task = std::move(tasks_[first_task_]);
+            tasks_[first_task_] = nullptr;
+            first_task_ = (first_task_ + 1) % tasks_.size();
+            --task_count_;
+        }
+        task();
+    }
+}
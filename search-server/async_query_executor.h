@@ -0,0 +1,103 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define SEARCH_SERVER_HAS_COROUTINES
+#endif
+
+constexpr size_t DEFAULT_ASYNC_QUEUE_CAPACITY = 1024;
+
+// Threads answering queries submitted without waiting for them. Submission only
+// queues the task: once the bounded queue is full it is refused at once, so a
+// caller sheds load instead of blocking. Tasks queued when the executor is
+// destroyed still run
+class AsyncQueryExecutor {
+public:
+    // thread_count = 0 takes the number of hardware threads
+    explicit AsyncQueryExecutor(size_t thread_count = 0, size_t queue_capacity = DEFAULT_ASYNC_QUEUE_CAPACITY);
+    AsyncQueryExecutor(const AsyncQueryExecutor&) = delete;
+    AsyncQueryExecutor& operator=(const AsyncQueryExecutor&) = delete;
+    ~AsyncQueryExecutor();
+
+    // Executor of the asynchronous SearchServer calls given none
+    static AsyncQueryExecutor& GetDefault();
+
+    // False if the queue is full; the task must not throw
+    bool TrySubmit(std::function<void()> task);
+
+    size_t GetThreadCount() const;
+    size_t GetQueueCapacity() const;
+    size_t GetQueuedCount() const;
+
+private:
+    // Ring buffer of queue_capacity tasks
+    std::vector<std::function<void()>> tasks_;
+    size_t first_task_ = 0;
+    size_t task_count_ = 0;
+    mutable std::mutex mutex_;
+    std::condition_variable has_tasks_;
+    bool is_stopping_ = false;
+    std::vector<std::thread> threads_;
+
+    void WorkerLoop();
+};
+
+#ifdef SEARCH_SERVER_HAS_COROUTINES
+
+// co_await runs function on the executor and resumes the coroutine on the
+// executor's thread with its result. A full queue throws std::runtime_error
+// into the coroutine, as does FindTopDocumentsAsync
+template <typename Result>
+class AsyncQueryAwaitable {
+public:
+    AsyncQueryAwaitable(AsyncQueryExecutor& executor, std::function<Result()> function)
+        : executor_(executor)
+        , function_(std::move(function))
+    {
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        // The awaitable lives in the suspended coroutine until it is resumed
+        const bool is_submitted = executor_.TrySubmit([this, handle] {
+            try {
+                result_.emplace(function_());
+            }
+            catch (...) {
+                exception_ = std::current_exception();
+            }
+            handle.resume();
+            });
+        if (!is_submitted) {
+            throw std::runtime_error("Query queue is full");
+        }
+    }
+
+    Result await_resume() {
+        if (exception_) {
+            std::rethrow_exception(exception_);
+        }
+        return std::move(*result_);
+    }
+
+private:
+    AsyncQueryExecutor& executor_;
+    std::function<Result()> function_;
+    std::optional<Result> result_;
+    std::exception_ptr exception_;
+};
+
+#endif
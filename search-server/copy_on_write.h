@@ -0,0 +1,175 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Value shared between copies until one of them changes it. A shared value is
+// never written: Modify copies it first, so other copies may be read by other
+// threads meanwhile. The last holder frees it
+template <typename T>
+class CopyOnWrite {
+public:
+    CopyOnWrite()
+        : value_(std::make_shared<T>())
+    {
+    }
+    explicit CopyOnWrite(T value)
+        : value_(std::make_shared<T>(std::move(value)))
+    {
+    }
+
+    const T& operator*() const {
+        return *value_;
+    }
+    const T* operator->() const {
+        return value_.get();
+    }
+
+    // Value held by this copy only
+    T& Modify() {
+        if (value_.use_count() > 1) {
+            value_ = std::make_shared<T>(*value_);
+        }
+        else {
+            // Reads through copies released on other threads happen before the writes
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        return *value_;
+    }
+
+private:
+    std::shared_ptr<T> value_;
+};
+
+// Vector kept in chunks of CHUNK_SIZE elements shared between copies: a copy costs
+// one pointer per chunk and a write copies only the chunk it changes
+template <typename T>
+class ChunkedVector {
+public:
+    size_t size() const {
+        return size_;
+    }
+
+    const T& operator[](size_t index) const {
+        return (*chunks_[index / CHUNK_SIZE])[index % CHUNK_SIZE];
+    }
+
+    // Element held by this copy only
+    T& Modify(size_t index) {
+        return chunks_[index / CHUNK_SIZE].Modify()[index % CHUNK_SIZE];
+    }
+
+    void push_back(T value) {
+        if (size_ % CHUNK_SIZE == 0) {
+            chunks_.emplace_back().Modify().reserve(CHUNK_SIZE);
+        }
+        chunks_.back().Modify().push_back(std::move(value));
+        ++size_;
+    }
+
+    template <typename Iterator>
+    void assign(Iterator first, Iterator last) {
+        chunks_.clear();
+        size_ = 0;
+        for (; first != last; ++first) {
+            push_back(*first);
+        }
+    }
+
+    std::vector<T> ToVector() const {
+        std::vector<T> values;
+        values.reserve(size_);
+        for (const CopyOnWrite<std::vector<T>>& chunk : chunks_) {
+            values.insert(values.end(), chunk->begin(), chunk->end());
+        }
+        return values;
+    }
+
+private:
+    static constexpr size_t CHUNK_SIZE = 4096;
+
+    std::vector<CopyOnWrite<std::vector<T>>> chunks_;
+    size_t size_ = 0;
+};
+
+// Ordered map kept in chunks of adjacent keys shared between copies: a copy costs
+// one pointer per chunk and a write copies only the chunk it changes. A chunk is
+// split in two once it holds MAX_CHUNK_SIZE keys and dropped once it is empty
+template <typename Key, typename Value>
+class ChunkedMap {
+public:
+    size_t size() const {
+        return size_;
+    }
+
+    // Null when the key is absent
+    const Value* Find(const Key& key) const {
+        if (chunks_.empty()) {
+            return nullptr;
+        }
+        const std::map<Key, Value>& chunk = *chunks_[FindChunk(key)];
+        const auto it = chunk.find(key);
+        return it == chunk.end() ? nullptr : &it->second;
+    }
+
+    // Inserts the key or replaces its value
+    void Set(const Key& key, Value value) {
+        if (chunks_.empty()) {
+            chunks_.emplace_back();
+        }
+        const size_t index = FindChunk(key);
+        std::map<Key, Value>& chunk = chunks_[index].Modify();
+        if (chunk.insert_or_assign(key, std::move(value)).second) {
+            ++size_;
+        }
+        if (chunk.size() >= MAX_CHUNK_SIZE) {
+            const auto middle = std::next(chunk.begin(), chunk.size() / 2);
+            std::map<Key, Value> upper(middle, chunk.end());
+            chunk.erase(middle, chunk.end());
+            chunks_.insert(chunks_.begin() + index + 1, CopyOnWrite<std::map<Key, Value>>(std::move(upper)));
+        }
+    }
+
+    void Erase(const Key& key) {
+        if (Find(key) == nullptr) {
+            return;
+        }
+        const size_t index = FindChunk(key);
+        std::map<Key, Value>& chunk = chunks_[index].Modify();
+        chunk.erase(key);
+        --size_;
+        if (chunk.empty()) {
+            chunks_.erase(chunks_.begin() + index);
+        }
+    }
+
+    // Calls function(key, value) in key order
+    template <typename Function>
+    void ForEach(Function function) const {
+        for (const CopyOnWrite<std::map<Key, Value>>& chunk : chunks_) {
+            for (const auto& [key, value] : *chunk) {
+                function(key, value);
+            }
+        }
+    }
+
+private:
+    static constexpr size_t MAX_CHUNK_SIZE = 4096;
+
+    // Ordered by key, none is empty
+    std::vector<CopyOnWrite<std::map<Key, Value>>> chunks_;
+    size_t size_ = 0;
+
+    // First chunk whose last key is not less than key, the last one if there is none
+    size_t FindChunk(const Key& key) const {
+        const auto chunk = std::partition_point(chunks_.begin(), chunks_.end() - 1,
+            [&key](const CopyOnWrite<std::map<Key, Value>>& chunk) {
+                return chunk->rbegin()->first < key;
+            });
+        return static_cast<size_t>(chunk - chunks_.begin());
+    }
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include <sstream>
+#include <cstddef>
 
 enum class DocumentStatus {
     ACTUAL,
@@ -7,6 +8,7 @@ enum class DocumentStatus {
     BANNED,
     REMOVED,
 };
+constexpr size_t DOCUMENT_STATUS_COUNT = 4;
 
 struct Document {
     Document() = default;
@@ -0,0 +1,104 @@
+#include "string_processing.h"
+#include "durable_search_server.h"
+
+DurableSearchServer::DurableSearchServer(const std::string& snapshot_path, const std::string& log_path,
+    const std::string& stop_words_text, std::chrono::milliseconds sync_interval)
+    : DurableSearchServer(snapshot_path, log_path, std::string_view(stop_words_text), sync_interval)
+{
+}
+
+DurableSearchServer::DurableSearchServer(const std::string& snapshot_path, const std::string& log_path,
+    std::string_view stop_words_text, std::chrono::milliseconds sync_interval)
+    : DurableSearchServer(snapshot_path, log_path, SplitIntoWords(stop_words_text), sync_interval)
+{
+}
+
+void DurableSearchServer::AddDocument(int document_id, std::string_view document, DocumentStatus status,
+    const std::vector<int>& ratings) {
+    // Only documents the index accepted are logged, so replay never fails
+    server_.AddDocument(document_id, document, status, ratings);
+    log_.AppendAdd(document_id, document, status, ratings);
+}
+
+std::vector<RejectedDocument> DurableSearchServer::AddDocuments(const std::vector<DocumentToAdd>& batch) {
+    std::vector<RejectedDocument> rejected = server_.AddDocuments(batch);
+    auto next_rejected = rejected.begin();
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (next_rejected != rejected.end() && next_rejected->position == i) {
+            ++next_rejected;
+            continue;
+        }
+        log_.AppendAdd(batch[i].document_id, batch[i].document, batch[i].status, batch[i].ratings);
+    }
+    return rejected;
+}
+
+std::vector<Document> DurableSearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+    ResultPage page) const {
+    return server_.FindTopDocuments(raw_query, status, page);
+}
+
+std::vector<Document> DurableSearchServer::FindTopDocuments(std::string_view raw_query, ResultPage page) const {
+    return server_.FindTopDocuments(raw_query, page);
+}
+
+int DurableSearchServer::GetDocumentCount() const {
+    return server_.GetDocumentCount();
+}
+
+std::set<int>::const_iterator DurableSearchServer::begin() const {
+    return server_.begin();
+}
+
+std::set<int>::const_iterator DurableSearchServer::end() const {
+    return server_.end();
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> DurableSearchServer::MatchDocument(
+    std::string_view raw_query, int document_id) const {
+    return server_.MatchDocument(raw_query, document_id);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> DurableSearchServer::MatchDocument(
+    const std::execution::sequenced_policy&, std::string_view raw_query, int document_id) const {
+    return server_.MatchDocument(std::execution::seq, raw_query, document_id);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> DurableSearchServer::MatchDocument(
+    const std::execution::parallel_policy&, std::string_view raw_query, int document_id) const {
+    return server_.MatchDocument(std::execution::par, raw_query, document_id);
+}
+
+const std::map<std::string_view, double>& DurableSearchServer::GetWordFrequencies(int document_id) const {
+    return server_.GetWordFrequencies(document_id);
+}
+
+void DurableSearchServer::RemoveDocument(int document_id) {
+    RemoveDocument(std::execution::seq, document_id);
+}
+
+void DurableSearchServer::RemoveDocument(const std::execution::sequenced_policy&, int document_id) {
+    if (!server_.HasDocument(document_id)) {
+        return;
+    }
+    server_.RemoveDocument(std::execution::seq, document_id);
+    log_.AppendRemove(document_id);
+}
+
+void DurableSearchServer::RemoveDocument(const std::execution::parallel_policy&, int document_id) {
+    if (!server_.HasDocument(document_id)) {
+        return;
+    }
+    server_.RemoveDocument(std::execution::par, document_id);
+    log_.AppendRemove(document_id);
+}
+
+void DurableSearchServer::Sync() {
+    log_.Sync();
+}
+
+void DurableSearchServer::Checkpoint() {
+    // Save replaces the old snapshot only when the new one is on disk
+    server_.Save(snapshot_path_);
+    log_.Truncate();
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <chrono>
+#include <string>
+#include <vector>
+#include <set>
+#include <filesystem>
+#include <execution>
+
+#include "document.h"
+#include "search_server.h"
+#include "write_ahead_log.h"
+
+// SearchServer whose updates survive a crash. It starts from the snapshot saved
+// by the last checkpoint (opened with OpenMapped) and replays the write-ahead log
+// of later updates on top of it. Every successful AddDocument and RemoveDocument
+// is logged; records are group-committed every sync interval, so a crash loses
+// at most the updates of the last interval unless Sync is called.
+// Checkpoint saves a new snapshot and empties the log.
+class DurableSearchServer {
+public:
+    // Stop words are used only when there is no snapshot yet, a snapshot keeps its own
+    template <typename StringContainer>
+    DurableSearchServer(const std::string& snapshot_path, const std::string& log_path,
+        const StringContainer& stop_words, std::chrono::milliseconds sync_interval = DEFAULT_LOG_SYNC_INTERVAL);
+    DurableSearchServer(const std::string& snapshot_path, const std::string& log_path,
+        const std::string& stop_words_text, std::chrono::milliseconds sync_interval = DEFAULT_LOG_SYNC_INTERVAL);
+    DurableSearchServer(const std::string& snapshot_path, const std::string& log_path,
+        std::string_view stop_words_text, std::chrono::milliseconds sync_interval = DEFAULT_LOG_SYNC_INTERVAL);
+
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status,
+        const std::vector<int>& ratings);
+    std::vector<RejectedDocument> AddDocuments(const std::vector<DocumentToAdd>& batch);
+
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, ResultPage page = {}) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+        ResultPage page = {}) const;
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate,
+        ResultPage page = {}) const;
+
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+        ResultPage page = {}) const;
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+        DocumentStatus status, ResultPage page = {}) const;
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+        DocumentPredicate document_predicate, ResultPage page = {}) const;
+
+    int GetDocumentCount() const;
+    std::set<int>::const_iterator begin() const;
+    std::set<int>::const_iterator end() const;
+
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::string_view raw_query,
+        int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(
+        const std::execution::sequenced_policy&,
+        std::string_view raw_query,
+        int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(
+        const std::execution::parallel_policy&,
+        std::string_view raw_query,
+        int document_id) const;
+
+    const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
+
+    void RemoveDocument(int document_id);
+    void RemoveDocument(const std::execution::sequenced_policy&, int document_id);
+    void RemoveDocument(const std::execution::parallel_policy&, int document_id);
+
+    // Returns once every update made so far is on disk
+    void Sync();
+    // Saves the index as the new snapshot and empties the log. A crash in between
+    // is harmless: the old log replays idempotently on the new snapshot
+    void Checkpoint();
+
+private:
+    const std::string snapshot_path_;
+    SearchServer server_;
+    WriteAheadLog log_;
+
+    template <typename StringContainer>
+    static SearchServer OpenSnapshot(const std::string& snapshot_path, const StringContainer& stop_words);
+};
+
+template <typename StringContainer>
+DurableSearchServer::DurableSearchServer(const std::string& snapshot_path, const std::string& log_path,
+    const StringContainer& stop_words, std::chrono::milliseconds sync_interval)
+    : snapshot_path_(snapshot_path)
+    , server_(OpenSnapshot(snapshot_path, stop_words))
+    , log_(log_path, sync_interval)
+{
+    log_.Replay(server_);
+}
+
+template <typename StringContainer>
+SearchServer DurableSearchServer::OpenSnapshot(const std::string& snapshot_path, const StringContainer& stop_words) {
+    if (std::filesystem::exists(snapshot_path)) {
+        return SearchServer::OpenMapped(snapshot_path);
+    }
+    return SearchServer(stop_words);
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> DurableSearchServer::FindTopDocuments(std::string_view raw_query,
+    DocumentPredicate document_predicate, ResultPage page) const {
+    return server_.FindTopDocuments(raw_query, document_predicate, page);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> DurableSearchServer::FindTopDocuments(ExecutionPolicy&& policy,
+    std::string_view raw_query, ResultPage page) const {
+    return server_.FindTopDocuments(policy, raw_query, page);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> DurableSearchServer::FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+    DocumentStatus status, ResultPage page) const {
+    return server_.FindTopDocuments(policy, raw_query, status, page);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> DurableSearchServer::FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+    DocumentPredicate document_predicate, ResultPage page) const {
+    return server_.FindTopDocuments(policy, raw_query, document_predicate, page);
+}
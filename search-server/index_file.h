@@ -0,0 +1,278 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <system_error>
+#include <stdexcept>
+#include <type_traits>
+
+#include "mapped_file.h"
+
+// Layout of an index file written by SearchServer::Save:
+//   header: magic, format version, payload size, payload checksum (8 bytes each)
+//   payload: numbers, strings and arrays, every item padded to 8 bytes so that
+//   arrays can be used in place once the file is mapped into memory.
+// Numbers are stored in the byte order of the machine that wrote the file.
+constexpr uint64_t INDEX_FILE_VERSION = 1;
+constexpr char INDEX_FILE_MAGIC[8] = { 'S', 'R', 'C', 'H', 'I', 'D', 'X', '\0' };
+constexpr size_t INDEX_FILE_HEADER_SIZE = 32;
+constexpr size_t INDEX_FILE_ALIGNMENT = 8;
+
+// Checksum of a byte stream fed in pieces of any size, taken over 8-byte words
+class IndexChecksum {
+public:
+    void Update(const char* data, size_t size) {
+        while (size > 0 && pending_size_ > 0) {
+            AddPendingByte(*data++);
+            --size;
+        }
+        for (; size >= sizeof(uint64_t); data += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+            uint64_t word;
+            std::memcpy(&word, data, sizeof(word));
+            AddWord(word);
+        }
+        while (size-- > 0) {
+            AddPendingByte(*data++);
+        }
+    }
+
+    uint64_t Get() const {
+        return hash_;
+    }
+
+private:
+    uint64_t hash_ = 0xCBF29CE484222325ull;
+    char pending_[sizeof(uint64_t)] = {};
+    size_t pending_size_ = 0;
+
+    void AddWord(uint64_t word) {
+        hash_ = (hash_ ^ word) * 0x9E3779B97F4A7C15ull;
+        hash_ ^= hash_ >> 29;
+    }
+
+    void AddPendingByte(char byte) {
+        pending_[pending_size_++] = byte;
+        if (pending_size_ == sizeof(uint64_t)) {
+            uint64_t word;
+            std::memcpy(&word, pending_, sizeof(word));
+            AddWord(word);
+            pending_size_ = 0;
+        }
+    }
+};
+
+// Array owned by its holder or borrowed from a mapped index file. Borrowed
+// contents are copied on the first modification
+template <typename T>
+class MappableArray {
+public:
+    MappableArray() = default;
+    MappableArray(std::vector<T> values)
+        : owned_(std::move(values))
+    {
+    }
+    MappableArray(const T* data, size_t size)
+        : mapped_data_(data)
+        , mapped_size_(size)
+        , is_mapped_(true)
+    {
+    }
+
+    const T* data() const {
+        return is_mapped_ ? mapped_data_ : owned_.data();
+    }
+    size_t size() const {
+        return is_mapped_ ? mapped_size_ : owned_.size();
+    }
+    bool empty() const {
+        return size() == 0;
+    }
+    const T* begin() const {
+        return data();
+    }
+    const T* end() const {
+        return data() + size();
+    }
+    const T& operator[](size_t index) const {
+        return data()[index];
+    }
+    const T& back() const {
+        return data()[size() - 1];
+    }
+
+    std::vector<T>& Modify() {
+        if (is_mapped_) {
+            owned_.assign(mapped_data_, mapped_data_ + mapped_size_);
+            is_mapped_ = false;
+        }
+        return owned_;
+    }
+    // Bytes allocated by the array itself, mapped contents are not counted
+    size_t GetMemoryUsage() const {
+        return owned_.capacity() * sizeof(T);
+    }
+
+private:
+    std::vector<T> owned_;
+    const T* mapped_data_ = nullptr;
+    size_t mapped_size_ = 0;
+    bool is_mapped_ = false;
+};
+
+// Writes an index file next to path and puts it in place of path only when it is
+// complete and on disk. A server that has the old file mapped keeps reading it
+class IndexWriter {
+public:
+    explicit IndexWriter(const std::string& path)
+        : path_(path)
+        , temporary_path_(path + ".tmp")
+        , out_(temporary_path_, std::ios::binary | std::ios::trunc)
+    {
+        if (!out_) {
+            throw std::runtime_error("Cannot create index file " + temporary_path_);
+        }
+        // Reserved for the header, which is written by Finish
+        const char header[INDEX_FILE_HEADER_SIZE] = {};
+        out_.write(header, sizeof(header));
+    }
+
+    void WriteNumber(uint64_t value) {
+        WritePadded(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void WriteString(std::string_view text) {
+        WriteNumber(text.size());
+        WritePadded(text.data(), text.size());
+    }
+
+    template <typename T>
+    void WriteArray(const T* data, size_t size) {
+        static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= INDEX_FILE_ALIGNMENT);
+        WriteNumber(size);
+        WritePadded(reinterpret_cast<const char*>(data), size * sizeof(T));
+    }
+
+    template <typename Container>
+    void WriteArray(const Container& values) {
+        WriteArray(values.data(), values.size());
+    }
+
+    void Finish() {
+        const uint64_t fields[] = { INDEX_FILE_VERSION, payload_size_, checksum_.Get() };
+        out_.seekp(0);
+        out_.write(INDEX_FILE_MAGIC, sizeof(INDEX_FILE_MAGIC));
+        out_.write(reinterpret_cast<const char*>(fields), sizeof(fields));
+        out_.close();
+        if (!out_) {
+            throw std::runtime_error("Cannot write index file " + temporary_path_);
+        }
+        SyncToDisk(temporary_path_);
+        std::filesystem::rename(temporary_path_, path_);
+        SyncToDisk(std::filesystem::absolute(path_).parent_path().string());
+        is_finished_ = true;
+    }
+
+    ~IndexWriter() {
+        if (!is_finished_) {
+            out_.close();
+            std::error_code error;
+            std::filesystem::remove(temporary_path_, error);
+        }
+    }
+
+private:
+    std::string path_;
+    std::string temporary_path_;
+    std::ofstream out_;
+    bool is_finished_ = false;
+    uint64_t payload_size_ = 0;
+    IndexChecksum checksum_;
+
+    void WritePadded(const char* data, size_t size) {
+        const char padding[INDEX_FILE_ALIGNMENT] = {};
+        const size_t padding_size = (INDEX_FILE_ALIGNMENT - size % INDEX_FILE_ALIGNMENT) % INDEX_FILE_ALIGNMENT;
+        out_.write(data, size);
+        out_.write(padding, padding_size);
+        checksum_.Update(data, size);
+        checksum_.Update(padding, padding_size);
+        payload_size_ += size + padding_size;
+    }
+};
+
+// Reads the payload of an index file in place; strings and arrays it returns
+// point into the file data
+class IndexReader {
+public:
+    IndexReader(const char* data, size_t size)
+        : data_(data)
+        , size_(size)
+    {
+        uint64_t header[INDEX_FILE_HEADER_SIZE / sizeof(uint64_t)];
+        if (size < sizeof(header)) {
+            throw std::runtime_error("Index file is corrupted");
+        }
+        std::memcpy(header, data, sizeof(header));
+        if (std::memcmp(data, INDEX_FILE_MAGIC, sizeof(INDEX_FILE_MAGIC)) != 0) {
+            throw std::runtime_error("Not an index file");
+        }
+        if (header[1] != INDEX_FILE_VERSION) {
+            throw std::runtime_error("Unsupported index file version " + std::to_string(header[1]));
+        }
+        if (header[2] != size - INDEX_FILE_HEADER_SIZE) {
+            throw std::runtime_error("Index file is corrupted");
+        }
+        checksum_ = header[3];
+        position_ = INDEX_FILE_HEADER_SIZE;
+    }
+
+    // Reads the whole file, so it is done once when the file is opened
+    void VerifyChecksum() const {
+        IndexChecksum checksum;
+        checksum.Update(data_ + INDEX_FILE_HEADER_SIZE, size_ - INDEX_FILE_HEADER_SIZE);
+        if (checksum.Get() != checksum_) {
+            throw std::runtime_error("Index file is corrupted");
+        }
+    }
+
+    uint64_t ReadNumber() {
+        uint64_t value;
+        std::memcpy(&value, Skip(sizeof(value)), sizeof(value));
+        return value;
+    }
+
+    std::string_view ReadString() {
+        const size_t size = ReadNumber();
+        return { Skip(size), size };
+    }
+
+    template <typename T>
+    MappableArray<T> ReadArray() {
+        static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= INDEX_FILE_ALIGNMENT);
+        const size_t size = ReadNumber();
+        if (size > size_ / sizeof(T)) {
+            throw std::runtime_error("Index file is corrupted");
+        }
+        return { reinterpret_cast<const T*>(Skip(size * sizeof(T))), size };
+    }
+
+private:
+    const char* data_;
+    size_t size_;
+    size_t position_ = 0;
+    uint64_t checksum_ = 0;
+
+    const char* Skip(size_t size) {
+        const size_t padded_size = size + (INDEX_FILE_ALIGNMENT - size % INDEX_FILE_ALIGNMENT) % INDEX_FILE_ALIGNMENT;
+        if (padded_size < size || padded_size > size_ - position_) {
+            throw std::runtime_error("Index file is corrupted");
+        }
+        const char* item = data_ + position_;
+        position_ += padded_size;
+        return item;
+    }
+};
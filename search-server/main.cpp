@@ -1,4 +1,5 @@
 #include "search_server.h"
+#include "posting_list.h"
 #include "log_duration.h"
 #include <execution>
 #include <iostream>
@@ -49,7 +50,7 @@ vector<string> GenerateQueries(mt19937& generator, const vector<string>& diction
 }
 template <typename ExecutionPolicy>
 void Test(string_view mark, const SearchServer& search_server, const vector<string>& queries, ExecutionPolicy&& policy) {
-    LOG_DURATION(mark);
+    LOG_DURATION(static_cast<string>(mark));
     double total_relevance = 0;
     for (const string_view query : queries) {
         for (const auto& document : search_server.FindTopDocuments(policy, query)) {
@@ -59,6 +60,33 @@ void Test(string_view mark, const SearchServer& search_server, const vector<stri
     cout << total_relevance << endl;
 }
 #define TEST(policy) Test(#policy, search_server, queries, execution::policy)
+void ScanPostings(string_view mark, const PostingList& postings, int repeat_count) {
+    LOG_DURATION(static_cast<string>(mark));
+    long long id_sum = 0;
+    double freq_sum = 0;
+    for (int i = 0; i < repeat_count; ++i) {
+        postings.ForEach([&id_sum, &freq_sum](int document_id, double term_freq) {
+            id_sum += document_id;
+            freq_sum += term_freq;
+        });
+    }
+    cout << id_sum << ' ' << freq_sum << endl;
+}
+void BenchmarkPostingScan(mt19937& generator) {
+    PostingList raw;
+    PostingList compressed;
+    int document_id = 0;
+    for (int i = 0; i < 10'000'000; ++i) {
+        document_id += uniform_int_distribution(1, 16)(generator);
+        const double term_freq = 1.0 / uniform_int_distribution(1, 70)(generator);
+        raw.Add(document_id, term_freq);
+        compressed.Add(document_id, term_freq);
+    }
+    compressed.Compress();
+    cout << "raw: " << raw.GetMemoryUsage() << " bytes, compressed: " << compressed.GetMemoryUsage() << " bytes" << endl;
+    ScanPostings("raw scan", raw, 10);
+    ScanPostings("compressed scan", compressed, 10);
+}
 int main() {
     mt19937 generator;
     const auto dictionary = GenerateDictionary(generator, 1000, 10);
@@ -70,4 +98,7 @@ int main() {
     const auto queries = GenerateQueries(generator, dictionary, 100, 70);
     TEST(seq);
     TEST(par);
+    search_server.SetQueryEvaluation(QueryEvaluation::PRUNED);
+    Test("pruned"sv, search_server, queries, execution::seq);
+    BenchmarkPostingScan(generator);
 }
\ No newline at end of file
@@ -0,0 +1,83 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Set of document ordinals, one bit per ordinal
+class OrdinalBitmap {
+public:
+    void Set(int ordinal) {
+        const size_t word = static_cast<size_t>(ordinal) / 64;
+        if (words_.size() <= word) {
+            words_.resize(word + 1, 0);
+        }
+        words_[word] |= uint64_t{ 1 } << (ordinal % 64);
+    }
+
+    void Reset(int ordinal) {
+        const size_t word = static_cast<size_t>(ordinal) / 64;
+        if (word < words_.size()) {
+            words_[word] &= ~(uint64_t{ 1 } << (ordinal % 64));
+        }
+    }
+
+    bool Test(int ordinal) const {
+        const size_t word = static_cast<size_t>(ordinal) / 64;
+        return word < words_.size() && (words_[word] >> (ordinal % 64) & 1) != 0;
+    }
+
+private:
+    std::vector<uint64_t> words_;
+};
+
+// Set of document ordinals whose words are kept in chunks shared between copies:
+// a copy costs one pointer per chunk and a write copies only the chunk it changes.
+// Chunks held by another copy are never written, so copies may be read by other
+// threads while this one changes
+class ChunkedOrdinalBitmap {
+public:
+    void Set(int ordinal) {
+        const size_t word = static_cast<size_t>(ordinal) / 64;
+        ModifyChunk(word / CHUNK_WORDS)[word % CHUNK_WORDS] |= uint64_t{ 1 } << (ordinal % 64);
+    }
+
+    void Reset(int ordinal) {
+        if (Test(ordinal)) {
+            const size_t word = static_cast<size_t>(ordinal) / 64;
+            ModifyChunk(word / CHUNK_WORDS)[word % CHUNK_WORDS] &= ~(uint64_t{ 1 } << (ordinal % 64));
+        }
+    }
+
+    bool Test(int ordinal) const {
+        const size_t word = static_cast<size_t>(ordinal) / 64;
+        const size_t chunk = word / CHUNK_WORDS;
+        return chunk < chunks_.size() && chunks_[chunk]
+            && ((*chunks_[chunk])[word % CHUNK_WORDS] >> (ordinal % 64) & 1) != 0;
+    }
+
+private:
+    static constexpr size_t CHUNK_WORDS = 64;
+    using Chunk = std::array<uint64_t, CHUNK_WORDS>;
+
+    std::vector<std::shared_ptr<Chunk>> chunks_;
+
+    Chunk& ModifyChunk(size_t chunk) {
+        if (chunks_.size() <= chunk) {
+            chunks_.resize(chunk + 1);
+        }
+        std::shared_ptr<Chunk>& words = chunks_[chunk];
+        if (!words) {
+            words = std::make_shared<Chunk>();
+        }
+        else if (words.use_count() > 1) {
+            words = std::make_shared<Chunk>(*words);
+        }
+        else {
+            // Reads through copies released on other threads happen before the writes
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        return *words;
+    }
+};
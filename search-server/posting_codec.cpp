@@ -0,0 +1,345 @@
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <stdexcept>
+#include "posting_codec.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAS_AVX2_CODEC
+#endif
+
+namespace {
+
+constexpr size_t LANE_COUNT = 4;
+constexpr size_t ROW_COUNT = POSTING_BLOCK_SIZE / LANE_COUNT;
+
+uint8_t BitWidth(uint32_t value) {
+    uint8_t width = 0;
+    while (value != 0) {
+        ++width;
+        value >>= 1;
+    }
+    return width;
+}
+
+uint32_t LowBitsMask(uint8_t bit_width) {
+    return bit_width == 32 ? ~0u : (1u << bit_width) - 1;
+}
+
+// Value i of the block goes to lane i % 4; every lane fills its own column of
+// 32-bit words, so word w of lane l is stored at index 4 * w + l
+void PackBlock(const uint32_t* deltas, uint8_t bit_width, uint32_t* out) {
+    for (size_t lane = 0; lane < LANE_COUNT; ++lane) {
+        uint32_t* words = out + lane;
+        size_t word = 0;
+        uint32_t shift = 0;
+        for (size_t row = 0; row < ROW_COUNT; ++row) {
+            const uint32_t value = deltas[row * LANE_COUNT + lane];
+            words[word * LANE_COUNT] |= value << shift;
+            if (shift + bit_width > 32) {
+                words[(word + 1) * LANE_COUNT] |= value >> (32 - shift);
+            }
+            shift += bit_width;
+            if (shift >= 32) {
+                shift -= 32;
+                ++word;
+            }
+        }
+    }
+}
+
+void UnpackBlockScalar(const uint32_t* packed, uint8_t bit_width, int base, int* out) {
+    const uint32_t mask = LowBitsMask(bit_width);
+    for (size_t lane = 0; lane < LANE_COUNT; ++lane) {
+        const uint32_t* words = packed + lane;
+        uint32_t previous = static_cast<uint32_t>(base);
+        size_t word = 0;
+        uint32_t shift = 0;
+        for (size_t row = 0; row < ROW_COUNT; ++row) {
+            uint32_t value = 0;
+            if (bit_width != 0) {
+                value = words[word * LANE_COUNT] >> shift;
+                if (shift + bit_width > 32) {
+                    value |= words[(word + 1) * LANE_COUNT] << (32 - shift);
+                }
+                shift += bit_width;
+                if (shift >= 32) {
+                    shift -= 32;
+                    ++word;
+                }
+            }
+            previous += value & mask;
+            out[row * LANE_COUNT + lane] = static_cast<int>(previous);
+        }
+    }
+}
+
+#ifdef __SSE2__
+
+void UnpackBlockSse2(const uint32_t* packed, uint8_t bit_width, int base, int* out) {
+    const __m128i* in = reinterpret_cast<const __m128i*>(packed);
+    __m128i previous = _mm_set1_epi32(base);
+    if (bit_width == 0) {
+        for (size_t row = 0; row < ROW_COUNT; ++row) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + row * LANE_COUNT), previous);
+        }
+        return;
+    }
+    const __m128i mask = _mm_set1_epi32(static_cast<int>(LowBitsMask(bit_width)));
+    __m128i current = _mm_loadu_si128(in++);
+    uint32_t shift = 0;
+    for (size_t row = 0; row < ROW_COUNT; ++row) {
+        __m128i value = _mm_srl_epi32(current, _mm_cvtsi32_si128(static_cast<int>(shift)));
+        if (shift + bit_width > 32) {
+            current = _mm_loadu_si128(in++);
+            value = _mm_or_si128(value, _mm_sll_epi32(current, _mm_cvtsi32_si128(static_cast<int>(32 - shift))));
+            shift = shift + bit_width - 32;
+        }
+        else {
+            shift += bit_width;
+            if (shift == 32 && row + 1 < ROW_COUNT) {
+                current = _mm_loadu_si128(in++);
+                shift = 0;
+            }
+        }
+        previous = _mm_add_epi32(previous, _mm_and_si128(value, mask));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + row * LANE_COUNT), previous);
+    }
+}
+
+#endif
+
+#ifdef HAS_AVX2_CODEC
+
+// Words of two rows: the low half from word low_word, the high half from high_word
+__attribute__((target("avx2")))
+__m256i LoadRowWords(const uint32_t* packed, size_t low_word, size_t high_word) {
+    const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(packed + low_word * LANE_COUNT));
+    const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(packed + high_word * LANE_COUNT));
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+}
+
+// Decodes two rows per step: the low half of a register holds row r and the high
+// half row r + 1, each shifted by its own amount, so rows need no branches. A word
+// past the value is shifted in harmlessly, the mask drops its bits
+__attribute__((target("avx2")))
+void UnpackBlockAvx2(const uint32_t* packed, uint8_t bit_width, int base, int* out) {
+    __m256i previous = _mm256_set1_epi32(base);
+    if (bit_width == 0) {
+        for (size_t row = 0; row < ROW_COUNT; row += 2) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + row * LANE_COUNT), previous);
+        }
+        return;
+    }
+    const __m256i mask = _mm256_set1_epi32(static_cast<int>(LowBitsMask(bit_width)));
+    const __m256i word_bits = _mm256_set1_epi32(32);
+    const size_t last_word = bit_width - 1;
+    for (size_t row = 0; row < ROW_COUNT; row += 2) {
+        const size_t low_bit = row * bit_width;
+        const size_t high_bit = low_bit + bit_width;
+        const size_t low_word = low_bit / 32;
+        const size_t high_word = high_bit / 32;
+        const __m256i shifts = _mm256_set_epi32(
+            static_cast<int>(high_bit % 32), static_cast<int>(high_bit % 32),
+            static_cast<int>(high_bit % 32), static_cast<int>(high_bit % 32),
+            static_cast<int>(low_bit % 32), static_cast<int>(low_bit % 32),
+            static_cast<int>(low_bit % 32), static_cast<int>(low_bit % 32));
+        // A value in the last word cannot cross into the next one
+        const __m256i next = LoadRowWords(packed, std::min(low_word + 1, last_word), std::min(high_word + 1, last_word));
+        __m256i value = _mm256_srlv_epi32(LoadRowWords(packed, low_word, high_word), shifts);
+        // Shifting left by 32 gives zero, so rows starting at a word boundary take nothing from next
+        value = _mm256_or_si256(value, _mm256_sllv_epi32(next, _mm256_sub_epi32(word_bits, shifts)));
+        value = _mm256_and_si256(value, mask);
+        // Row r + 1 adds the deltas of row r as well
+        value = _mm256_add_epi32(value, _mm256_permute2x128_si256(value, value, 0x08));
+        const __m256i current = _mm256_add_epi32(previous, value);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + row * LANE_COUNT), current);
+        previous = _mm256_permute2x128_si256(current, current, 0x11);
+    }
+}
+
+#endif
+
+using UnpackBlockFunction = void (*)(const uint32_t* packed, uint8_t bit_width, int base, int* out);
+
+UnpackBlockFunction GetUnpackBlock(UnpackKernel kernel) {
+    switch (kernel) {
+#ifdef __SSE2__
+    case UnpackKernel::SSE2:
+        return UnpackBlockSse2;
+#endif
+#ifdef HAS_AVX2_CODEC
+    case UnpackKernel::AVX2:
+        return UnpackBlockAvx2;
+#endif
+    default:
+        return UnpackBlockScalar;
+    }
+}
+
+// Picked once by the features of the running CPU
+UnpackBlockFunction SelectUnpackBlock() {
+    const std::vector<UnpackKernel> kernels = GetSupportedUnpackKernels();
+    return GetUnpackBlock(kernels.back());
+}
+
+void AppendVarint(uint32_t value, std::vector<uint8_t>& out) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+uint32_t ReadVarint(const uint8_t*& in) {
+    uint32_t value = 0;
+    for (uint32_t shift = 0;; shift += 7) {
+        const uint8_t byte = *in++;
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+}
+
+}  // namespace
+
+CompressedPostingList::CompressedPostingList(const int* document_ids, const double* term_freqs, size_t count)
+    : size_(count)
+{
+    std::vector<Block> blocks;
+    std::vector<uint32_t> packed;
+    std::vector<uint8_t> tail;
+    std::vector<float> freqs(term_freqs, term_freqs + count);
+    blocks.reserve(GetBlockCount());
+    const size_t full_blocks = count / POSTING_BLOCK_SIZE;
+    uint32_t deltas[POSTING_BLOCK_SIZE];
+    for (size_t block = 0; block < full_blocks; ++block) {
+        const int* ids = document_ids + block * POSTING_BLOCK_SIZE;
+        uint32_t max_delta = 0;
+        for (size_t i = 0; i < POSTING_BLOCK_SIZE; ++i) {
+            const int previous = i < LANE_COUNT ? ids[0] : ids[i - LANE_COUNT];
+            deltas[i] = static_cast<uint32_t>(ids[i]) - static_cast<uint32_t>(previous);
+            max_delta = std::max(max_delta, deltas[i]);
+        }
+        Block header;
+        header.first_document_id = ids[0];
+        header.last_document_id = ids[POSTING_BLOCK_SIZE - 1];
+        header.max_term_freq = *std::max_element(freqs.begin() + block * POSTING_BLOCK_SIZE,
+            freqs.begin() + (block + 1) * POSTING_BLOCK_SIZE);
+        header.offset = static_cast<uint32_t>(packed.size());
+        header.bit_width = BitWidth(max_delta);
+        packed.resize(packed.size() + LANE_COUNT * header.bit_width, 0);
+        PackBlock(deltas, header.bit_width, packed.data() + header.offset);
+        blocks.push_back(header);
+    }
+    if (full_blocks * POSTING_BLOCK_SIZE < count) {
+        const int* ids = document_ids + full_blocks * POSTING_BLOCK_SIZE;
+        const size_t tail_count = count - full_blocks * POSTING_BLOCK_SIZE;
+        Block header;
+        header.first_document_id = ids[0];
+        header.last_document_id = ids[tail_count - 1];
+        header.max_term_freq = *std::max_element(freqs.begin() + full_blocks * POSTING_BLOCK_SIZE, freqs.end());
+        header.offset = static_cast<uint32_t>(tail.size());
+        for (size_t i = 1; i < tail_count; ++i) {
+            AppendVarint(static_cast<uint32_t>(ids[i]) - static_cast<uint32_t>(ids[i - 1]), tail);
+        }
+        blocks.push_back(header);
+    }
+    packed.shrink_to_fit();
+    tail.shrink_to_fit();
+    blocks_ = std::move(blocks);
+    packed_ = std::move(packed);
+    tail_ = std::move(tail);
+    term_freqs_ = std::move(freqs);
+}
+
+size_t CompressedPostingList::GetMemoryUsage() const {
+    return sizeof(*this)
+        + blocks_.GetMemoryUsage()
+        + packed_.GetMemoryUsage()
+        + tail_.GetMemoryUsage()
+        + term_freqs_.GetMemoryUsage();
+}
+
+void CompressedPostingList::Save(IndexWriter& writer) const {
+    writer.WriteNumber(size_);
+    writer.WriteArray(blocks_);
+    writer.WriteArray(packed_);
+    writer.WriteArray(tail_);
+    writer.WriteArray(term_freqs_);
+}
+
+CompressedPostingList CompressedPostingList::Load(IndexReader& reader) {
+    CompressedPostingList postings;
+    postings.size_ = reader.ReadNumber();
+    postings.blocks_ = reader.ReadArray<Block>();
+    postings.packed_ = reader.ReadArray<uint32_t>();
+    postings.tail_ = reader.ReadArray<uint8_t>();
+    postings.term_freqs_ = reader.ReadArray<float>();
+    if (postings.blocks_.size() != postings.GetBlockCount() || postings.term_freqs_.size() != postings.size_) {
+        throw std::runtime_error("Index file is corrupted");
+    }
+    return postings;
+}
+
+size_t CompressedPostingList::FindBlock(int document_id) const {
+    return std::partition_point(blocks_.begin(), blocks_.end(), [document_id](const Block& block) {
+        return block.last_document_id < document_id;
+        }) - blocks_.begin();
+}
+
+size_t CompressedPostingList::DecodeBlock(size_t block, int* document_ids, double* term_freqs) const {
+    const size_t count = DecodeDocumentIds(block, document_ids);
+    const float* freqs = term_freqs_.data() + block * POSTING_BLOCK_SIZE;
+    for (size_t i = 0; i < count; ++i) {
+        term_freqs[i] = freqs[i];
+    }
+    return count;
+}
+
+std::vector<UnpackKernel> GetSupportedUnpackKernels() {
+    std::vector<UnpackKernel> kernels = { UnpackKernel::SCALAR };
+#ifdef __SSE2__
+    kernels.push_back(UnpackKernel::SSE2);
+#endif
+#ifdef HAS_AVX2_CODEC
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back(UnpackKernel::AVX2);
+    }
+#endif
+    return kernels;
+}
+
+size_t CompressedPostingList::DecodeDocumentIds(size_t block, int* document_ids) const {
+    static const UnpackBlockFunction unpack_block = SelectUnpackBlock();
+    return DecodeDocumentIds(block, document_ids, unpack_block);
+}
+
+size_t CompressedPostingList::DecodeDocumentIds(size_t block, int* document_ids, UnpackKernel kernel) const {
+    return DecodeDocumentIds(block, document_ids, GetUnpackBlock(kernel));
+}
+
+size_t CompressedPostingList::DecodeDocumentIds(size_t block, int* document_ids,
+    UnpackBlockFunction unpack_block) const {
+    const Block& header = blocks_[block];
+    const size_t begin = block * POSTING_BLOCK_SIZE;
+    const size_t count = std::min(POSTING_BLOCK_SIZE, size_ - begin);
+    if (count == POSTING_BLOCK_SIZE) {
+        unpack_block(packed_.data() + header.offset, header.bit_width, header.first_document_id, document_ids);
+    }
+    else {
+        const uint8_t* in = tail_.data() + header.offset;
+        uint32_t document_id = static_cast<uint32_t>(header.first_document_id);
+        document_ids[0] = header.first_document_id;
+        for (size_t i = 1; i < count; ++i) {
+            document_id += ReadVarint(in);
+            document_ids[i] = static_cast<int>(document_id);
+        }
+    }
+    return count;
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "index_file.h"
+
+constexpr size_t POSTING_BLOCK_SIZE = 128;
+
+// Kernels decoding a full block. The best one the running CPU supports is picked
+// once; the others stay available, so tests can compare them
+enum class UnpackKernel {
+    SCALAR,
+    SSE2,
+    AVX2,
+};
+
+// Kernels usable on the running CPU, from the slowest to the fastest
+std::vector<UnpackKernel> GetSupportedUnpackKernels();
+
+// Compressed form of a posting list.
+// Document ids are split into blocks of POSTING_BLOCK_SIZE. Inside a full block
+// the ids are stored as deltas against the id four positions earlier and bit-packed
+// into four interleaved 32-bit lanes (SIMD-BP128 layout), so a block decodes with a
+// handful of SIMD shifts and adds. The tail block is varint-encoded.
+// Term frequencies are quantized to float.
+// A list loaded from a mapped index file decodes straight from the mapping.
+class CompressedPostingList {
+public:
+    CompressedPostingList() = default;
+    CompressedPostingList(const int* document_ids, const double* term_freqs, size_t count);
+
+    size_t size() const {
+        return size_;
+    }
+    size_t GetBlockCount() const {
+        return (size_ + POSTING_BLOCK_SIZE - 1) / POSTING_BLOCK_SIZE;
+    }
+    int GetBlockLastDocumentId(size_t block) const {
+        return blocks_[block].last_document_id;
+    }
+    double GetBlockMaxTermFreq(size_t block) const {
+        return blocks_[block].max_term_freq;
+    }
+    size_t GetMemoryUsage() const;
+
+    void Save(IndexWriter& writer) const;
+    static CompressedPostingList Load(IndexReader& reader);
+    // First block that may contain document_id or anything greater
+    size_t FindBlock(int document_id) const;
+
+    // Write at most POSTING_BLOCK_SIZE postings and return how many were written
+    size_t DecodeBlock(size_t block, int* document_ids, double* term_freqs) const;
+    size_t DecodeDocumentIds(size_t block, int* document_ids) const;
+    size_t DecodeDocumentIds(size_t block, int* document_ids, UnpackKernel kernel) const;
+
+    template <typename Function>
+    void ForEach(Function function) const;
+    // Visits postings with ids in [first, last)
+    template <typename Function>
+    void ForEachInRange(int first, int last, Function function) const;
+
+private:
+    struct Block {
+        int first_document_id = 0;
+        int last_document_id = 0;
+        float max_term_freq = 0;
+        uint32_t offset = 0;
+        uint8_t bit_width = 0;
+        // Blocks are saved as raw bytes, so the padding is spelled out and zeroed
+        uint8_t reserved[3] = {};
+    };
+    static_assert(sizeof(Block) == 20, "Block must have no padding");
+
+    using UnpackBlockFunction = void (*)(const uint32_t* packed, uint8_t bit_width, int base, int* out);
+
+    size_t size_ = 0;
+    MappableArray<Block> blocks_;
+    MappableArray<uint32_t> packed_;
+    MappableArray<uint8_t> tail_;
+    MappableArray<float> term_freqs_;
+
+    size_t DecodeDocumentIds(size_t block, int* document_ids, UnpackBlockFunction unpack_block) const;
+};
+
+template <typename Function>
+void CompressedPostingList::ForEach(Function function) const {
+    int document_ids[POSTING_BLOCK_SIZE];
+    const float* term_freqs = term_freqs_.data();
+    const size_t block_count = GetBlockCount();
+    for (size_t block = 0; block < block_count; ++block) {
+        const size_t count = DecodeDocumentIds(block, document_ids);
+        for (size_t i = 0; i < count; ++i) {
+            function(document_ids[i], static_cast<double>(term_freqs[i]));
+        }
+        term_freqs += count;
+    }
+}
+
+template <typename Function>
+void CompressedPostingList::ForEachInRange(int first, int last, Function function) const {
+    int document_ids[POSTING_BLOCK_SIZE];
+    const size_t block_count = GetBlockCount();
+    for (size_t block = FindBlock(first); block < block_count; ++block) {
+        const size_t count = DecodeDocumentIds(block, document_ids);
+        const float* term_freqs = term_freqs_.data() + block * POSTING_BLOCK_SIZE;
+        for (size_t i = 0; i < count; ++i) {
+            if (document_ids[i] >= last) {
+                return;
+            }
+            if (document_ids[i] >= first) {
+                function(document_ids[i], static_cast<double>(term_freqs[i]));
+            }
+        }
+    }
+}
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include "posting_list.h"
+
+void PostingList::Add(int document_id, double term_freq) {
+    Decompress();
+    std::vector<int>& document_ids = document_ids_.Modify();
+    std::vector<double>& term_freqs = term_freqs_.Modify();
+    // Documents usually arrive with growing ids, so appending is the common case
+    if (document_ids.empty() || document_ids.back() < document_id) {
+        document_ids.push_back(document_id);
+        term_freqs.push_back(term_freq);
+        std::vector<double>& block_max_term_freqs = block_max_term_freqs_.Modify();
+        if (document_ids.size() % POSTING_BLOCK_SIZE == 1) {
+            block_max_term_freqs.push_back(term_freq);
+        }
+        else {
+            block_max_term_freqs.back() = std::max(block_max_term_freqs.back(), term_freq);
+        }
+        return;
+    }
+    const auto it = std::lower_bound(document_ids.begin(), document_ids.end(), document_id);
+    const auto pos = std::distance(document_ids.begin(), it);
+    if (it != document_ids.end() && *it == document_id) {
+        term_freqs[pos] += term_freq;
+    }
+    else {
+        document_ids.insert(it, document_id);
+        term_freqs.insert(term_freqs.begin() + pos, term_freq);
+    }
+    UpdateBlockMaxTermFreqs(pos);
+}
+
+void PostingList::Erase(int document_id) {
+    Decompress();
+    std::vector<int>& document_ids = document_ids_.Modify();
+    const auto it = std::lower_bound(document_ids.begin(), document_ids.end(), document_id);
+    if (it == document_ids.end() || *it != document_id) {
+        return;
+    }
+    const auto pos = std::distance(document_ids.begin(), it);
+    document_ids.erase(it);
+    std::vector<double>& term_freqs = term_freqs_.Modify();
+    term_freqs.erase(term_freqs.begin() + pos);
+    UpdateBlockMaxTermFreqs(pos);
+}
+
+void PostingList::Compress() {
+    if (is_compressed_) {
+        return;
+    }
+    compressed_ = CompressedPostingList(document_ids_.data(), term_freqs_.data(), document_ids_.size());
+    is_compressed_ = true;
+    document_ids_ = {};
+    term_freqs_ = {};
+    block_max_term_freqs_ = {};
+}
+
+size_t PostingList::GetMemoryUsage() const {
+    return sizeof(*this)
+        + document_ids_.GetMemoryUsage()
+        + term_freqs_.GetMemoryUsage()
+        + block_max_term_freqs_.GetMemoryUsage()
+        + (is_compressed_ ? compressed_.GetMemoryUsage() - sizeof(compressed_) : 0);
+}
+
+void PostingList::Save(IndexWriter& writer) const {
+    writer.WriteNumber(is_compressed_ ? 1 : 0);
+    if (is_compressed_) {
+        compressed_.Save(writer);
+        return;
+    }
+    writer.WriteArray(document_ids_);
+    writer.WriteArray(term_freqs_);
+    writer.WriteArray(block_max_term_freqs_);
+}
+
+PostingList PostingList::Load(IndexReader& reader) {
+    PostingList postings;
+    postings.is_compressed_ = reader.ReadNumber() != 0;
+    if (postings.is_compressed_) {
+        postings.compressed_ = CompressedPostingList::Load(reader);
+        return postings;
+    }
+    postings.document_ids_ = reader.ReadArray<int>();
+    postings.term_freqs_ = reader.ReadArray<double>();
+    postings.block_max_term_freqs_ = reader.ReadArray<double>();
+    if (postings.term_freqs_.size() != postings.document_ids_.size()
+        || postings.block_max_term_freqs_.size() != postings.GetBlockCount()) {
+        throw std::runtime_error("Index file is corrupted");
+    }
+    return postings;
+}
+
+int PostingList::GetBlockLastDocumentId(size_t block) const {
+    if (is_compressed_) {
+        return compressed_.GetBlockLastDocumentId(block);
+    }
+    return document_ids_[std::min(document_ids_.size(), (block + 1) * POSTING_BLOCK_SIZE) - 1];
+}
+
+double PostingList::GetBlockMaxTermFreq(size_t block) const {
+    return is_compressed_ ? compressed_.GetBlockMaxTermFreq(block) : block_max_term_freqs_[block];
+}
+
+double PostingList::GetMaxTermFreq() const {
+    double max_term_freq = 0;
+    for (size_t block = 0; block < GetBlockCount(); ++block) {
+        max_term_freq = std::max(max_term_freq, GetBlockMaxTermFreq(block));
+    }
+    return max_term_freq;
+}
+
+size_t PostingList::ReadBlock(size_t block, const int*& document_ids, const double*& term_freqs,
+    int* document_id_buffer, double* term_freq_buffer) const {
+    if (is_compressed_) {
+        document_ids = document_id_buffer;
+        term_freqs = term_freq_buffer;
+        return compressed_.DecodeBlock(block, document_id_buffer, term_freq_buffer);
+    }
+    const size_t begin = block * POSTING_BLOCK_SIZE;
+    document_ids = document_ids_.data() + begin;
+    term_freqs = term_freqs_.data() + begin;
+    return std::min(POSTING_BLOCK_SIZE, document_ids_.size() - begin);
+}
+
+void PostingList::Decompress() {
+    if (!is_compressed_) {
+        return;
+    }
+    std::vector<int>& document_ids = document_ids_.Modify();
+    std::vector<double>& term_freqs = term_freqs_.Modify();
+    document_ids.reserve(compressed_.size());
+    term_freqs.reserve(compressed_.size());
+    compressed_.ForEach([&document_ids, &term_freqs](int document_id, double term_freq) {
+        document_ids.push_back(document_id);
+        term_freqs.push_back(term_freq);
+    });
+    compressed_ = CompressedPostingList();
+    is_compressed_ = false;
+    UpdateBlockMaxTermFreqs(0);
+}
+
+void PostingList::UpdateBlockMaxTermFreqs(size_t first_position) {
+    // Postings after first_position may have shifted, so every block from there on is recomputed
+    const size_t first_block = first_position / POSTING_BLOCK_SIZE;
+    std::vector<double>& block_max_term_freqs = block_max_term_freqs_.Modify();
+    block_max_term_freqs.resize(GetBlockCount());
+    for (size_t block = first_block; block < block_max_term_freqs.size(); ++block) {
+        const auto begin = term_freqs_.begin() + block * POSTING_BLOCK_SIZE;
+        const auto end = term_freqs_.begin() + std::min(term_freqs_.size(), (block + 1) * POSTING_BLOCK_SIZE);
+        block_max_term_freqs[block] = *std::max_element(begin, end);
+    }
+}
+
+PostingCursor::PostingCursor(const PostingList& postings)
+    : postings_(&postings)
+    , block_count_(postings.GetBlockCount())
+{
+    if (postings.IsCompressed()) {
+        ordinal_buffer_.resize(POSTING_BLOCK_SIZE);
+        term_freq_buffer_.resize(POSTING_BLOCK_SIZE);
+    }
+    if (block_count_ > 0) {
+        LoadBlock(0);
+    }
+}
+
+void PostingCursor::Next() {
+    if (++position_ == block_size_) {
+        LoadBlock(block_ + 1);
+    }
+}
+
+void PostingCursor::Seek(int ordinal) {
+    if (IsEnd() || GetOrdinal() >= ordinal) {
+        return;
+    }
+    size_t block = block_;
+    while (block < block_count_ && postings_->GetBlockLastDocumentId(block) < ordinal) {
+        ++block;
+    }
+    if (block != block_) {
+        LoadBlock(block);
+        if (IsEnd()) {
+            return;
+        }
+    }
+    position_ = std::lower_bound(ordinals_ + position_, ordinals_ + block_size_, ordinal) - ordinals_;
+}
+
+double PostingCursor::GetMaxTermFreqAt(int ordinal) {
+    shallow_block_ = std::max(shallow_block_, block_);
+    while (shallow_block_ < block_count_ && postings_->GetBlockLastDocumentId(shallow_block_) < ordinal) {
+        ++shallow_block_;
+    }
+    return shallow_block_ < block_count_ ? postings_->GetBlockMaxTermFreq(shallow_block_) : 0.0;
+}
+
+void PostingCursor::LoadBlock(size_t block) {
+    block_ = block;
+    position_ = 0;
+    if (block_ >= block_count_) {
+        block_size_ = 0;
+        return;
+    }
+    block_size_ = postings_->ReadBlock(block_, ordinals_, term_freqs_,
+        ordinal_buffer_.data(), term_freq_buffer_.data());
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include "posting_codec.h"
+
+// Postings of a single term: document ids in ascending order with term frequencies
+// stored in a parallel array, so a scan walks two contiguous buffers.
+// Compress() switches the list to the block-packed form of CompressedPostingList;
+// the next modification transparently unpacks it again.
+// Both forms are split into blocks of POSTING_BLOCK_SIZE postings, each with the
+// largest term frequency inside it, which dynamic pruning uses as an upper bound.
+// Lists loaded from a mapped index file are read in place until modified.
+class PostingList {
+public:
+    void Add(int document_id, double term_freq);
+    void Erase(int document_id);
+
+    void Compress();
+    bool IsCompressed() const {
+        return is_compressed_;
+    }
+
+    size_t size() const {
+        return is_compressed_ ? compressed_.size() : document_ids_.size();
+    }
+    bool empty() const {
+        return size() == 0;
+    }
+    size_t GetMemoryUsage() const;
+
+    void Save(IndexWriter& writer) const;
+    static PostingList Load(IndexReader& reader);
+
+    size_t GetBlockCount() const {
+        return (size() + POSTING_BLOCK_SIZE - 1) / POSTING_BLOCK_SIZE;
+    }
+    int GetBlockLastDocumentId(size_t block) const;
+    double GetBlockMaxTermFreq(size_t block) const;
+    double GetMaxTermFreq() const;
+
+    // Points document_ids and term_freqs at the postings of the block. Uncompressed
+    // lists are exposed in place, compressed ones are decoded into the buffers.
+    size_t ReadBlock(size_t block, const int*& document_ids, const double*& term_freqs,
+        int* document_id_buffer, double* term_freq_buffer) const;
+
+    template <typename Function>
+    void ForEach(Function function) const;
+    // Visits postings with ids in [first, last)
+    template <typename Function>
+    void ForEachInRange(int first, int last, Function function) const;
+
+private:
+    MappableArray<int> document_ids_;
+    MappableArray<double> term_freqs_;
+    MappableArray<double> block_max_term_freqs_;
+    CompressedPostingList compressed_;
+    bool is_compressed_ = false;
+
+    void Decompress();
+    void UpdateBlockMaxTermFreqs(size_t first_position);
+};
+
+template <typename Function>
+void PostingList::ForEach(Function function) const {
+    if (is_compressed_) {
+        compressed_.ForEach(function);
+        return;
+    }
+    const int* ids = document_ids_.data();
+    const double* freqs = term_freqs_.data();
+    const size_t count = document_ids_.size();
+    for (size_t i = 0; i < count; ++i) {
+        function(ids[i], freqs[i]);
+    }
+}
+
+template <typename Function>
+void PostingList::ForEachInRange(int first, int last, Function function) const {
+    if (is_compressed_) {
+        compressed_.ForEachInRange(first, last, function);
+        return;
+    }
+    const int* ids = document_ids_.data();
+    const double* freqs = term_freqs_.data();
+    const size_t count = document_ids_.size();
+    for (size_t i = std::lower_bound(ids, ids + count, first) - ids; i < count && ids[i] < last; ++i) {
+        function(ids[i], freqs[i]);
+    }
+}
+
+// Forward-only iterator over a posting list used by document-at-a-time evaluation
+class PostingCursor {
+public:
+    explicit PostingCursor(const PostingList& postings);
+
+    bool IsEnd() const {
+        return block_ >= block_count_;
+    }
+    // Posting lists of SearchServer hold document ordinals, not document ids
+    int GetOrdinal() const {
+        return ordinals_[position_];
+    }
+    double GetTermFreq() const {
+        return term_freqs_[position_];
+    }
+
+    void Next();
+    // Moves to the first posting with ordinal not less than ordinal
+    void Seek(int ordinal);
+    // Upper bound of the term frequency at ordinal without decoding any block;
+    // zero when the list cannot contain it
+    double GetMaxTermFreqAt(int ordinal);
+
+private:
+    const PostingList* postings_;
+    size_t block_count_;
+    size_t block_ = 0;
+    size_t shallow_block_ = 0;
+    size_t position_ = 0;
+    size_t block_size_ = 0;
+    const int* ordinals_ = nullptr;
+    const double* term_freqs_ = nullptr;
+    std::vector<int> ordinal_buffer_;
+    std::vector<double> term_freq_buffer_;
+
+    void LoadBlock(size_t block);
+};
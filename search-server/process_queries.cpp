@@ -1,9 +1,12 @@
 #include <vector>
 #include <execution>
 #include <list>
+#include <numeric>
+#include <algorithm>
 #include "document.h"
 #include "search_server.h"
 #include "process_queries.h"
+#include "query_result_cache.h"
 
 
 std::vector<std::vector<Document>> ProcessQueries(
@@ -21,15 +24,64 @@ std::vector<std::vector<Document>> ProcessQueries(
     return top_documents;
 }
 
-std::vector<Document>ProcessQueriesJoined(
+std::vector<std::vector<Document>> ProcessQueries(
+    const SearchExecutor& executor,
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries) {
+    std::vector<std::vector<Document>> top_documents(queries.size());
+    executor.ForEachIndex(0, queries.size(), [&](size_t i) {
+        top_documents[i] = search_server.FindTopDocuments(queries[i]);
+        });
+    return top_documents;
+}
+
+std::vector<std::vector<Document>> ProcessQueries(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    QueryResultCache& cache) {
+    std::vector<std::vector<Document>> top_documents(queries.size());
+    transform(
+        std::execution::par,
+        queries.begin(),
+        queries.end(),
+        top_documents.begin(),
+        [&search_server, &cache](const std::string& query) {
+            return cache.FindTopDocuments(search_server, query);
+        });
+    return top_documents;
+}
+
+std::vector<std::vector<Document>> ProcessQueriesBatched(
     const SearchServer& search_server,
     const std::vector<std::string>& queries) {
-    std::vector<Document> documents;
-    std::vector<std::vector<Document>> temp = ProcessQueries(search_server, queries);
-    for (auto vec : temp) {
-        for (auto doc : vec) {
-            documents.push_back(doc);
+    return search_server.FindTopDocumentsBatch(queries);
+}
+
+JoinedDocuments ProcessQueriesJoined(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries) {
+    // Every query gets a slot of a full page in the buffer and its worker ranks the
+    // results right there. The offsets are summed up from the counts, then one pass
+    // moves every page down over the unused ends of the slots before it
+    const size_t slot_size = MAX_RESULT_DOCUMENT_COUNT;
+    JoinedDocuments joined;
+    joined.documents_.resize(queries.size() * slot_size);
+    std::vector<size_t> counts(queries.size());
+    std::vector<size_t> indexes(queries.size());
+    std::iota(indexes.begin(), indexes.end(), 0);
+    std::for_each(std::execution::par, indexes.begin(), indexes.end(),
+        [&search_server, &queries, &joined, &counts, slot_size](size_t query) {
+            counts[query] = search_server.FindTopDocumentsInto(queries[query], DocumentStatus::ACTUAL,
+                { 0, slot_size }, joined.documents_.data() + query * slot_size);
+        });
+    joined.offsets_.assign(queries.size() + 1, 0);
+    for (size_t query = 0; query < queries.size(); ++query) {
+        joined.offsets_[query + 1] = joined.offsets_[query] + counts[query];
+        const auto slot = joined.documents_.begin() + query * slot_size;
+        if (joined.offsets_[query] != query * slot_size) {
+            std::move(slot, slot + counts[query], joined.documents_.begin() + joined.offsets_[query]);
         }
     }
-    return documents;
-}
\ No newline at end of file
+    joined.documents_.resize(joined.offsets_.back());
+    return joined;
+}
@@ -2,12 +2,69 @@
 #include <vector>
 #include <list>
 #include "document.h"
+#include "paginator.h"
 #include "search_server.h"
+#include "query_result_cache.h"
 
+class JoinedDocuments;
+
+// Results of all the queries one after another in one buffer, which the parallel
+// workers rank them into directly
+JoinedDocuments ProcessQueriesJoined(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries);
+
+// Results of a batch of queries in one contiguous buffer: the documents of query
+// i are the ones between offsets i and i + 1. Iterates as one flat range of all
+// documents, GetQueryDocuments gives those of one query
+class JoinedDocuments {
+public:
+    using const_iterator = std::vector<Document>::const_iterator;
+
+    JoinedDocuments() = default;
+
+    const_iterator begin() const {
+        return documents_.begin();
+    }
+    const_iterator end() const {
+        return documents_.end();
+    }
+    size_t size() const {
+        return documents_.size();
+    }
+    size_t GetQueryCount() const {
+        return offsets_.size() - 1;
+    }
+    IteratorRange<const_iterator> GetQueryDocuments(size_t query) const {
+        return { documents_.begin() + offsets_.at(query), documents_.begin() + offsets_.at(query + 1) };
+    }
+
+private:
+    std::vector<Document> documents_;
+    std::vector<size_t> offsets_ = { 0 };
+
+    friend JoinedDocuments ProcessQueriesJoined(const SearchServer& search_server,
+        const std::vector<std::string>& queries);
+};
+
+std::vector<std::vector<Document>> ProcessQueries(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries);
+
+// Runs the queries on the executor's pool instead of the standard parallel algorithms
 std::vector<std::vector<Document>> ProcessQueries(
+    const SearchExecutor& executor,
     const SearchServer& search_server,
     const std::vector<std::string>& queries);
 
-std::vector<Document>ProcessQueriesJoined(
+// Answers repeated queries from the cache, which the parallel queries share
+std::vector<std::vector<Document>> ProcessQueries(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    QueryResultCache& cache);
+
+// Same results as ProcessQueries, with posting lists shared by several queries
+// walked once for all of them
+std::vector<std::vector<Document>> ProcessQueriesBatched(
     const SearchServer& search_server,
     const std::vector<std::string>& queries);
\ No newline at end of file
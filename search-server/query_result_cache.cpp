@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include "query_result_cache.h"
+
+namespace {
+
+// Rough cost of the list and hash table nodes of one entry
+constexpr size_t ENTRY_OVERHEAD = 64;
+
+template <typename T>
+void AppendValue(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+}  // namespace
+
+QueryResultCache::QueryResultCache(size_t memory_budget, size_t shard_count)
+    : shard_budget_(memory_budget / std::max<size_t>(1, shard_count))
+    , shards_(std::max<size_t>(1, shard_count))
+{
+}
+
+std::vector<Document> QueryResultCache::FindTopDocuments(const SearchServer& server, std::string_view raw_query,
+    ResultPage page) {
+    return FindTopDocuments(std::execution::seq, server, raw_query, DocumentStatus::ACTUAL, page);
+}
+
+std::vector<Document> QueryResultCache::FindTopDocuments(const SearchServer& server, std::string_view raw_query,
+    DocumentStatus status, ResultPage page) {
+    return FindTopDocuments(std::execution::seq, server, raw_query, status, page);
+}
+
+uint64_t QueryResultCache::GetHitCount() const {
+    return hit_count_.load();
+}
+
+uint64_t QueryResultCache::GetMissCount() const {
+    return miss_count_.load();
+}
+
+size_t QueryResultCache::GetMemoryUsage() const {
+    size_t memory_usage = 0;
+    for (const Shard& shard : shards_) {
+        std::lock_guard guard(shard.mutex);
+        memory_usage += shard.memory_usage;
+    }
+    return memory_usage;
+}
+
+void QueryResultCache::Clear() {
+    for (Shard& shard : shards_) {
+        std::lock_guard guard(shard.mutex);
+        shard.index.clear();
+        shard.entries.clear();
+        shard.memory_usage = 0;
+    }
+}
+
+std::string QueryResultCache::MakeKey(const PreparedQuery& query, DocumentStatus status, ResultPage page) {
+    std::string key;
+    AppendValue(key, status);
+    AppendValue(key, page.offset);
+    AppendValue(key, page.count);
+    // Words hold neither spaces nor a leading '-', so the joined form is unambiguous
+    for (const std::string& word : query.GetPlusWords()) {
+        key += ' ';
+        key += word;
+    }
+    for (const std::string& word : query.GetMinusWords()) {
+        key += " -";
+        key += word;
+    }
+    return key;
+}
+
+QueryResultCache::Shard& QueryResultCache::GetShard(const std::string& key) {
+    return shards_[std::hash<std::string>{}(key) % shards_.size()];
+}
+
+bool QueryResultCache::Find(Shard& shard, const std::string& key, uint64_t generation,
+    std::vector<Document>& documents) {
+    std::lock_guard guard(shard.mutex);
+    const auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        return false;
+    }
+    if (it->second->generation != generation) {
+        Erase(shard, it->second);
+        return false;
+    }
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    documents = it->second->documents;
+    return true;
+}
+
+void QueryResultCache::Insert(Shard& shard, std::string key, uint64_t generation,
+    const std::vector<Document>& documents) {
+    const size_t size = ENTRY_OVERHEAD + sizeof(Entry) + key.size() + documents.size() * sizeof(Document);
+    if (size > shard_budget_) {
+        return;
+    }
+    std::lock_guard guard(shard.mutex);
+    if (const auto it = shard.index.find(key); it != shard.index.end()) {
+        Erase(shard, it->second);
+    }
+    while (shard.memory_usage + size > shard_budget_) {
+        Erase(shard, std::prev(shard.entries.end()));
+    }
+    shard.entries.push_front({ std::move(key), generation, documents, size });
+    shard.index.emplace(shard.entries.front().key, shard.entries.begin());
+    shard.memory_usage += size;
+}
+
+void QueryResultCache::Erase(Shard& shard, std::list<Entry>::iterator entry) {
+    shard.memory_usage -= entry->size;
+    shard.index.erase(entry->key);
+    shard.entries.erase(entry);
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <execution>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "document.h"
+#include "search_server.h"
+
+constexpr size_t DEFAULT_QUERY_CACHE_SHARD_COUNT = 16;
+
+// Top documents of recent queries of a SearchServer, for traffic where a few
+// queries make up most requests. Entries are keyed by the normalized query
+// (sorted unique plus and minus words without stop words), the status and the
+// page, so differently written equal queries share one. Every entry remembers
+// the generation of the server it was computed on and is dropped once the
+// server has changed. The cache is split into shards with their own lock and
+// least recently used order, and keeps their total size within the memory
+// budget; it may be used from many threads at once.
+// Only status filters are cached, an arbitrary predicate has no key
+class QueryResultCache {
+public:
+    explicit QueryResultCache(size_t memory_budget, size_t shard_count = DEFAULT_QUERY_CACHE_SHARD_COUNT);
+
+    std::vector<Document> FindTopDocuments(const SearchServer& server, std::string_view raw_query,
+        ResultPage page = {});
+    std::vector<Document> FindTopDocuments(const SearchServer& server, std::string_view raw_query,
+        DocumentStatus status, ResultPage page = {});
+    // The policy is used by queries missing the cache
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const SearchServer& server,
+        std::string_view raw_query, DocumentStatus status = DocumentStatus::ACTUAL, ResultPage page = {});
+
+    uint64_t GetHitCount() const;
+    uint64_t GetMissCount() const;
+    // Estimated bytes taken by the entries
+    size_t GetMemoryUsage() const;
+    void Clear();
+
+private:
+    struct Entry {
+        std::string key;
+        uint64_t generation;
+        std::vector<Document> documents;
+        size_t size;
+    };
+    struct Shard {
+        mutable std::mutex mutex;
+        // Most recently used first
+        std::list<Entry> entries;
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+        size_t memory_usage = 0;
+    };
+
+    const size_t shard_budget_;
+    std::vector<Shard> shards_;
+    std::atomic<uint64_t> hit_count_{ 0 };
+    std::atomic<uint64_t> miss_count_{ 0 };
+
+    static std::string MakeKey(const PreparedQuery& query, DocumentStatus status, ResultPage page);
+    Shard& GetShard(const std::string& key);
+    bool Find(Shard& shard, const std::string& key, uint64_t generation, std::vector<Document>& documents);
+    void Insert(Shard& shard, std::string key, uint64_t generation, const std::vector<Document>& documents);
+    void Erase(Shard& shard, std::list<Entry>::iterator entry);
+};
+
+template <typename ExecutionPolicy>
+std::vector<Document> QueryResultCache::FindTopDocuments(ExecutionPolicy&& policy, const SearchServer& server,
+    std::string_view raw_query, DocumentStatus status, ResultPage page) {
+    const PreparedQuery query = server.Prepare(raw_query);
+    std::string key = MakeKey(query, status, page);
+    Shard& shard = GetShard(key);
+    const uint64_t generation = server.GetGeneration();
+    std::vector<Document> documents;
+    if (Find(shard, key, generation, documents)) {
+        ++hit_count_;
+        return documents;
+    }
+    ++miss_count_;
+    // The query runs unlocked, concurrent misses of one key compute it each
+    documents = server.FindTopDocuments(policy, query, status, page);
+    Insert(shard, std::move(key), generation, documents);
+    return documents;
+}
@@ -0,0 +1,90 @@
+#include <algorithm>
+#include "query_statistics.h"
+
+QueryStatistics::QueryStatistics(size_t capacity)
+    : slots_(std::max<size_t>(1, capacity))
+{
+}
+
+void QueryStatistics::Record(size_t result_count, std::chrono::nanoseconds latency) {
+    const uint64_t ticket = next_ticket_.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = slots_[ticket % slots_.size()];
+    uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    // A newer record already in the slot is kept
+    if (sequence == WRITING_SEQUENCE || sequence > ticket
+        || !slot.sequence.compare_exchange_strong(sequence, WRITING_SEQUENCE, std::memory_order_acq_rel)) {
+        return;
+    }
+    // Readers must not see the new fields before the slot is marked as being written
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.time.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    slot.latency.store(latency.count(), std::memory_order_relaxed);
+    slot.result_count.store(result_count, std::memory_order_relaxed);
+    slot.sequence.store(ticket + 1, std::memory_order_release);
+}
+
+QueryStatisticsReport QueryStatistics::GetReport(size_t request_count) const {
+    const uint64_t end_ticket = next_ticket_.load(std::memory_order_acquire);
+    const uint64_t first_ticket = end_ticket - std::min<uint64_t>(end_ticket, request_count);
+    std::vector<Sample> samples = ReadSamples();
+    samples.erase(std::remove_if(samples.begin(), samples.end(), [first_ticket](const Sample& sample) {
+        return sample.ticket < first_ticket;
+        }), samples.end());
+    return MakeReport(samples);
+}
+
+QueryStatisticsReport QueryStatistics::GetReport(Clock::duration period) const {
+    const int64_t first_time = (Clock::now() - period).time_since_epoch().count();
+    std::vector<Sample> samples = ReadSamples();
+    samples.erase(std::remove_if(samples.begin(), samples.end(), [first_time](const Sample& sample) {
+        return sample.time < first_time;
+        }), samples.end());
+    return MakeReport(samples);
+}
+
+std::vector<QueryStatistics::Sample> QueryStatistics::ReadSamples() const {
+    std::vector<Sample> samples;
+    samples.reserve(slots_.size());
+    for (const Slot& slot : slots_) {
+        const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence == EMPTY_SEQUENCE || sequence == WRITING_SEQUENCE) {
+            continue;
+        }
+        const Sample sample{ sequence - 1, slot.time.load(std::memory_order_relaxed),
+            slot.latency.load(std::memory_order_relaxed), slot.result_count.load(std::memory_order_relaxed) };
+        // A slot rewritten meanwhile has a different sequence now
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == sequence) {
+            samples.push_back(sample);
+        }
+    }
+    return samples;
+}
+
+QueryStatisticsReport QueryStatistics::MakeReport(const std::vector<Sample>& samples) {
+    QueryStatisticsReport report;
+    report.request_count = samples.size();
+    if (samples.empty()) {
+        return report;
+    }
+    std::vector<int64_t> latencies;
+    latencies.reserve(samples.size());
+    for (const Sample& sample : samples) {
+        if (sample.result_count == 0) {
+            ++report.empty_result_count;
+        }
+        const size_t bucket = std::min<uint64_t>(sample.result_count, report.result_count_histogram.size() - 1);
+        ++report.result_count_histogram[bucket];
+        latencies.push_back(sample.latency);
+    }
+    report.empty_result_rate = report.empty_result_count * 1.0 / samples.size();
+    std::sort(latencies.begin(), latencies.end());
+    const auto percentile = [&latencies](size_t percent) {
+        return std::chrono::nanoseconds(latencies[(latencies.size() - 1) * percent / 100]);
+    };
+    report.latency_p50 = percentile(50);
+    report.latency_p90 = percentile(90);
+    report.latency_p99 = percentile(99);
+    report.latency_max = std::chrono::nanoseconds(latencies.back());
+    return report;
+}
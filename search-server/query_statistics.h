@@ -0,0 +1,79 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "search_server.h"
+
+// Requests of the last day at one request per minute
+constexpr size_t DEFAULT_QUERY_STATISTICS_CAPACITY = 1440;
+
+// Statistics over a window of recorded requests
+struct QueryStatisticsReport {
+    size_t request_count = 0;
+    size_t empty_result_count = 0;
+    double empty_result_rate = 0.0;
+    std::chrono::nanoseconds latency_p50{ 0 };
+    std::chrono::nanoseconds latency_p90{ 0 };
+    std::chrono::nanoseconds latency_p99{ 0 };
+    std::chrono::nanoseconds latency_max{ 0 };
+    // Requests by their result count; the last bucket also holds larger counts
+    std::vector<size_t> result_count_histogram = std::vector<size_t>(MAX_RESULT_DOCUMENT_COUNT + 1, 0);
+};
+
+// Result counts and latencies of the last requests, recorded from any number of
+// threads without a lock. Records live in a fixed ring: a producer takes the next
+// slot with one atomic increment and publishes the record under the slot's
+// sequence number, which readers check before and after reading it. A record is
+// dropped if another producer, a whole ring ahead, is still writing its slot
+class QueryStatistics {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit QueryStatistics(size_t capacity = DEFAULT_QUERY_STATISTICS_CAPACITY);
+
+    void Record(size_t result_count, std::chrono::nanoseconds latency);
+    // Runs the query and records the size of its result and its duration
+    template <typename Query>
+    auto Measure(Query query);
+
+    // Over the last request_count requests, at most the capacity
+    QueryStatisticsReport GetReport(size_t request_count) const;
+    // Over the requests recorded within the period, as far as the ring reaches back
+    QueryStatisticsReport GetReport(Clock::duration period) const;
+
+private:
+    // Sequence of a slot never written and of one being written
+    static constexpr uint64_t EMPTY_SEQUENCE = 0;
+    static constexpr uint64_t WRITING_SEQUENCE = UINT64_MAX;
+
+    struct Slot {
+        // Ticket of the record plus one
+        std::atomic<uint64_t> sequence{ EMPTY_SEQUENCE };
+        std::atomic<int64_t> time{ 0 };
+        std::atomic<int64_t> latency{ 0 };
+        std::atomic<uint64_t> result_count{ 0 };
+    };
+    struct Sample {
+        uint64_t ticket;
+        int64_t time;
+        int64_t latency;
+        uint64_t result_count;
+    };
+
+    std::vector<Slot> slots_;
+    std::atomic<uint64_t> next_ticket_{ 0 };
+
+    // Consistent records of the ring, in no particular order
+    std::vector<Sample> ReadSamples() const;
+    static QueryStatisticsReport MakeReport(const std::vector<Sample>& samples);
+};
+
+template <typename Query>
+auto QueryStatistics::Measure(Query query) {
+    const Clock::time_point start = Clock::now();
+    auto documents = query();
+    Record(documents.size(), Clock::now() - start);
+    return documents;
+}
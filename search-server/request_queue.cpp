@@ -10,13 +10,20 @@ RequestQueue::RequestQueue(const SearchServer& search_server) :
 }
 
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query, DocumentStatus status) {
-    return RequestQueue::AddFindRequest(raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-        return document_status == status;
-        });
+    return RequestQueue::AddFindRequest(raw_query, DocumentStatusFilter{ status });
 }
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query) {
     return RequestQueue::AddFindRequest(raw_query, DocumentStatus::ACTUAL);
 }
+std::vector<Document> RequestQueue::AddFindRequest(const PreparedQuery& query, DocumentStatus status) {
+    return RequestQueue::AddFindRequest(query, DocumentStatusFilter{ status });
+}
+std::vector<Document> RequestQueue::AddFindRequest(const PreparedQuery& query) {
+    return RequestQueue::AddFindRequest(query, DocumentStatus::ACTUAL);
+}
 int RequestQueue::GetNoResultRequests() const {
-    return RequestQueue::empty_results_;
-}
\ No newline at end of file
+    return static_cast<int>(statistics_.GetReport(static_cast<size_t>(min_in_day_)).empty_result_count);
+}
+const QueryStatistics& RequestQueue::GetStatistics() const {
+    return statistics_;
+}
@@ -1,11 +1,13 @@
 #pragma once
 #include <vector>
 #include <string>
-#include <deque>
 #include "request_queue.h"
 #include "search_server.h"
+#include "query_statistics.h"
 #include "document.h"
 
+// Runs queries against the server and keeps statistics of the last requests.
+// Requests may be added from any number of threads
 class RequestQueue {
 public:
     explicit RequestQueue(const SearchServer& search_server);
@@ -14,37 +16,31 @@ public:
     std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate);
     std::vector<Document> AddFindRequest(const std::string& raw_query, DocumentStatus status);
     std::vector<Document> AddFindRequest(const std::string& raw_query);
+    // Same requests for a query the server has prepared once
+    template <typename DocumentPredicate>
+    std::vector<Document> AddFindRequest(const PreparedQuery& query, DocumentPredicate document_predicate);
+    std::vector<Document> AddFindRequest(const PreparedQuery& query, DocumentStatus status);
+    std::vector<Document> AddFindRequest(const PreparedQuery& query);
+    // Requests with no documents among the last day's
     int GetNoResultRequests() const;
+    const QueryStatistics& GetStatistics() const;
 
 private:
-    struct QueryResult {
-        bool is_empty;
-        std::vector<std::string> query_;
-        std::vector<Document> relevant_documents_;
-    };
-    std::deque<QueryResult> requests_;
     const static int min_in_day_ = 1440;
     const SearchServer& server_;
-    int empty_results_ = 0;
+    QueryStatistics statistics_{ min_in_day_ };
 };
 
 template <typename DocumentPredicate>
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate) {
-    std::vector<Document> documents = server_.FindTopDocuments(raw_query, document_predicate);
-    requests_.push_back({ documents.empty(), SplitIntoWords(raw_query), documents });
-
-    if (documents.empty()) {
-        ++empty_results_;
-    }
+    return statistics_.Measure([this, &raw_query, &document_predicate] {
+        return server_.FindTopDocuments(raw_query, document_predicate);
+        });
+}
 
-    if (requests_.size() > min_in_day_) {
-        if (requests_.front().is_empty) {
-            --empty_results_;
-            if (empty_results_ < 0) {
-                empty_results_ = 0;
-            }
-        }
-        requests_.pop_front();
-    }
-    return documents;
-}
\ No newline at end of file
+template <typename DocumentPredicate>
+std::vector<Document> RequestQueue::AddFindRequest(const PreparedQuery& query, DocumentPredicate document_predicate) {
+    return statistics_.Measure([this, &query, &document_predicate] {
+        return server_.FindTopDocuments(query, document_predicate);
+        });
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+// Dense scratch space for query scoring indexed by document ordinal.
+// Every slot carries the tag of the query that last touched it, so starting a new
+// query is a single increment instead of clearing the arrays. A slot tagged with
+// the current epoch holds a score, the odd tag right after it marks an excluded
+// document. Scored slots are also remembered in the touched list, which drives
+// collection without walking the whole array.
+class ScoreAccumulator {
+public:
+    void Reset(size_t ordinal_count) {
+        if (tags_.size() < ordinal_count) {
+            tags_.resize(ordinal_count, 0);
+            scores_.resize(ordinal_count);
+        }
+        touched_.clear();
+        epoch_ += 2;
+        if (epoch_ == 0) {
+            // The tag counter wrapped around, stale tags could alias the new epoch
+            std::fill(tags_.begin(), tags_.end(), 0);
+            epoch_ = 2;
+        }
+    }
+
+    void Add(int ordinal, double score) {
+        uint32_t& tag = tags_[ordinal];
+        if (tag == epoch_) {
+            scores_[ordinal] += score;
+        }
+        else if (tag != epoch_ + 1) {
+            tag = epoch_;
+            scores_[ordinal] = score;
+            touched_.push_back(ordinal);
+        }
+    }
+
+    void Exclude(int ordinal) {
+        tags_[ordinal] = epoch_ + 1;
+    }
+
+    template <typename Function>
+    void ForEachScored(Function function) const {
+        for (const int ordinal : touched_) {
+            if (tags_[ordinal] == epoch_) {
+                function(ordinal, scores_[ordinal]);
+            }
+        }
+    }
+
+private:
+    uint32_t epoch_ = 0;
+    std::vector<uint32_t> tags_;
+    std::vector<double> scores_;
+    std::vector<int> touched_;
+};
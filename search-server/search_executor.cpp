@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include "search_executor.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+// Pool the calling thread works for and its index there
+thread_local const SearchExecutor* current_executor = nullptr;
+thread_local size_t current_worker = 0;
+
+void CheckCpu(int cpu) {
+#if defined(__linux__)
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        throw std::invalid_argument("CPU " + std::to_string(cpu) + " is invalid");
+    }
+#else
+    if (cpu < 0) {
+        throw std::invalid_argument("CPU " + std::to_string(cpu) + " is invalid");
+    }
+#endif
+}
+
+void PinThread(std::thread& thread, int cpu) {
+#if defined(__linux__)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    if (pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set), &cpu_set) != 0) {
+        throw std::runtime_error("Cannot pin a thread to CPU " + std::to_string(cpu));
+    }
+#else
+    (void)thread;
+    (void)cpu;
+#endif
+}
+
+}  // namespace
+
+SearchExecutor::SearchExecutor(size_t thread_count, const std::vector<int>& cpus) {
+    std::for_each(cpus.begin(), cpus.end(), CheckCpu);
+    if (thread_count == 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    try {
+        for (size_t i = 0; i < thread_count; ++i) {
+            workers_[i]->thread = std::thread(&SearchExecutor::WorkerLoop, this, i);
+            if (!cpus.empty()) {
+                PinThread(workers_[i]->thread, cpus[i % cpus.size()]);
+            }
+        }
+    }
+    catch (...) {
+        Stop();
+        throw;
+    }
+}
+
+SearchExecutor::~SearchExecutor() {
+    Stop();
+}
+
+size_t SearchExecutor::GetThreadCount() const {
+    return workers_.size();
+}
+
+void SearchExecutor::Run(size_t first, size_t last, const RangeFunction& function) const {
+    if (first >= last) {
+        return;
+    }
+    const size_t task_count = std::min(last - first, TASKS_PER_EXECUTOR_THREAD * workers_.size());
+    if (task_count <= 1) {
+        function(first, last);
+        return;
+    }
+    TaskGroup group;
+    group.pending = task_count;
+    const size_t self = GetCurrentWorker();
+    const size_t task_size = (last - first) / task_count;
+    const size_t larger_task_count = (last - first) % task_count;
+    size_t task_first = first;
+    for (size_t i = 0; i < task_count; ++i) {
+        const size_t task_last = task_first + task_size + (i < larger_task_count ? 1 : 0);
+        // A worker queues its tasks to itself and lets idle workers steal them;
+        // an outside thread spreads them over the pool
+        Push(self < workers_.size() ? self : i % workers_.size(), { &function, task_first, task_last, &group });
+        task_first = task_last;
+    }
+
+    Task task;
+    while (true) {
+        {
+            std::lock_guard lock(group.mutex);
+            if (group.pending == 0) {
+                break;
+            }
+        }
+        if (TryTake(self, task)) {
+            Execute(task);
+            continue;
+        }
+        // Every remaining task of the group is running on another thread
+        std::unique_lock lock(group.mutex);
+        group.done.wait(lock, [&group] { return group.pending == 0; });
+        break;
+    }
+    // The group is checked under its lock, so no thread touches it any more
+    std::lock_guard lock(group.mutex);
+    if (group.exception) {
+        std::rethrow_exception(group.exception);
+    }
+}
+
+void SearchExecutor::Push(size_t worker, const Task& task) const {
+    // Counted before it is queued, so the count never drops below the queued tasks
+    {
+        std::lock_guard lock(idle_mutex_);
+        ++queued_task_count_;
+        idle_.notify_one();
+    }
+    std::lock_guard lock(workers_[worker]->mutex);
+    workers_[worker]->tasks.push_back(task);
+}
+
+bool SearchExecutor::TryTake(size_t worker, Task& task) const {
+    const size_t worker_count = workers_.size();
+    for (size_t i = 0; i < worker_count; ++i) {
+        // An outside thread starts stealing from worker 0
+        const size_t victim = worker < worker_count ? (worker + i) % worker_count : i;
+        Worker& queue = *workers_[victim];
+        std::lock_guard lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        if (victim == worker) {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+        }
+        else {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+        }
+        std::lock_guard idle_lock(idle_mutex_);
+        --queued_task_count_;
+        return true;
+    }
+    return false;
+}
+
+void SearchExecutor::Execute(const Task& task) {
+    std::exception_ptr exception;
+    try {
+        (*task.function)(task.first, task.last);
+    }
+    catch (...) {
+        exception = std::current_exception();
+    }
+    TaskGroup& group = *task.group;
+    std::lock_guard lock(group.mutex);
+    if (exception && !group.exception) {
+        group.exception = exception;
+    }
+    if (--group.pending == 0) {
+        group.done.notify_all();
+    }
+}
+
+void SearchExecutor::WorkerLoop(size_t worker) {
+    current_executor = this;
+    current_worker = worker;
+    Task task;
+    while (true) {
+        if (TryTake(worker, task)) {
+            Execute(task);
+            continue;
+        }
+        std::unique_lock lock(idle_mutex_);
+        idle_.wait(lock, [this] { return stopping_ || queued_task_count_ > 0; });
+        if (stopping_ && queued_task_count_ == 0) {
+            return;
+        }
+    }
+}
+
+void SearchExecutor::Stop() {
+    {
+        std::lock_guard lock(idle_mutex_);
+        stopping_ = true;
+    }
+    idle_.notify_all();
+    for (auto& worker : workers_) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+size_t SearchExecutor::GetCurrentWorker() const {
+    return current_executor == this ? current_worker : workers_.size();
+}
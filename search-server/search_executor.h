@@ -0,0 +1,101 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Tasks a parallel call is split into per pool thread, so stealing can even out
+// tasks of different cost
+constexpr size_t TASKS_PER_EXECUTOR_THREAD = 4;
+
+// Fixed pool of threads for the parallel overloads of SearchServer, passed in
+// place of std::execution::par. Every worker keeps its own task deque and steals
+// from the others once it is empty. A thread waiting for the tasks of its call
+// runs queued tasks meanwhile, so nested calls share the pool threads and never
+// start more. A task must not wait while it holds thread-local state, such as the
+// thread's score accumulator, that other tasks use.
+// Workers are pinned to the given CPUs in turn; pinning is supported on Linux only
+class SearchExecutor {
+public:
+    // thread_count = 0 takes the number of hardware threads
+    explicit SearchExecutor(size_t thread_count = 0, const std::vector<int>& cpus = {});
+    SearchExecutor(const SearchExecutor&) = delete;
+    SearchExecutor& operator=(const SearchExecutor&) = delete;
+    ~SearchExecutor();
+
+    size_t GetThreadCount() const;
+
+    // Calls function(index) for every index of [first, last) on the pool and the
+    // calling thread, and returns once all calls are done. The first exception
+    // thrown by a call is rethrown
+    template <typename Function>
+    void ForEachIndex(size_t first, size_t last, Function function) const;
+    // Same over the elements of a random access range
+    template <typename Iterator, typename Function>
+    void ForEach(Iterator first, Iterator last, Function function) const;
+
+private:
+    using RangeFunction = std::function<void(size_t first, size_t last)>;
+
+    // Tasks of one call; the calling thread waits until none are left
+    struct TaskGroup {
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t pending = 0;
+        std::exception_ptr exception;
+    };
+    struct Task {
+        const RangeFunction* function = nullptr;
+        size_t first = 0;
+        size_t last = 0;
+        TaskGroup* group = nullptr;
+    };
+    struct Worker {
+        std::mutex mutex;
+        // The owner takes from the back, thieves from the front
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    mutable std::mutex idle_mutex_;
+    mutable std::condition_variable idle_;
+    mutable size_t queued_task_count_ = 0;
+    bool stopping_ = false;
+
+    void Run(size_t first, size_t last, const RangeFunction& function) const;
+    void Push(size_t worker, const Task& task) const;
+    // Own tasks first, then stolen ones
+    bool TryTake(size_t worker, Task& task) const;
+    static void Execute(const Task& task);
+    void WorkerLoop(size_t worker);
+    void Stop();
+    // Index of the calling thread in this pool, workers_.size() if it is not a worker
+    size_t GetCurrentWorker() const;
+};
+
+template <typename Function>
+void SearchExecutor::ForEachIndex(size_t first, size_t last, Function function) const {
+    const RangeFunction range_function = [&function](size_t range_first, size_t range_last) {
+        for (size_t index = range_first; index < range_last; ++index) {
+            function(index);
+        }
+    };
+    Run(first, last, range_function);
+}
+
+template <typename Iterator, typename Function>
+void SearchExecutor::ForEach(Iterator first, Iterator last, Function function) const {
+    static_assert(std::is_base_of_v<std::random_access_iterator_tag,
+        typename std::iterator_traits<Iterator>::iterator_category>, "ForEach needs random access iterators");
+    ForEachIndex(0, static_cast<size_t>(last - first), [first, &function](size_t index) {
+        function(first[index]);
+    });
+}
@@ -9,13 +9,28 @@
 #include <numeric>
 #include <execution>
 #include <string_view>
+#include <deque>
+#include <thread>
+#include <exception>
+#include <future>
+#include <chrono>
+#include <memory>
 #include "string_processing.h"
 #include "document.h"
 #include "search_server.h"
 #include "concurrent_map.h"
+#include "posting_list.h"
+#include "score_accumulator.h"
 
 using namespace std;
 
+void CorpusStatistics::Merge(const CorpusStatistics& other) {
+    document_count += other.document_count;
+    for (const auto& [word, document_freq] : other.document_freqs) {
+        document_freqs[word] += document_freq;
+    }
+}
+
 SearchServer::SearchServer(const std::string& stop_words_text)
     : SearchServer(SplitIntoWords(stop_words_text))  // Invoke delegating constructor from string container
 {
@@ -26,63 +41,575 @@ SearchServer::SearchServer(std::string_view stop_words_text)
 {
 }
 
+SearchServer::SearchServer(std::shared_ptr<const MappedFile> mapped_file, IndexReader reader)
+    : SearchServer(ReadStopWords(reader))
+{
+    mapped_file_ = std::move(mapped_file);
+    LoadIndex(reader);
+    PublishSnapshot();
+}
+
 void SearchServer::AddDocument(int document_id, std::string_view document, DocumentStatus status,
     const std::vector<int>& ratings) {
-    if ((document_id < 0) || (documents_.count(document_id) > 0)) {
+    if ((document_id < 0) || (document_ordinals_.Find(document_id) != nullptr)) {
         throw std::invalid_argument("Invalid document_id");
     }
-    auto current_doc = documents_in_strings_.insert(static_cast<std::string>(document));
-    const std::vector<std::string_view> words = SplitIntoWordsNoStop(*current_doc.first);
-    const double inv_word_count = 1.0 / words.size();
-    for (std::string_view word : words) {
-        word_to_document_freqs_[word][document_id] += inv_word_count;
-        id_to_document_freqs_[document_id][word] += inv_word_count;
+    // Word views are interned by RegisterDocument, so the text itself is not kept
+    const auto word_freqs = ComputeWordFreqs(document);
+    std::vector<TermPosting> term_postings;
+    RegisterDocument(document_id, word_freqs, status, ComputeAverageRating(ratings), term_postings);
+    auto& postings = postings_.Modify();
+    for (const TermPosting& posting : term_postings) {
+        postings[posting.term_id].Modify().Add(posting.ordinal, posting.term_freq);
     }
-    documents_.emplace(document_id, DocumentData{ SearchServer::ComputeAverageRating(ratings), status });
-    document_ids_.insert(document_id);
+    InstallFinishedCompaction();
 }
 
-std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status) const {
-    return FindTopDocuments(
-        raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-            return document_status == status;
+std::vector<RejectedDocument> SearchServer::AddDocuments(const std::vector<DocumentToAdd>& batch) {
+    // Tokenizing is independent for every document and runs in parallel
+    struct TokenizedDocument {
+        std::map<std::string_view, double> word_freqs;
+        std::string error;
+    };
+    std::vector<TokenizedDocument> tokenized(batch.size());
+    std::transform(std::execution::par, batch.begin(), batch.end(), tokenized.begin(),
+        [this](const DocumentToAdd& document) {
+            TokenizedDocument result;
+            try {
+                result.word_freqs = ComputeWordFreqs(document.document);
+            }
+            catch (const std::invalid_argument& e) {
+                result.error = e.what();
+            }
+            return result;
         });
+
+    // Ids are checked and ordinals given in batch order, so duplicates inside the
+    // batch are rejected exactly as with consecutive AddDocument calls
+    std::vector<RejectedDocument> rejected;
+    std::vector<TermPosting> term_postings;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        const DocumentToAdd& document = batch[i];
+        if ((document.document_id < 0) || (document_ordinals_.Find(document.document_id) != nullptr)) {
+            rejected.push_back({ i, document.document_id, "Invalid document_id" });
+            continue;
+        }
+        if (!tokenized[i].error.empty()) {
+            rejected.push_back({ i, document.document_id, std::move(tokenized[i].error) });
+            continue;
+        }
+        RegisterDocument(document.document_id, tokenized[i].word_freqs,
+            document.status, ComputeAverageRating(document.ratings), term_postings);
+    }
+    AppendPostings(term_postings);
+    InstallFinishedCompaction();
+    return rejected;
 }
 
-std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query) const {
-    return SearchServer::FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
+void SearchServer::AddDocumentsFrom(const SearchServer& other, const ChunkedOrdinalBitmap& excluded) {
+    other.document_ordinals_.ForEach([this, &excluded](int document_id, int ordinal) {
+        if (!excluded.Test(ordinal) && document_ordinals_.Find(document_id) != nullptr) {
+            throw std::invalid_argument("Invalid document_id");
+        }
+        });
+    std::vector<TermPosting> term_postings;
+    for (size_t ordinal = 0; ordinal < other.ordinal_to_document_id_.size(); ++ordinal) {
+        const int document_id = other.ordinal_to_document_id_[ordinal];
+        if (document_id < 0 || excluded.Test(static_cast<int>(ordinal))) {
+            continue;
+        }
+        RegisterDocument(document_id, *other.document_word_freqs_[ordinal],
+            other.document_statuses_[ordinal], other.document_ratings_[ordinal], term_postings);
+    }
+    AppendPostings(term_postings);
+    InstallFinishedCompaction();
 }
 
-int SearchServer::GetDocumentCount() const {
-    return documents_.size();
+void SearchServer::EraseDocument(int document_id, int ordinal) {
+    generation_ = NewVersion();
+    ordinal_to_document_id_.Modify(ordinal) = -1;
+    status_bitmaps_[static_cast<size_t>(document_statuses_[ordinal])].Reset(ordinal);
+    document_word_freqs_.Modify(ordinal).reset();
+    document_ordinals_.Erase(document_id);
+    writer_state_.document_ids.erase(document_id);
+    ++removed_document_count_;
+    InstallFinishedCompaction();
+    if (!pending_compaction_.index.valid()
+        && removed_document_count_ > MAX_REMOVED_DOCUMENT_SHARE * ordinal_to_document_id_.size()) {
+        // The copy shares the index with this server, whose updates copy what they change
+        const std::shared_ptr<const SearchServer> frozen(new SearchServer(*this));
+        pending_compaction_.index = std::async(std::launch::async, [frozen] {
+            return frozen->BuildCompactedIndex();
+            });
+    }
 }
 
-std::set<int>::iterator SearchServer::begin() {
-    return document_ids_.begin();
+void SearchServer::AppendPostings(const std::vector<TermPosting>& term_postings) {
+
+    // Postings are bucketed by term keeping the ordinal order, then every posting
+    // list is extended by its own task
+    std::vector<size_t> term_offsets(terms_->size() + 1, 0);
+    for (const TermPosting& posting : term_postings) {
+        ++term_offsets[posting.term_id + 1];
+    }
+    std::partial_sum(term_offsets.begin(), term_offsets.end(), term_offsets.begin());
+    std::vector<TermPosting> sorted_postings(term_postings.size());
+    std::vector<size_t> positions(term_offsets.begin(), term_offsets.end() - 1);
+    for (const TermPosting& posting : term_postings) {
+        sorted_postings[positions[posting.term_id]++] = posting;
+    }
+    std::vector<uint32_t> touched_terms;
+    for (uint32_t term_id = 0; term_id < terms_->size(); ++term_id) {
+        if (term_offsets[term_id] != term_offsets[term_id + 1]) {
+            touched_terms.push_back(term_id);
+        }
+    }
+    auto& term_postings_by_id = postings_.Modify();
+    std::for_each(std::execution::par, touched_terms.begin(), touched_terms.end(),
+        [&](uint32_t term_id) {
+            PostingList& postings = term_postings_by_id[term_id].Modify();
+            for (size_t i = term_offsets[term_id]; i < term_offsets[term_id + 1]; ++i) {
+                postings.Add(sorted_postings[i].ordinal, sorted_postings[i].term_freq);
+            }
+        });
 }
 
-std::set<int>::iterator SearchServer::end() {
-    return document_ids_.end();
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+    ResultPage page) const {
+    return FindTopDocuments(raw_query, DocumentStatusFilter{ status }, page);
 }
 
-const std::map<std::string_view, double>& SearchServer::GetWordFrequencies(int document_id) const {
-    try {
-        const std::map<std::string_view, double>& key = id_to_document_freqs_.at(document_id);
-        return key;
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, ResultPage page) const {
+    return SearchServer::FindTopDocuments(raw_query, DocumentStatus::ACTUAL, page);
+}
+
+PreparedQuery SearchServer::Prepare(std::string_view raw_query) const {
+    const Query parsed = ParseQueryUnique(std::execution::seq, raw_query);
+    PreparedQuery query;
+    for (std::string_view word : parsed.plus_words) {
+        query.plus_words_.emplace_back(word);
+        query.plus_term_ids_.push_back(FindTermId(word));
+    }
+    for (std::string_view word : parsed.minus_words) {
+        query.minus_words_.emplace_back(word);
+        query.minus_term_ids_.push_back(FindTermId(word));
+    }
+    query.dictionary_version_ = dictionary_version_;
+    return query;
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const PreparedQuery& query, DocumentStatus status,
+    ResultPage page) const {
+    return FindTopDocuments(query, DocumentStatusFilter{ status }, page);
+}
+
+std::vector<Document> SearchServer::FindTopDocuments(const PreparedQuery& query, ResultPage page) const {
+    return FindTopDocuments(query, DocumentStatus::ACTUAL, page);
+}
+
+std::vector<std::vector<Document>> SearchServer::FindTopDocumentsBatch(
+    const std::vector<std::string>& raw_queries, DocumentStatus status, ResultPage page) const {
+    std::vector<std::vector<Document>> top_documents(raw_queries.size());
+    if (page.count == 0) {
+        return top_documents;
+    }
+    // Invalid queries fail the batch with the error of the first one
+    std::vector<QueryTerms> queries(raw_queries.size());
+    std::vector<std::exception_ptr> errors(raw_queries.size());
+    std::vector<size_t> query_indexes(raw_queries.size());
+    std::iota(query_indexes.begin(), query_indexes.end(), 0);
+    std::for_each(std::execution::par, query_indexes.begin(), query_indexes.end(),
+        [&](size_t i) {
+            try {
+                queries[i] = ResolveQuery(ParseQueryUnique(std::execution::seq, raw_queries[i]), nullptr);
+            }
+            catch (...) {
+                errors[i] = std::current_exception();
+            }
+        });
+    for (const std::exception_ptr& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // Chunks are the parallel tasks: enough of them to keep every thread busy, each
+    // as large as allowed, since only queries of one chunk share posting walks
+    const size_t task_count = 4 * std::max<size_t>(1, std::thread::hardware_concurrency());
+    const size_t chunk_size = std::clamp<size_t>((queries.size() + task_count - 1) / task_count,
+        1, BATCH_ACCUMULATOR_SIZE / MIN_BATCH_PARTITION_SIZE);
+    const int ordinal_count = static_cast<int>(ordinal_to_document_id_.size());
+    const int partition_size = static_cast<int>(BATCH_ACCUMULATOR_SIZE / chunk_size);
+    const size_t top_count = page.offset + page.count;
+    std::vector<size_t> chunk_begins;
+    for (size_t begin = 0; begin < queries.size(); begin += chunk_size) {
+        chunk_begins.push_back(begin);
+    }
+
+    std::for_each(std::execution::par, chunk_begins.begin(), chunk_begins.end(), [&](size_t chunk_begin) {
+        const size_t chunk_end = std::min(queries.size(), chunk_begin + chunk_size);
+        // Plus words of every query come sorted and terms are walked in the order of
+        // their words, so each document sums its contributions as FindTopDocuments does
+        struct PlusQuery {
+            size_t query;
+            double inverse_document_freq;
+        };
+        struct TermGroup {
+            const PostingList* postings = nullptr;
+            std::vector<PlusQuery> plus_queries;
+            std::vector<size_t> minus_queries;
+        };
+        std::map<std::string_view, TermGroup> plus_groups;
+        std::map<const PostingList*, TermGroup> minus_groups;
+        for (size_t query = chunk_begin; query < chunk_end; ++query) {
+            for (const QueryTerm& term : queries[query].plus_terms) {
+                TermGroup& group = plus_groups[*(*terms_)[term.term_id]];
+                group.postings = term.postings;
+                group.plus_queries.push_back({ query - chunk_begin, term.inverse_document_freq });
+            }
+            for (const PostingList* postings : queries[query].minus_terms) {
+                TermGroup& group = minus_groups[postings];
+                group.postings = postings;
+                group.minus_queries.push_back(query - chunk_begin);
+            }
+        }
+        // Every posting list is walked once, partition after partition
+        std::vector<std::pair<const TermGroup*, PostingCursor>> minus_cursors;
+        for (const auto& [postings, group] : minus_groups) {
+            minus_cursors.emplace_back(&group, PostingCursor(*postings));
+        }
+        std::vector<std::pair<const TermGroup*, PostingCursor>> plus_cursors;
+        for (const auto& [word, group] : plus_groups) {
+            plus_cursors.emplace_back(&group, PostingCursor(*group.postings));
+        }
+
+        // Once a query has a full top, documents below all of it by more than the
+        // tolerance cannot enter it and are not collected
+        std::vector<double> min_relevances(chunk_end - chunk_begin, -std::numeric_limits<double>::infinity());
+        // The slot of a document for a query is in the query's row of the partition
+        ScoreAccumulator& document_to_relevance = GetThreadScoreAccumulator();
+        DocumentStatusFilter status_filter{ status };
+        for (int first = 0; first < ordinal_count; first += partition_size) {
+            const int last = std::min(ordinal_count, first + partition_size);
+            const auto slot = [first, partition_size](size_t query, int ordinal) {
+                return static_cast<int>(query * partition_size) + ordinal - first;
+            };
+            document_to_relevance.Reset(chunk_size * partition_size);
+            for (auto& [group, cursor] : minus_cursors) {
+                for (; !cursor.IsEnd() && cursor.GetOrdinal() < last; cursor.Next()) {
+                    for (const size_t query : group->minus_queries) {
+                        document_to_relevance.Exclude(slot(query, cursor.GetOrdinal()));
+                    }
+                }
+            }
+            for (auto& [group, cursor] : plus_cursors) {
+                for (; !cursor.IsEnd() && cursor.GetOrdinal() < last; cursor.Next()) {
+                    const int ordinal = cursor.GetOrdinal();
+                    if (!IsAccepted(ordinal, status_filter)) {
+                        continue;
+                    }
+                    for (const PlusQuery& plus_query : group->plus_queries) {
+                        document_to_relevance.Add(slot(plus_query.query, ordinal),
+                            cursor.GetTermFreq() * plus_query.inverse_document_freq);
+                    }
+                }
+            }
+            document_to_relevance.ForEachScored([&](int slot_index, double relevance) {
+                const size_t query = slot_index / partition_size;
+                if (relevance < min_relevances[query]) {
+                    return;
+                }
+                const int ordinal = first + slot_index % partition_size;
+                std::vector<Document>& documents = top_documents[chunk_begin + query];
+                documents.push_back({ ordinal_to_document_id_[ordinal], relevance, document_ratings_[ordinal] });
+                // Candidates are cut back to the top once they double it
+                if (documents.size() >= top_count && documents.size() - top_count >= top_count) {
+                    SelectPage(documents, { 0, top_count });
+                    const auto least_relevant = std::min_element(documents.begin(), documents.end(),
+                        [](const Document& lhs, const Document& rhs) { return lhs.relevance < rhs.relevance; });
+                    min_relevances[query] = least_relevant->relevance - TOLERANCE;
+                }
+            });
+        }
+        for (size_t query = chunk_begin; query < chunk_end; ++query) {
+            SelectPage(top_documents[query], page);
+        }
+    });
+    return top_documents;
+}
+
+size_t SearchServer::FindTopDocumentsInto(std::string_view raw_query, DocumentStatus status, ResultPage page,
+    Document* output) const {
+    const QueryTerms query = ResolveQuery(ParseQueryUnique(std::execution::seq, raw_query), nullptr);
+    const DocumentStatusFilter document_predicate{ status };
+    if (page.count == 0) {
+        return 0;
+    }
+    TopDocumentHeap top_documents(output, page.offset + page.count);
+    if (query_evaluation_.value == QueryEvaluation::PRUNED) {
+        CollectTopDocumentsPruned(query, document_predicate, top_documents);
+    }
+    else {
+        ScoreAccumulator& document_to_relevance = ScoreAllDocuments(query, document_predicate);
+        document_to_relevance.ForEachScored([this, &top_documents](int ordinal, double relevance) {
+            top_documents.Push({ ordinal_to_document_id_[ordinal], relevance, document_ratings_[ordinal] });
+        });
+    }
+    return top_documents.ExtractPage(page.offset);
+}
+
+BudgetedDocuments SearchServer::FindTopDocuments(std::string_view raw_query, QueryBudget budget,
+    ResultPage page) const {
+    return FindTopDocuments(raw_query, budget, DocumentStatus::ACTUAL, page);
+}
+
+BudgetedDocuments SearchServer::FindTopDocuments(std::string_view raw_query, QueryBudget budget,
+    DocumentStatus status, ResultPage page) const {
+    const QueryTerms query = ResolveQuery(ParseQueryUnique(std::execution::seq, raw_query), nullptr);
+    DocumentStatusFilter document_predicate{ status };
+    ScoreAccumulator& document_to_relevance = GetThreadScoreAccumulator();
+    document_to_relevance.Reset(ordinal_to_document_id_.size());
+    for (const PostingList* postings : query.minus_terms) {
+        postings->ForEach([&document_to_relevance](int ordinal, double) {
+            document_to_relevance.Exclude(ordinal);
+        });
+    }
+
+    std::vector<size_t> term_order(query.plus_terms.size());
+    std::iota(term_order.begin(), term_order.end(), 0);
+    std::stable_sort(term_order.begin(), term_order.end(), [&query](size_t lhs, size_t rhs) {
+        return query.plus_terms[lhs].inverse_document_freq > query.plus_terms[rhs].inverse_document_freq;
+        });
+    const bool has_deadline = budget.deadline != std::chrono::steady_clock::time_point::max();
+    BudgetedDocuments result;
+    size_t scored_postings = 0;
+    size_t unchecked_blocks = 0;
+    int document_id_buffer[POSTING_BLOCK_SIZE];
+    double term_freq_buffer[POSTING_BLOCK_SIZE];
+    for (const size_t term_index : term_order) {
+        const QueryTerm& term = query.plus_terms[term_index];
+        if (term.postings->size() > budget.max_postings - scored_postings) {
+            result.is_partial = true;
+            break;
+        }
+        for (size_t block = 0; block < term.postings->GetBlockCount(); ++block) {
+            if (has_deadline && unchecked_blocks++ % DEADLINE_CHECK_BLOCKS == 0
+                && std::chrono::steady_clock::now() >= budget.deadline) {
+                result.is_partial = true;
+                break;
+            }
+            const int* ordinals;
+            const double* term_freqs;
+            const size_t count = term.postings->ReadBlock(block, ordinals, term_freqs,
+                document_id_buffer, term_freq_buffer);
+            for (size_t i = 0; i < count; ++i) {
+                if (IsAccepted(ordinals[i], document_predicate)) {
+                    document_to_relevance.Add(ordinals[i], term_freqs[i] * term.inverse_document_freq);
+                }
+            }
+        }
+        if (result.is_partial) {
+            break;
+        }
+        scored_postings += term.postings->size();
+    }
+
+    std::vector<Document>& documents = result.documents;
+    document_to_relevance.ForEachScored([this, &documents](int ordinal, double relevance) {
+        documents.push_back({ ordinal_to_document_id_[ordinal], relevance, document_ratings_[ordinal] });
+    });
+    SelectPage(documents, { 0, page.offset + page.count });
+    if (!result.is_partial) {
+        // Summed again in query word order, so relevance is bit-identical to FindTopDocuments
+        for (Document& document : documents) {
+            const int ordinal = *document_ordinals_.Find(document.id);
+            double relevance = 0;
+            for (const QueryTerm& term : query.plus_terms) {
+                PostingCursor cursor(*term.postings);
+                cursor.Seek(ordinal);
+                if (!cursor.IsEnd() && cursor.GetOrdinal() == ordinal) {
+                    relevance += cursor.GetTermFreq() * term.inverse_document_freq;
+                }
+            }
+            document.relevance = relevance;
+        }
+        std::sort(documents.begin(), documents.end(), IsMoreRelevant);
+    }
+    documents.erase(documents.begin(), documents.begin() + std::min(page.offset, documents.size()));
+    return result;
+}
+
+std::future<std::vector<Document>> SearchServer::FindTopDocumentsAsync(AsyncQueryExecutor& executor,
+    std::string_view raw_query, DocumentStatus status, ResultPage page) const {
+    auto promise = std::make_shared<std::promise<std::vector<Document>>>();
+    std::future<std::vector<Document>> documents = promise->get_future();
+    const bool is_submitted = executor.TrySubmit(
+        [this, query = std::string(raw_query), status, page, promise] {
+            try {
+                promise->set_value(FindTopDocuments(query, status, page));
+            }
+            catch (...) {
+                promise->set_exception(std::current_exception());
+            }
+        });
+    if (!is_submitted) {
+        throw std::runtime_error("Query queue is full");
+    }
+    return documents;
+}
+
+std::future<std::vector<Document>> SearchServer::FindTopDocumentsAsync(std::string_view raw_query,
+    DocumentStatus status, ResultPage page) const {
+    return FindTopDocumentsAsync(AsyncQueryExecutor::GetDefault(), raw_query, status, page);
+}
+
+#ifdef SEARCH_SERVER_HAS_COROUTINES
+
+AsyncQueryAwaitable<std::vector<Document>> SearchServer::FindTopDocumentsAwaitable(AsyncQueryExecutor& executor,
+    std::string_view raw_query, DocumentStatus status, ResultPage page) const {
+    return AsyncQueryAwaitable<std::vector<Document>>(executor,
+        [this, query = std::string(raw_query), status, page] {
+            return FindTopDocuments(query, status, page);
+        });
+}
+
+AsyncQueryAwaitable<std::vector<Document>> SearchServer::FindTopDocumentsAwaitable(std::string_view raw_query,
+    DocumentStatus status, ResultPage page) const {
+    return FindTopDocumentsAwaitable(AsyncQueryExecutor::GetDefault(), raw_query, status, page);
+}
+
+#endif
+
+CorpusStatistics SearchServer::GetCorpusStatistics(std::string_view raw_query) const {
+    CorpusStatistics statistics;
+    statistics.document_count = GetDocumentCount();
+    for (std::string_view word : ParseQueryUnique(std::execution::seq, raw_query).plus_words) {
+        const auto it = term_ids_->find(word);
+        statistics.document_freqs[word] = it == term_ids_->end() ? 0 : (*document_freqs_)[it->second];
     }
-    catch (const std::out_of_range& ex) {
-        const std::map<std::string_view, double>& key = empty_ref_;
-        return key;
+    return statistics;
+}
+
+CorpusStatistics SearchServer::GetCorpusStatistics(const PreparedQuery& query) const {
+    CorpusStatistics statistics;
+    statistics.document_count = GetDocumentCount();
+    for (const std::string& word : query.plus_words_) {
+        const uint32_t term_id = FindTermId(word);
+        statistics.document_freqs[word] = term_id == NO_TERM_ID ? 0 : (*document_freqs_)[term_id];
+    }
+    return statistics;
+}
+
+int SearchServer::GetDocumentCount() const {
+    return static_cast<int>(document_ordinals_.size());
+}
+
+bool SearchServer::HasDocument(int document_id) const {
+    return document_ordinals_.Find(document_id) != nullptr;
+}
+
+void SearchServer::MarkDocument(ChunkedOrdinalBitmap& ordinals, int document_id) const {
+    const int* ordinal = document_ordinals_.Find(document_id);
+    if (ordinal == nullptr) {
+        throw std::invalid_argument("Invalid document_id");
     }
+    ordinals.Set(*ordinal);
+}
+
+bool SearchServer::IsMarked(const ChunkedOrdinalBitmap& ordinals, int document_id) const {
+    const int* ordinal = document_ordinals_.Find(document_id);
+    return ordinal != nullptr && ordinals.Test(*ordinal);
+}
+
+uint64_t SearchServer::GetGeneration() const {
+    return generation_;
+}
+
+std::set<int>::const_iterator SearchServer::begin() const {
+    return writer_state_.document_ids.begin();
+}
+
+std::set<int>::const_iterator SearchServer::end() const {
+    return writer_state_.document_ids.end();
+}
+
+const std::map<std::string_view, double>& SearchServer::GetWordFrequencies(int document_id) const {
+    static const std::map<std::string_view, double> empty_word_freqs;
+    const int* ordinal = document_ordinals_.Find(document_id);
+    return ordinal == nullptr ? empty_word_freqs : *document_word_freqs_[*ordinal];
+}
+
+void SearchServer::PublishSnapshot() {
+    std::shared_ptr<SearchServer> snapshot(new SearchServer(*this));
+    snapshot->snapshot_.reset();
+    std::atomic_store(&snapshot_, std::shared_ptr<const SearchServer>(std::move(snapshot)));
+}
+
+SearchServer::Snapshot SearchServer::GetSnapshot() const {
+    return Snapshot(std::atomic_load(&snapshot_));
+}
+
+SearchServer::Snapshot::Snapshot(std::shared_ptr<const SearchServer> server)
+    : server_(std::move(server))
+{
+}
+
+std::vector<Document> SearchServer::Snapshot::FindTopDocuments(std::string_view raw_query, ResultPage page) const {
+    return server_->FindTopDocuments(raw_query, page);
+}
+
+std::vector<Document> SearchServer::Snapshot::FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+    ResultPage page) const {
+    return server_->FindTopDocuments(raw_query, status, page);
+}
+
+int SearchServer::Snapshot::GetDocumentCount() const {
+    return server_->GetDocumentCount();
+}
+
+std::vector<int> SearchServer::Snapshot::GetDocumentIds() const {
+    // The snapshot copy has no writer state to iterate
+    std::vector<int> document_ids;
+    document_ids.reserve(server_->document_ordinals_.size());
+    server_->document_ordinals_.ForEach([&document_ids](int document_id, int) {
+        document_ids.push_back(document_id);
+        });
+    return document_ids;
+}
+
+uint64_t SearchServer::Snapshot::GetGeneration() const {
+    return server_->GetGeneration();
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::Snapshot::MatchDocument(
+    std::string_view raw_query, int document_id) const {
+    return server_->MatchDocument(raw_query, document_id);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::Snapshot::MatchDocument(
+    const std::execution::sequenced_policy&, std::string_view raw_query, int document_id) const {
+    return server_->MatchDocument(std::execution::seq, raw_query, document_id);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::Snapshot::MatchDocument(
+    const std::execution::parallel_policy&, std::string_view raw_query, int document_id) const {
+    return server_->MatchDocument(std::execution::par, raw_query, document_id);
+}
+
+const std::map<std::string_view, double>& SearchServer::Snapshot::GetWordFrequencies(int document_id) const {
+    return server_->GetWordFrequencies(document_id);
 }
 
 void SearchServer::RemoveDocument(int document_id) {
-    for (auto [str, freq] : id_to_document_freqs_[document_id]) {
-        word_to_document_freqs_.at(str).erase(document_id);
+    const int* ordinal = document_ordinals_.Find(document_id);
+    if (ordinal == nullptr) {
+        return;
+    }
+    auto& document_freqs = document_freqs_.Modify();
+    for (const auto [word, term_freq] : *document_word_freqs_[*ordinal]) {
+        --document_freqs[term_ids_->at(word)];
     }
-    id_to_document_freqs_.erase(document_id);
-    documents_.erase(document_id);
-    document_ids_.erase(find(document_ids_.begin(), document_ids_.end(), document_id));
+    EraseDocument(document_id, *ordinal);
 }
 
 void SearchServer::RemoveDocument(const std::execution::sequenced_policy&, int document_id) {
@@ -90,55 +617,253 @@ void SearchServer::RemoveDocument(const std::execution::sequenced_policy&, int d
 }
 
 void SearchServer::RemoveDocument(const std::execution::parallel_policy&, int document_id) {
-    std::vector<std::string_view> str_to_remove(id_to_document_freqs_.at(document_id).size());
-    transform(
-        std::execution::par,
-        id_to_document_freqs_.at(document_id).begin(),
-        id_to_document_freqs_.at(document_id).end(),
-        str_to_remove.begin(),
-        [](auto& temp_pair) {
-            const auto temp = temp_pair.first;
-            return temp;
+    const int* ordinal = document_ordinals_.Find(document_id);
+    if (ordinal == nullptr) {
+        return;
+    }
+    const auto& word_freqs = *document_word_freqs_[*ordinal];
+    auto& document_freqs = document_freqs_.Modify();
+    // Every word of the document is a different term, so the counters are disjoint
+    std::for_each(std::execution::par, word_freqs.begin(), word_freqs.end(),
+        [this, &document_freqs](const auto& word_freq) {
+            --document_freqs[term_ids_->at(word_freq.first)];
+        });
+    EraseDocument(document_id, *ordinal);
+}
+
+void SearchServer::RemoveDocument(const SearchExecutor& executor, int document_id) {
+    const int* ordinal = document_ordinals_.Find(document_id);
+    if (ordinal == nullptr) {
+        return;
+    }
+    const auto& word_freqs = *document_word_freqs_[*ordinal];
+    std::vector<std::string_view> words;
+    words.reserve(word_freqs.size());
+    for (const auto& [word, term_freq] : word_freqs) {
+        words.push_back(word);
+    }
+    auto& document_freqs = document_freqs_.Modify();
+    executor.ForEach(words.begin(), words.end(), [this, &document_freqs](std::string_view word) {
+        --document_freqs[term_ids_->at(word)];
+        });
+    EraseDocument(document_id, *ordinal);
+}
+
+void SearchServer::Compact() {
+    WaitForCompaction();
+    InstallCompactedIndex(BuildCompactedIndex());
+}
+
+bool SearchServer::IsCompacting() const {
+    return pending_compaction_.index.valid();
+}
+
+void SearchServer::WaitForCompaction() {
+    if (pending_compaction_.index.valid()) {
+        InstallCompactedIndex(pending_compaction_.index.get());
+    }
+}
+
+void SearchServer::InstallFinishedCompaction() {
+    if (pending_compaction_.index.valid()
+        && pending_compaction_.index.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        InstallCompactedIndex(pending_compaction_.index.get());
+    }
+}
+
+SearchServer::CompactedIndex SearchServer::BuildCompactedIndex() const {
+    // Live documents keep their relative order, so every posting list stays sorted.
+    // The columns and lists are built anew, snapshots keep the old ones
+    CompactedIndex index;
+    index.new_ordinals.assign(ordinal_to_document_id_.size(), -1);
+    for (size_t ordinal = 0; ordinal < ordinal_to_document_id_.size(); ++ordinal) {
+        const int document_id = ordinal_to_document_id_[ordinal];
+        if (document_id < 0) {
+            continue;
         }
-    );
-    std::for_each(
-        std::execution::par,
-        str_to_remove.begin(),
-        str_to_remove.end(),
-        [this, document_id](std::string_view str) {word_to_document_freqs_[str].erase(document_id); }
-    );
-    id_to_document_freqs_.erase(document_id);
-    documents_.erase(document_id);
-    document_ids_.erase(document_id);
+        const int new_ordinal = static_cast<int>(index.ordinal_to_document_id.size());
+        index.new_ordinals[ordinal] = new_ordinal;
+        index.ordinal_to_document_id.push_back(document_id);
+        index.document_ratings.push_back(document_ratings_[ordinal]);
+        index.document_statuses.push_back(document_statuses_[ordinal]);
+        index.status_bitmaps[static_cast<size_t>(document_statuses_[ordinal])].Set(new_ordinal);
+        index.document_word_freqs.push_back(document_word_freqs_[ordinal]);
+        index.document_ordinals.Set(document_id, new_ordinal);
+    }
+
+    index.postings.resize(terms_->size());
+    std::vector<uint32_t> term_ids(terms_->size());
+    std::iota(term_ids.begin(), term_ids.end(), 0);
+    std::for_each(std::execution::par, term_ids.begin(), term_ids.end(),
+        [this, &index](uint32_t term_id) {
+            if ((*document_freqs_)[term_id] == 0) {
+                return;
+            }
+            const PostingList& old_postings = *(*postings_)[term_id];
+            PostingList& new_postings = index.postings[term_id].Modify();
+            old_postings.ForEach([&new_postings, &index](int ordinal, double term_freq) {
+                if (index.new_ordinals[ordinal] >= 0) {
+                    new_postings.Add(index.new_ordinals[ordinal], term_freq);
+                }
+            });
+            if (old_postings.IsCompressed()) {
+                new_postings.Compress();
+            }
+        });
+    return index;
+}
+
+void SearchServer::InstallCompactedIndex(CompactedIndex index) {
+    const size_t built_ordinal_count = index.new_ordinals.size();
+    int removed_document_count = 0;
+    for (size_t ordinal = 0; ordinal < built_ordinal_count; ++ordinal) {
+        const int new_ordinal = index.new_ordinals[ordinal];
+        if (new_ordinal < 0 || ordinal_to_document_id_[ordinal] >= 0) {
+            continue;
+        }
+        // Its postings stay until the next compaction, like those of any removed document
+        index.document_ordinals.Erase(index.ordinal_to_document_id[new_ordinal]);
+        index.ordinal_to_document_id.Modify(new_ordinal) = -1;
+        index.status_bitmaps[static_cast<size_t>(index.document_statuses[new_ordinal])].Reset(new_ordinal);
+        index.document_word_freqs.Modify(new_ordinal).reset();
+        ++removed_document_count;
+    }
+    std::vector<TermPosting> term_postings;
+    for (size_t ordinal = built_ordinal_count; ordinal < ordinal_to_document_id_.size(); ++ordinal) {
+        const int document_id = ordinal_to_document_id_[ordinal];
+        const int new_ordinal = static_cast<int>(index.ordinal_to_document_id.size());
+        index.ordinal_to_document_id.push_back(document_id);
+        index.document_ratings.push_back(document_ratings_[ordinal]);
+        index.document_statuses.push_back(document_statuses_[ordinal]);
+        index.document_word_freqs.push_back(document_word_freqs_[ordinal]);
+        if (document_id < 0) {
+            ++removed_document_count;
+            continue;
+        }
+        index.status_bitmaps[static_cast<size_t>(document_statuses_[ordinal])].Set(new_ordinal);
+        index.document_ordinals.Set(document_id, new_ordinal);
+        for (const auto& [word, term_freq] : *document_word_freqs_[ordinal]) {
+            term_postings.push_back({ term_ids_->at(word), new_ordinal, term_freq });
+        }
+    }
+    index.postings.resize(terms_->size());
+    ordinal_to_document_id_ = std::move(index.ordinal_to_document_id);
+    document_ratings_ = std::move(index.document_ratings);
+    document_statuses_ = std::move(index.document_statuses);
+    status_bitmaps_ = std::move(index.status_bitmaps);
+    document_word_freqs_ = std::move(index.document_word_freqs);
+    document_ordinals_ = std::move(index.document_ordinals);
+    postings_ = CopyOnWrite(std::move(index.postings));
+    removed_document_count_ = removed_document_count;
+    AppendPostings(term_postings);
+
+    // No live document refers to a term without documents, so its text can go once
+    // no removed document is left in its postings either
+    auto& term_ids_by_word = term_ids_.Modify();
+    for (auto it = term_ids_by_word.begin(); it != term_ids_by_word.end();) {
+        const uint32_t term_id = it->second;
+        if ((*document_freqs_)[term_id] > 0 || !(*postings_)[term_id]->empty()) {
+            ++it;
+            continue;
+        }
+        it = term_ids_by_word.erase(it);
+        terms_.Modify()[term_id].reset();
+        writer_state_.free_term_ids.push_back(term_id);
+        dictionary_version_ = NewVersion();
+    }
+}
+
+void SearchServer::CompressPostings() {
+    // Lists built by a running compaction would keep their old form
+    WaitForCompaction();
+    // Quantized term frequencies change relevance
+    generation_ = NewVersion();
+    for (CopyOnWrite<PostingList>& postings : postings_.Modify()) {
+        postings.Modify().Compress();
+    }
+}
+
+void SearchServer::SetQueryEvaluation(QueryEvaluation evaluation) {
+    query_evaluation_.value = evaluation;
+}
+
+void SearchServer::Save(const std::string& path) const {
+    IndexWriter writer(path);
+    writer.WriteNumber(stop_words_->size());
+    for (const std::string& stop_word : *stop_words_) {
+        writer.WriteString(stop_word);
+    }
+
+    writer.WriteNumber(terms_->size());
+    for (uint32_t term_id = 0; term_id < terms_->size(); ++term_id) {
+        // Freed terms have no text
+        const std::shared_ptr<const std::string>& term = (*terms_)[term_id];
+        writer.WriteString(term ? *term : std::string());
+        writer.WriteNumber((*document_freqs_)[term_id]);
+        (*postings_)[term_id]->Save(writer);
+    }
+    writer.WriteArray(writer_state_.free_term_ids);
+
+    const std::vector<int> ordinal_to_document_id = ordinal_to_document_id_.ToVector();
+    writer.WriteArray(ordinal_to_document_id);
+    writer.WriteArray(document_ratings_.ToVector());
+    writer.WriteArray(document_statuses_.ToVector());
+    // Word frequencies of every ordinal in the order of its map, removed ones have none
+    std::vector<uint64_t> word_offsets = { 0 };
+    std::vector<uint32_t> word_term_ids;
+    std::vector<double> word_term_freqs;
+    for (size_t ordinal = 0; ordinal < ordinal_to_document_id.size(); ++ordinal) {
+        if (ordinal_to_document_id[ordinal] >= 0) {
+            for (const auto [word, term_freq] : *document_word_freqs_[ordinal]) {
+                word_term_ids.push_back(term_ids_->at(word));
+                word_term_freqs.push_back(term_freq);
+            }
+        }
+        word_offsets.push_back(word_term_ids.size());
+    }
+    writer.WriteArray(word_offsets);
+    writer.WriteArray(word_term_ids);
+    writer.WriteArray(word_term_freqs);
+    writer.WriteNumber(removed_document_count_);
+    writer.Finish();
+}
+
+SearchServer SearchServer::OpenMapped(const std::string& path) {
+    auto mapped_file = std::make_shared<const MappedFile>(path);
+    IndexReader reader(mapped_file->data(), mapped_file->size());
+    reader.VerifyChecksum();
+    return SearchServer(std::move(mapped_file), reader);
 }
 
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(
     std::string_view raw_query,
     int document_id) const {
     auto query = ParseQuery(raw_query);
+    const int ordinal = GetDocumentOrdinal(document_id);
+    const auto& word_freqs = *document_word_freqs_[ordinal];
     std::vector<std::string_view> matched_words;
 
     for (std::string_view min_word : query.minus_words) {
         if (std::any_of(
-            id_to_document_freqs_.at(document_id).begin(),
-            id_to_document_freqs_.at(document_id).end(),
+            word_freqs.begin(),
+            word_freqs.end(),
             [min_word](const auto word) {return word.first == min_word; })
             ) {
             matched_words.clear();
-            return { matched_words, documents_.at(document_id).status };
+            return { matched_words, document_statuses_[ordinal] };
         }
     }
     for (std::string_view plus_word : query.plus_words) {
         if (std::any_of(
-            id_to_document_freqs_.at(document_id).begin(),
-            id_to_document_freqs_.at(document_id).end(),
+            word_freqs.begin(),
+            word_freqs.end(),
             [plus_word](auto word) { return word.first == plus_word; })
             ) {
-            auto temp = id_to_document_freqs_.at(document_id).find(plus_word);
+            auto temp = word_freqs.find(plus_word);
             matched_words.push_back((*temp).first);
         }
     }
-    return { matched_words, documents_.at(document_id).status };
+    return { matched_words, document_statuses_[ordinal] };
 }
 
 std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(
@@ -153,38 +878,148 @@ std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDoc
     std::string_view raw_query,
     int document_id) const {
     const auto query = ParseQueryPar(raw_query);
+    const int ordinal = GetDocumentOrdinal(document_id);
+    const auto& word_freqs = *document_word_freqs_[ordinal];
     std::vector<std::string_view> matched_words;
     matched_words.reserve(query.plus_words.size());
     for (std::string_view min_word : query.minus_words) {
         if (std::any_of(std::execution::par,
-            id_to_document_freqs_.at(document_id).begin(),
-            id_to_document_freqs_.at(document_id).end(),
+            word_freqs.begin(),
+            word_freqs.end(),
             [&min_word](const auto& word) {return word.first == min_word; })
             ) {
-            return { matched_words, documents_.at(document_id).status };
+            return { matched_words, document_statuses_[ordinal] };
         }
     }
     for (std::string_view plus_word : query.plus_words) {
         if (std::any_of(
-            id_to_document_freqs_.at(document_id).begin(),
-            id_to_document_freqs_.at(document_id).end(),
+            word_freqs.begin(),
+            word_freqs.end(),
             [plus_word](auto word) { return word.first == plus_word; })
             ) {
-            auto temp = id_to_document_freqs_.at(document_id).find(plus_word);
+            auto temp = word_freqs.find(plus_word);
             matched_words.push_back((*temp).first);
         }
     }
     std::sort(std::execution::par, matched_words.begin(), matched_words.end());
     auto last = std::unique(matched_words.begin(), matched_words.end());
     matched_words.erase(last, matched_words.end());
-    return { matched_words, documents_.at(document_id).status };
+    return { matched_words, document_statuses_[ordinal] };
 }
 
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(
+    const SearchExecutor& executor,
+    std::string_view raw_query,
+    int document_id) const {
+    const auto query = ParseQueryPar(raw_query);
+    const int ordinal = GetDocumentOrdinal(document_id);
+    const auto& word_freqs = *document_word_freqs_[ordinal];
+    const DocumentStatus status = document_statuses_[ordinal];
+    std::atomic<bool> has_minus_word = false;
+    executor.ForEach(query.minus_words.begin(), query.minus_words.end(),
+        [&word_freqs, &has_minus_word](std::string_view word) {
+            if (word_freqs.count(word) > 0) {
+                has_minus_word.store(true, std::memory_order_relaxed);
+            }
+        });
+    std::vector<std::string_view> matched_words;
+    if (has_minus_word.load(std::memory_order_relaxed)) {
+        return { matched_words, status };
+    }
+    for (std::string_view plus_word : query.plus_words) {
+        const auto word_freq = word_freqs.find(plus_word);
+        if (word_freq != word_freqs.end()) {
+            matched_words.push_back(word_freq->first);
+        }
+    }
+    std::sort(matched_words.begin(), matched_words.end());
+    matched_words.erase(std::unique(matched_words.begin(), matched_words.end()), matched_words.end());
+    return { matched_words, status };
+}
 
 /*-------------private---------------*/
 
+std::vector<std::string> SearchServer::ReadStopWords(IndexReader& reader) {
+    std::vector<std::string> stop_words(reader.ReadNumber());
+    for (std::string& stop_word : stop_words) {
+        stop_word = reader.ReadString();
+    }
+    return stop_words;
+}
+
+void SearchServer::LoadIndex(IndexReader& reader) {
+    // Posting lists keep pointing into the file, the rest is copied out of it
+    const size_t term_count = reader.ReadNumber();
+    auto& terms = terms_.Modify();
+    auto& document_freqs = document_freqs_.Modify();
+    auto& postings = postings_.Modify();
+    for (size_t term_id = 0; term_id < term_count; ++term_id) {
+        terms.push_back(std::make_shared<const std::string>(reader.ReadString()));
+        document_freqs.push_back(static_cast<int>(reader.ReadNumber()));
+        postings.emplace_back(PostingList::Load(reader));
+        inverse_document_freqs_.entries.emplace_back();
+    }
+    const MappableArray<uint32_t> free_term_ids = reader.ReadArray<uint32_t>();
+    std::vector<bool> is_free_term(term_count, false);
+    for (const uint32_t term_id : free_term_ids) {
+        if (term_id >= term_count) {
+            throw std::runtime_error("Index file is corrupted");
+        }
+        is_free_term[term_id] = true;
+    }
+    writer_state_.free_term_ids.assign(free_term_ids.begin(), free_term_ids.end());
+    auto& term_ids = term_ids_.Modify();
+    for (uint32_t term_id = 0; term_id < term_count; ++term_id) {
+        if (is_free_term[term_id]) {
+            terms[term_id].reset();
+        }
+        else {
+            term_ids.emplace(*terms[term_id], term_id);
+        }
+    }
+
+    const MappableArray<int> ordinal_to_document_id = reader.ReadArray<int>();
+    const MappableArray<int> document_ratings = reader.ReadArray<int>();
+    const MappableArray<DocumentStatus> document_statuses = reader.ReadArray<DocumentStatus>();
+    const MappableArray<uint64_t> word_offsets = reader.ReadArray<uint64_t>();
+    const MappableArray<uint32_t> word_term_ids = reader.ReadArray<uint32_t>();
+    const MappableArray<double> word_term_freqs = reader.ReadArray<double>();
+    const size_t ordinal_count = ordinal_to_document_id.size();
+    if (document_ratings.size() != ordinal_count || document_statuses.size() != ordinal_count
+        || word_offsets.size() != ordinal_count + 1 || word_offsets.back() != word_term_ids.size()
+        || word_term_freqs.size() != word_term_ids.size()) {
+        throw std::runtime_error("Index file is corrupted");
+    }
+    ordinal_to_document_id_.assign(ordinal_to_document_id.begin(), ordinal_to_document_id.end());
+    document_ratings_.assign(document_ratings.begin(), document_ratings.end());
+    document_statuses_.assign(document_statuses.begin(), document_statuses.end());
+    for (size_t ordinal = 0; ordinal < ordinal_count; ++ordinal) {
+        const int document_id = ordinal_to_document_id[ordinal];
+        document_word_freqs_.push_back(nullptr);
+        if (document_id < 0) {
+            continue;
+        }
+        const size_t status = static_cast<size_t>(document_statuses[ordinal]);
+        if (status >= DOCUMENT_STATUS_COUNT || word_offsets[ordinal] > word_offsets[ordinal + 1]) {
+            throw std::runtime_error("Index file is corrupted");
+        }
+        status_bitmaps_[status].Set(static_cast<int>(ordinal));
+        document_ordinals_.Set(document_id, static_cast<int>(ordinal));
+        writer_state_.document_ids.insert(document_id);
+        auto word_freqs = std::make_shared<std::map<std::string_view, double>>();
+        for (size_t i = word_offsets[ordinal]; i < word_offsets[ordinal + 1]; ++i) {
+            if (word_term_ids[i] >= term_count || !terms[word_term_ids[i]]) {
+                throw std::runtime_error("Index file is corrupted");
+            }
+            word_freqs->emplace_hint(word_freqs->end(), *terms[word_term_ids[i]], word_term_freqs[i]);
+        }
+        document_word_freqs_.Modify(ordinal) = std::move(word_freqs);
+    }
+    removed_document_count_ = static_cast<int>(reader.ReadNumber());
+}
+
 bool SearchServer::IsStopWord(std::string_view word) const {
-    return stop_words_.count(static_cast<std::string>(word)) > 0;
+    return stop_word_set_->Contains(word);
 }
 
 bool SearchServer::IsValidWord(std::string_view word) {
@@ -195,19 +1030,6 @@ bool SearchServer::IsValidWord(std::string_view word) {
     );
 }
 
-std::vector<std::string_view> SearchServer::SplitIntoWordsNoStop(std::string_view text) const {
-    std::vector<std::string_view> words;
-    for (std::string_view word : SplitIntoWords(text)) {
-        if (!IsValidWord(word)) {
-            throw std::invalid_argument("Word " + static_cast<std::string>(word) + " is invalid");
-        }
-        if (!IsStopWord(word)) {
-            words.push_back(word);
-        }
-    }
-    return words;
-}
-
 int SearchServer::ComputeAverageRating(const std::vector<int>& ratings) {
     if (ratings.empty()) {
         return 0;
@@ -216,7 +1038,85 @@ int SearchServer::ComputeAverageRating(const std::vector<int>& ratings) {
     return rating_sum / static_cast<int>(ratings.size());
 }
 
-SearchServer::QueryWord SearchServer::ParseQueryWord(std::string_view text) const {
+bool SearchServer::IsMoreRelevant(const Document& lhs, const Document& rhs) {
+    if (std::abs(lhs.relevance - rhs.relevance) < TOLERANCE) {
+        return lhs.rating > rhs.rating;
+    }
+    return lhs.relevance > rhs.relevance;
+}
+
+SearchServer::TopDocumentHeap::TopDocumentHeap(Document* documents, size_t capacity)
+    : documents_(documents)
+    , capacity_(capacity)
+{
+}
+
+bool SearchServer::TopDocumentHeap::IsFull() const {
+    return size_ == capacity_;
+}
+
+const Document& SearchServer::TopDocumentHeap::GetLeastRelevant() const {
+    return documents_[0];
+}
+
+void SearchServer::TopDocumentHeap::Push(const Document& document) {
+    if (size_ < capacity_) {
+        documents_[size_++] = document;
+        std::push_heap(documents_, documents_ + size_, IsMoreRelevant);
+    }
+    else if (capacity_ > 0 && IsMoreRelevant(document, documents_[0])) {
+        std::pop_heap(documents_, documents_ + size_, IsMoreRelevant);
+        documents_[size_ - 1] = document;
+        std::push_heap(documents_, documents_ + size_, IsMoreRelevant);
+    }
+}
+
+size_t SearchServer::TopDocumentHeap::ExtractPage(size_t offset) {
+    std::sort(documents_, documents_ + size_, IsMoreRelevant);
+    const size_t skipped = std::min(offset, size_);
+    if (skipped > 0) {
+        std::move(documents_ + skipped, documents_ + size_, documents_);
+    }
+    return size_ - skipped;
+}
+
+ScoreAccumulator& SearchServer::GetThreadScoreAccumulator() {
+    static thread_local ScoreAccumulator accumulator;
+    return accumulator;
+}
+
+std::vector<std::string_view>& SearchServer::GetThreadWordBuffer() {
+    static thread_local std::vector<std::string_view> words;
+    return words;
+}
+
+void SearchServer::SelectPage(std::vector<Document>& documents, ResultPage page) {
+    // Only the first offset + count places are ordered: O(n log k) instead of a full sort
+    const size_t top_count = std::min(documents.size(), page.offset + page.count);
+    std::partial_sort(documents.begin(), documents.begin() + top_count, documents.end(), IsMoreRelevant);
+    documents.resize(top_count);
+    documents.erase(documents.begin(), documents.begin() + std::min(page.offset, top_count));
+}
+
+void SearchServer::SelectPage(const std::execution::sequenced_policy&, std::vector<Document>& documents,
+    ResultPage page) {
+    SelectPage(documents, page);
+}
+
+void SearchServer::SelectPage(const std::execution::parallel_policy&, std::vector<Document>& documents,
+    ResultPage page) {
+    SelectPageInChunks([](auto first, auto last, auto function) {
+        std::for_each(std::execution::par, first, last, function);
+        }, std::max<size_t>(1, std::thread::hardware_concurrency()), documents, page);
+}
+
+void SearchServer::SelectPage(const SearchExecutor& executor, std::vector<Document>& documents, ResultPage page) {
+    SelectPageInChunks([&executor](auto first, auto last, auto function) {
+        executor.ForEach(first, last, function);
+        }, executor.GetThreadCount(), documents, page);
+}
+
+SearchServer::QueryWord SearchServer::ParseQueryWord(std::string_view text, bool is_valid) const {
     if (text.empty()) {
         throw std::invalid_argument("Query word is empty");
     }
@@ -225,7 +1125,7 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(std::string_view text) cons
         is_minus = true;
         text = text.substr(1);
     }
-    if (text.empty() || text[0] == '-' || !IsValidWord(text)) {
+    if (text.empty() || text[0] == '-' || !is_valid) {
         throw std::invalid_argument("Query word " + static_cast<std::string>(text) + " is invalid");
     }
     return { text, is_minus, IsStopWord(text) };
@@ -233,8 +1133,10 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(std::string_view text) cons
 
 SearchServer::Query SearchServer::ParseQuery(std::string_view text) const {
     Query result;
-    for (std::string_view word : SplitIntoWords(text)) {
-        auto query_word = ParseQueryWord(word);
+    std::vector<std::string_view>& words = GetThreadWordBuffer();
+    const size_t first_invalid = SplitIntoValidatedWords(text, words);
+    for (size_t i = 0; i < words.size(); ++i) {
+        auto query_word = ParseQueryWord(words[i], i < first_invalid);
         if (!query_word.is_stop) {
             query_word.is_minus ? 
                 result.minus_words.push_back(query_word.data) : 
@@ -252,8 +1154,10 @@ SearchServer::Query SearchServer::ParseQuery(std::string_view text) const {
 
 SearchServer::Query SearchServer::ParseQueryPar(std::string_view text) const {
     Query result;
-    for (std::string_view word : SplitIntoWords(text)) {
-        auto query_word = ParseQueryWord(word);
+    std::vector<std::string_view>& words = GetThreadWordBuffer();
+    const size_t first_invalid = SplitIntoValidatedWords(text, words);
+    for (size_t i = 0; i < words.size(); ++i) {
+        auto query_word = ParseQueryWord(words[i], i < first_invalid);
         if (!query_word.is_stop) {
             query_word.is_minus ? 
                 result.minus_words.push_back(query_word.data) : 
@@ -263,6 +1167,152 @@ SearchServer::Query SearchServer::ParseQueryPar(std::string_view text) const {
     return result;
 }
 
-double SearchServer::ComputeWordInverseDocumentFreq(std::string_view word) const {
-    return std::log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
+std::map<std::string_view, double> SearchServer::ComputeWordFreqs(std::string_view document) const {
+    std::vector<std::string_view>& words = GetThreadWordBuffer();
+    const size_t first_invalid = SplitIntoValidatedWords(document, words);
+    if (first_invalid < words.size()) {
+        throw std::invalid_argument("Word " + static_cast<std::string>(words[first_invalid]) + " is invalid");
+    }
+    // Stop words are dropped in place, the rest are counted by the total of non-stop words
+    words.erase(std::remove_if(words.begin(), words.end(),
+        [this](std::string_view word) { return IsStopWord(word); }), words.end());
+    const double inv_word_count = 1.0 / words.size();
+    std::map<std::string_view, double> word_freqs;
+    for (std::string_view word : words) {
+        word_freqs[word] += inv_word_count;
+    }
+    return word_freqs;
+}
+
+void SearchServer::RegisterDocument(int document_id, const std::map<std::string_view, double>& word_freqs,
+    DocumentStatus status, int rating, std::vector<TermPosting>& term_postings) {
+    generation_ = NewVersion();
+    const int ordinal = static_cast<int>(ordinal_to_document_id_.size());
+    auto document_freqs = std::make_shared<std::map<std::string_view, double>>();
+    for (const auto [word, term_freq] : word_freqs) {
+        const uint32_t term_id = InternTerm(word);
+        // Words come in sorted order, so each one goes to the end of the map
+        document_freqs->emplace_hint(document_freqs->end(), *(*terms_)[term_id], term_freq);
+        term_postings.push_back({ term_id, ordinal, term_freq });
+        ++document_freqs_.Modify()[term_id];
+    }
+    document_word_freqs_.push_back(std::move(document_freqs));
+    ordinal_to_document_id_.push_back(document_id);
+    document_ratings_.push_back(rating);
+    document_statuses_.push_back(status);
+    status_bitmaps_[static_cast<size_t>(status)].Set(ordinal);
+    document_ordinals_.Set(document_id, ordinal);
+    writer_state_.document_ids.insert(document_id);
+}
+
+uint32_t SearchServer::InternTerm(std::string_view word) {
+    const auto it = term_ids_->find(word);
+    if (it != term_ids_->end()) {
+        return it->second;
+    }
+    dictionary_version_ = NewVersion();
+    // Every term owns its text, so the key view stays valid wherever the term goes
+    auto term = std::make_shared<const std::string>(word);
+    std::vector<uint32_t>& free_term_ids = writer_state_.free_term_ids;
+    if (!free_term_ids.empty()) {
+        // The cached IDF depends only on the counts in its key, so it stays valid
+        const uint32_t term_id = free_term_ids.back();
+        free_term_ids.pop_back();
+        term_ids_.Modify().emplace(*term, term_id);
+        terms_.Modify()[term_id] = std::move(term);
+        return term_id;
+    }
+    const uint32_t term_id = static_cast<uint32_t>(terms_->size());
+    term_ids_.Modify().emplace(*term, term_id);
+    terms_.Modify().push_back(std::move(term));
+    postings_.Modify().emplace_back();
+    document_freqs_.Modify().push_back(0);
+    inverse_document_freqs_.entries.emplace_back();
+    return term_id;
+}
+
+uint32_t SearchServer::FindTermId(std::string_view word) const {
+    const auto it = term_ids_->find(word);
+    return it == term_ids_->end() ? NO_TERM_ID : it->second;
+}
+
+int SearchServer::GetDocumentOrdinal(int document_id) const {
+    const int* ordinal = document_ordinals_.Find(document_id);
+    if (ordinal == nullptr) {
+        throw std::out_of_range("Invalid document_id");
+    }
+    return *ordinal;
+}
+
+uint64_t SearchServer::NewVersion() {
+    static std::atomic<uint64_t> next_version{ 1 };
+    return next_version.fetch_add(1, std::memory_order_relaxed);
+}
+
+const PostingList* SearchServer::FindPostings(std::string_view word) const {
+    const auto it = term_ids_->find(word);
+    if (it == term_ids_->end() || (*document_freqs_)[it->second] == 0) {
+        return nullptr;
+    }
+    return &*(*postings_)[it->second];
+}
+
+double SearchServer::GetInverseDocumentFreq(uint32_t term_id) const {
+    const int document_count = GetDocumentCount();
+    const int document_freq = (*document_freqs_)[term_id];
+    const uint64_t key = (static_cast<uint64_t>(document_count) << 32) | static_cast<uint32_t>(document_freq);
+    if (term_id >= inverse_document_freqs_.entries.size()) {
+        return std::log(document_count * 1.0 / document_freq);
+    }
+    CachedInverseDocumentFreq& cached = inverse_document_freqs_.entries[term_id];
+    if (cached.key.load(std::memory_order_acquire) == key) {
+        return cached.value.load(std::memory_order_relaxed);
+    }
+    const double inverse_document_freq = std::log(document_count * 1.0 / document_freq);
+    cached.value.store(inverse_document_freq, std::memory_order_relaxed);
+    cached.key.store(key, std::memory_order_release);
+    return inverse_document_freq;
+}
+
+SearchServer::QueryTerms SearchServer::ResolveQuery(const Query& query, const CorpusStatistics* corpus) const {
+    QueryTerms terms;
+    for (std::string_view word : query.plus_words) {
+        const auto it = term_ids_->find(word);
+        if (it == term_ids_->end() || (*document_freqs_)[it->second] == 0) {
+            continue;
+        }
+        const double inverse_document_freq = corpus == nullptr
+            ? GetInverseDocumentFreq(it->second)
+            : std::log(corpus->document_count * 1.0 / corpus->document_freqs.at(word));
+        terms.plus_terms.push_back({ &*(*postings_)[it->second], inverse_document_freq, it->second });
+    }
+    for (std::string_view word : query.minus_words) {
+        if (const PostingList* postings = FindPostings(word)) {
+            terms.minus_terms.push_back(postings);
+        }
+    }
+    return terms;
+}
+
+SearchServer::QueryTerms SearchServer::ResolveQuery(const PreparedQuery& query,
+    const CorpusStatistics* corpus) const {
+    // Ids resolved under another dictionary may be gone or belong to other words
+    const bool is_resolved = query.dictionary_version_ == dictionary_version_;
+    QueryTerms terms;
+    for (size_t i = 0; i < query.plus_words_.size(); ++i) {
+        const uint32_t term_id = is_resolved ? query.plus_term_ids_[i] : FindTermId(query.plus_words_[i]);
+        if (term_id != NO_TERM_ID && (*document_freqs_)[term_id] > 0) {
+            const double inverse_document_freq = corpus == nullptr
+                ? GetInverseDocumentFreq(term_id)
+                : std::log(corpus->document_count * 1.0 / corpus->document_freqs.at(query.plus_words_[i]));
+            terms.plus_terms.push_back({ &*(*postings_)[term_id], inverse_document_freq, term_id });
+        }
+    }
+    for (size_t i = 0; i < query.minus_words_.size(); ++i) {
+        const uint32_t term_id = is_resolved ? query.minus_term_ids_[i] : FindTermId(query.minus_words_[i]);
+        if (term_id != NO_TERM_ID && (*document_freqs_)[term_id] > 0) {
+            terms.minus_terms.push_back(&*(*postings_)[term_id]);
+        }
+    }
+    return terms;
 }
@@ -3,20 +3,149 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <deque>
+#include <cstdint>
 #include <algorithm>
 #include <cmath>
 #include <utility>
 #include <stdexcept>
 #include <execution>
 #include <functional>
+#include <limits>
+#include <numeric>
+#include <thread>
+#include <atomic>
+#include <array>
+#include <type_traits>
+#include <memory>
+#include <future>
+#include <chrono>
 
 #include "string_processing.h"
 #include "document.h"
-#include "concurrent_map.h"
+#include "posting_list.h"
+#include "score_accumulator.h"
+#include "ordinal_bitmap.h"
+#include "mapped_file.h"
+#include "index_file.h"
+#include "stop_word_set.h"
+#include "copy_on_write.h"
+#include "search_executor.h"
+#include "async_query_executor.h"
 
 constexpr int MAX_RESULT_DOCUMENT_COUNT = 5;
-constexpr int MAX_MAPS_TO_DIVIDE = 50;
+// Smallest slice of the ordinal space scored by one task of a parallel query
+constexpr int MIN_ORDINALS_PER_PARTITION = 4096;
 constexpr double TOLERANCE = 1e-6;
+// Score slots of one batch task: the queries of a chunk times the ordinals of a partition
+constexpr size_t BATCH_ACCUMULATOR_SIZE = 1 << 15;
+constexpr size_t MIN_BATCH_PARTITION_SIZE = 64;
+// Posting blocks scored between two reads of the clock by a query with a deadline
+constexpr size_t DEADLINE_CHECK_BLOCKS = 8;
+// Removed documents stay in the postings until they make up this share of all
+// ordinals, then the postings are compacted
+constexpr double MAX_REMOVED_DOCUMENT_SHARE = 0.25;
+
+// Window over the ranked results: the best `offset` documents are skipped and
+// at most `count` following ones are returned
+struct ResultPage {
+    size_t offset = 0;
+    size_t count = MAX_RESULT_DOCUMENT_COUNT;
+};
+
+// Limits of a query allowed to stop early: it stops at the deadline or before a
+// term whose postings would take the scored ones past max_postings
+struct QueryBudget {
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    size_t max_postings = std::numeric_limits<size_t>::max();
+};
+
+// Top documents of a query with a budget; a partial result is ranked by the
+// postings scored before the budget ran out
+struct BudgetedDocuments {
+    std::vector<Document> documents;
+    bool is_partial = false;
+};
+
+// Document of a batch passed to AddDocuments
+struct DocumentToAdd {
+    int document_id = 0;
+    std::string_view document;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    std::vector<int> ratings;
+};
+
+// Document of a batch that was not added, with the message AddDocument would throw
+struct RejectedDocument {
+    size_t position = 0;
+    int document_id = 0;
+    std::string reason;
+};
+
+// Document count and frequencies of the query words over a whole corpus. Servers
+// holding parts of one corpus rank with the merged statistics, so their scores
+// match those of a single server holding all documents
+struct CorpusStatistics {
+    int document_count = 0;
+    std::map<std::string_view, int> document_freqs;
+
+    void Merge(const CorpusStatistics& other);
+};
+
+// Predicate of the status overloads of FindTopDocuments. The server recognizes it
+// and answers it from per-status bitmaps instead of calling it for every posting
+struct DocumentStatusFilter {
+    DocumentStatus status = DocumentStatus::ACTUAL;
+
+    bool operator()(int, DocumentStatus document_status, int) const {
+        return document_status == status;
+    }
+};
+
+// Predicate passing what filter passes except the documents marked in excluded by
+// SearchServer::MarkDocument. The server tests the bit before calling filter, so a
+// DocumentStatusFilter inside is still answered from the status bitmaps
+template <typename DocumentPredicate>
+struct ExcludingFilter {
+    const ChunkedOrdinalBitmap* excluded = nullptr;
+    DocumentPredicate filter;
+};
+
+template <typename DocumentPredicate>
+struct IsExcludingFilter : std::false_type {};
+template <typename DocumentPredicate>
+struct IsExcludingFilter<ExcludingFilter<DocumentPredicate>> : std::true_type {};
+
+// Query parsed once by SearchServer::Prepare: its plus and minus words are
+// sorted, deduplicated and free of stop words, and it owns them, so it outlives
+// the raw query. The term ids they resolved to are reused while the dictionary
+// of the server stays the same, other servers and later dictionaries look the
+// words up again
+class PreparedQuery {
+public:
+    const std::vector<std::string>& GetPlusWords() const {
+        return plus_words_;
+    }
+    const std::vector<std::string>& GetMinusWords() const {
+        return minus_words_;
+    }
+
+private:
+    friend class SearchServer;
+    PreparedQuery() = default;
+
+    std::vector<std::string> plus_words_;
+    std::vector<std::string> minus_words_;
+    // Id of every word in the dictionary of dictionary_version_, NO_TERM_ID if absent
+    std::vector<uint32_t> plus_term_ids_;
+    std::vector<uint32_t> minus_term_ids_;
+    uint64_t dictionary_version_ = 0;
+};
+
+enum class QueryEvaluation {
+    EXHAUSTIVE,  // score every matching document
+    PRUNED,      // MaxScore with block-max bounds, skips documents that cannot reach the top
+};
 
 class SearchServer {
 public:
@@ -25,27 +154,122 @@ public:
     explicit SearchServer(const StringContainer& stop_words);
     explicit SearchServer(const std::string& stop_words_text);
     explicit SearchServer(const std::string_view stop_words_text);
+    // Copies are made only for snapshots, see PublishSnapshot
+    SearchServer& operator=(const SearchServer&) = delete;
+    SearchServer(SearchServer&&) = default;
 
     void AddDocument(int document_id, std::string_view document, DocumentStatus status,
         const std::vector<int>& ratings);
+    // Adds the batch in order as AddDocument would, tokenizing the documents in
+    // parallel and merging their postings into the index at once. Documents that
+    // AddDocument would reject are skipped and reported
+    std::vector<RejectedDocument> AddDocuments(const std::vector<DocumentToAdd>& batch);
+    // Copies the documents of other except those marked in excluded by
+    // other.MarkDocument, with their word frequencies, status and rating unchanged;
+    // ids must not be present yet
+    void AddDocumentsFrom(const SearchServer& other, const ChunkedOrdinalBitmap& excluded);
 
-    std::vector<Document> FindTopDocuments(std::string_view raw_query) const;
-    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, ResultPage page = {}) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+        ResultPage page = {}) const;
     template <typename DocumentPredicate>
-    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate,
+        ResultPage page = {}) const;
 
     template <typename ExecutionPolicy>
-    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query) const;
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+        ResultPage page = {}) const;
     template <typename ExecutionPolicy>
     std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
-        DocumentStatus status) const;
+        DocumentStatus status, ResultPage page = {}) const;
     template <typename ExecutionPolicy, typename DocumentPredicate>
     std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
-        DocumentPredicate document_predicate) const;
+        DocumentPredicate document_predicate, ResultPage page = {}) const;
+    // Ranks with inverse document frequencies taken from corpus instead of this server
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+        DocumentPredicate document_predicate, ResultPage page, const CorpusStatistics& corpus) const;
+
+    // Parses the query once for any number of FindTopDocuments calls below
+    PreparedQuery Prepare(std::string_view raw_query) const;
+    std::vector<Document> FindTopDocuments(const PreparedQuery& query, ResultPage page = {}) const;
+    std::vector<Document> FindTopDocuments(const PreparedQuery& query, DocumentStatus status,
+        ResultPage page = {}) const;
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(const PreparedQuery& query, DocumentPredicate document_predicate,
+        ResultPage page = {}) const;
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query,
+        ResultPage page = {}) const;
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query,
+        DocumentStatus status, ResultPage page = {}) const;
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query,
+        DocumentPredicate document_predicate, ResultPage page = {}) const;
+    // Ranks with inverse document frequencies taken from corpus instead of this server;
+    // a query prepared by another server is resolved by its words, without parsing
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query,
+        DocumentPredicate document_predicate, ResultPage page, const CorpusStatistics& corpus) const;
+
+    // Answers every query as FindTopDocuments(raw_query, status, page) would. Queries
+    // are split into chunks run in parallel; a posting list used by several queries
+    // of a chunk is walked once for all of them, scoring one ordinal partition at a time
+    std::vector<std::vector<Document>> FindTopDocumentsBatch(const std::vector<std::string>& raw_queries,
+        DocumentStatus status = DocumentStatus::ACTUAL, ResultPage page = {}) const;
+
+    // Writes the documents FindTopDocuments(raw_query, status, page) returns to
+    // output and returns their count. Output must have room for page.offset +
+    // page.count documents: the top is ranked in place there, no vector is allocated
+    size_t FindTopDocumentsInto(std::string_view raw_query, DocumentStatus status, ResultPage page,
+        Document* output) const;
+
+    // Scores the plus words from the highest inverse document frequency down, so a
+    // query stopped by its budget has the most telling ones. Minus words are always
+    // applied in full. A complete result is what FindTopDocuments returns
+    BudgetedDocuments FindTopDocuments(std::string_view raw_query, QueryBudget budget,
+        ResultPage page = {}) const;
+    BudgetedDocuments FindTopDocuments(std::string_view raw_query, QueryBudget budget,
+        DocumentStatus status, ResultPage page = {}) const;
+
+    // Queues the query to executor and returns at once; the future gets what
+    // FindTopDocuments returns or throws. Throws std::runtime_error if the queue is
+    // full. The server must stay alive and unchanged until the query is answered
+    std::future<std::vector<Document>> FindTopDocumentsAsync(AsyncQueryExecutor& executor,
+        std::string_view raw_query, DocumentStatus status = DocumentStatus::ACTUAL, ResultPage page = {}) const;
+    std::future<std::vector<Document>> FindTopDocumentsAsync(std::string_view raw_query,
+        DocumentStatus status = DocumentStatus::ACTUAL, ResultPage page = {}) const;
+#ifdef SEARCH_SERVER_HAS_COROUTINES
+    // Same for co_await, the coroutine is resumed on the executor's thread
+    AsyncQueryAwaitable<std::vector<Document>> FindTopDocumentsAwaitable(AsyncQueryExecutor& executor,
+        std::string_view raw_query, DocumentStatus status = DocumentStatus::ACTUAL, ResultPage page = {}) const;
+    AsyncQueryAwaitable<std::vector<Document>> FindTopDocumentsAwaitable(std::string_view raw_query,
+        DocumentStatus status = DocumentStatus::ACTUAL, ResultPage page = {}) const;
+#endif
+
+    // Statistics of the query plus words; views in the result refer to raw_query
+    CorpusStatistics GetCorpusStatistics(std::string_view raw_query) const;
+    // Views in the result refer to the words of query
+    CorpusStatistics GetCorpusStatistics(const PreparedQuery& query) const;
+
+    // Ranking order of FindTopDocuments
+    static bool IsMoreRelevant(const Document& lhs, const Document& rhs);
+    // Keeps only the documents of the page, in ranking order
+    static void SelectPage(std::vector<Document>& documents, ResultPage page);
 
     int GetDocumentCount() const;
-    std::set<int>::iterator begin();
-    std::set<int>::iterator end();
+    bool HasDocument(int document_id) const;
+    // Sets the bit of the document in a bitmap for ExcludingFilter. The bitmap fits
+    // this server only and only until its documents are compacted
+    void MarkDocument(ChunkedOrdinalBitmap& ordinals, int document_id) const;
+    // Whether the document is in the server and its bit is set
+    bool IsMarked(const ChunkedOrdinalBitmap& ordinals, int document_id) const;
+    // Changes with every update that can change query results; never the same for
+    // two servers, so results stamped with it can be checked for being current
+    uint64_t GetGeneration() const;
+    std::set<int>::const_iterator begin() const;
+    std::set<int>::const_iterator end() const;
 
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::string_view raw_query,
         int document_id) const;
@@ -57,202 +281,770 @@ public:
         const std::execution::parallel_policy&,
         std::string_view raw_query,
         int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(
+        const SearchExecutor& executor,
+        std::string_view raw_query,
+        int document_id) const;
 
+    // The reference may dangle after the document is removed, Snapshot keeps it alive
     const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
 
+    class Snapshot;
+    // Makes the current state of the index the one GetSnapshot returns. The snapshot
+    // shares the index: it copies one pointer per chunk of the document columns, and
+    // the first write after it copies what it changes, a column chunk or a posting
+    // list by itself. Adding a term still copies the term tables, which grow with
+    // the vocabulary rather than the corpus. So publish once per batch of writes
+    // rather than after each of them
+    void PublishSnapshot();
+    // State of the last PublishSnapshot, a new server publishes its initial one.
+    // Safe to call from any thread while the server is written
+    Snapshot GetSnapshot() const;
+
     void RemoveDocument(int document_id);
     void RemoveDocument(const std::execution::sequenced_policy&, int document_id);
     void RemoveDocument(const std::execution::parallel_policy&, int document_id);
+    void RemoveDocument(const SearchExecutor& executor, int document_id);
+    // Drops removed documents from the postings, renumbers the live ones and frees
+    // terms left without documents. Waits for a background compaction first
+    void Compact();
+    // Once enough documents are removed, RemoveDocument starts compacting the index
+    // on another thread and returns. The next update after it is done installs the
+    // result, carrying over the documents added and removed meanwhile
+    bool IsCompacting() const;
+    // Blocks until the background compaction is done and installs it
+    void WaitForCompaction();
+
+    // Packs every posting list into the compressed block format. Scoring then uses
+    // float-quantized term frequencies; lists touched by later updates are unpacked.
+    void CompressPostings();
+
+    // Both modes return the same documents; PRUNED evaluates queries sequentially.
+    // Safe to call while queries run, each query reads the mode once
+    void SetQueryEvaluation(QueryEvaluation evaluation);
+
+    // Writes the index into a versioned, checksummed file. Postings keep their
+    // current form, compressed or not. The file replaces path once it is complete
+    // and synced, so servers that opened the old one keep reading it
+    void Save(const std::string& path) const;
+    // Maps a file written by Save. Only the postings are served from the mapping,
+    // each list is copied when first modified. Everything else is deserialized:
+    // the dictionary, the document columns and ids and the word frequencies are
+    // rebuilt from their stored arrays without tokenizing, in time and memory
+    // linear in the corpus. GetWordFrequencies returns a std::map, so the word
+    // frequencies cannot stay in the file
+    static SearchServer OpenMapped(const std::string& path);
 
 private:
-    struct DocumentData {
-        int rating = 0;
-        DocumentStatus status = DocumentStatus::ACTUAL;
+    // File the postings of an opened index point into
+    std::shared_ptr<const MappedFile> mapped_file_;
+    // Never changed, so snapshots share them
+    std::shared_ptr<const std::set<std::string>> stop_words_;
+    // Compiled from stop_words_, answers IsStopWord for every token
+    std::shared_ptr<const StopWordSet> stop_word_set_;
+    // Every indexed word is interned once: its text lives in terms_ and its
+    // postings in postings_, both indexed by the term id from term_ids_.
+    // Postings refer to documents by ordinal, a dense number given in order of
+    // addition; ordinal_to_document_id_ maps it back. Removal only marks the
+    // ordinal with -1, scoring skips it and Compact later drops it from postings.
+    // The parts below are shared with published snapshots and copied by the first
+    // write that changes them, each posting list on its own. Term texts are never
+    // changed, so word views stay valid while any snapshot holds the term
+    CopyOnWrite<std::vector<std::shared_ptr<const std::string>>> terms_;
+    CopyOnWrite<std::map<std::string_view, uint32_t>> term_ids_;
+    CopyOnWrite<std::vector<CopyOnWrite<PostingList>>> postings_;
+    // Live documents containing the term, postings may still hold removed ones
+    CopyOnWrite<std::vector<int>> document_freqs_;
+    // Drawn anew whenever a word gets or loses its term id; unique across servers,
+    // so a prepared query resolved under it can reuse its term ids
+    uint64_t dictionary_version_ = NewVersion();
+    // Drawn anew by every update that can change query results
+    uint64_t generation_ = NewVersion();
+    int removed_document_count_ = 0;
+    // IDF of every term with the document count and document frequency it was
+    // computed for, so a query recomputes it only after either of them changed.
+    // Queries running at the same time see the same index and store equal values.
+    // Snapshots see other counts, so they start without entries and compute IDF
+    struct CachedInverseDocumentFreq {
+        std::atomic<uint64_t> key{ 0 };
+        std::atomic<double> value{ 0.0 };
     };
-    const std::set<std::string> stop_words_;
-    std::map<std::string_view, std::map<int, double>> word_to_document_freqs_;
-    std::map<int, std::map<std::string_view, double>> id_to_document_freqs_;
-    std::map<int, DocumentData> documents_;
-    std::set<int> document_ids_;
-    std::set<std::string, std::less<>> documents_in_strings_;
-    const std::map<std::string_view, double> empty_ref_;
+    struct InverseDocumentFreqCache {
+        std::deque<CachedInverseDocumentFreq> entries;
+
+        InverseDocumentFreqCache() = default;
+        InverseDocumentFreqCache(const InverseDocumentFreqCache&) {
+        }
+        InverseDocumentFreqCache(InverseDocumentFreqCache&&) = default;
+    };
+    mutable InverseDocumentFreqCache inverse_document_freqs_;
+    // Document attributes are columns indexed by ordinal, status filters use the
+    // bitmap of live documents with that status. Columns and the id map are
+    // chunked, so a write after a snapshot copies a chunk and not the whole column
+    ChunkedVector<int> ordinal_to_document_id_;
+    ChunkedVector<int> document_ratings_;
+    ChunkedVector<DocumentStatus> document_statuses_;
+    std::array<ChunkedOrdinalBitmap, DOCUMENT_STATUS_COUNT> status_bitmaps_;
+    // Word frequencies of a document are never changed, a removed document's stay
+    // with the snapshots that hold them; null for removed ordinals
+    ChunkedVector<std::shared_ptr<const std::map<std::string_view, double>>> document_word_freqs_;
+    ChunkedMap<int, int> document_ordinals_;
+    // Used by writes only, so the copies made for snapshots and compaction start
+    // empty instead of copying them
+    struct WriterState {
+        // Ids of terms freed by Compact, reused by new terms
+        std::vector<uint32_t> free_term_ids;
+        // What begin and end iterate
+        std::set<int> document_ids;
+
+        WriterState() = default;
+        WriterState(const WriterState&) {
+        }
+        WriterState(WriterState&&) = default;
+    };
+    WriterState writer_state_;
+    // Atomic, so SetQueryEvaluation may run during queries, yet movable with the server
+    struct AtomicQueryEvaluation {
+        std::atomic<QueryEvaluation> value = QueryEvaluation::EXHAUSTIVE;
+
+        AtomicQueryEvaluation() = default;
+        AtomicQueryEvaluation(const AtomicQueryEvaluation& other)
+            : value(other.value.load())
+        {
+        }
+        AtomicQueryEvaluation& operator=(const AtomicQueryEvaluation& other) {
+            value = other.value.load();
+            return *this;
+        }
+    };
+    AtomicQueryEvaluation query_evaluation_;
+    // Columns and postings of the live documents only, renumbered in ordinal order
+    struct CompactedIndex {
+        // New ordinal of every old one, -1 for removed documents
+        std::vector<int> new_ordinals;
+        ChunkedVector<int> ordinal_to_document_id;
+        ChunkedVector<int> document_ratings;
+        ChunkedVector<DocumentStatus> document_statuses;
+        std::array<ChunkedOrdinalBitmap, DOCUMENT_STATUS_COUNT> status_bitmaps;
+        ChunkedVector<std::shared_ptr<const std::map<std::string_view, double>>> document_word_freqs;
+        ChunkedMap<int, int> document_ordinals;
+        std::vector<CopyOnWrite<PostingList>> postings;
+    };
+    // Built from a copy sharing the index, so updates go on meanwhile. Snapshots
+    // do not take it
+    struct PendingCompaction {
+        std::future<CompactedIndex> index;
+
+        PendingCompaction() = default;
+        PendingCompaction(const PendingCompaction&) {
+        }
+        PendingCompaction(PendingCompaction&&) = default;
+    };
+    PendingCompaction pending_compaction_;
+    // Read and replaced with std::atomic_load and std::atomic_store
+    std::shared_ptr<const SearchServer> snapshot_;
+
+    // Shares every part of the index with other
+    SearchServer(const SearchServer& other) = default;
+
+    // Reader must be positioned at the stop words of the mapped file
+    SearchServer(std::shared_ptr<const MappedFile> mapped_file, IndexReader reader);
+    static std::vector<std::string> ReadStopWords(IndexReader& reader);
+    void LoadIndex(IndexReader& reader);
 
     bool IsStopWord(std::string_view word) const;
     static bool IsValidWord(std::string_view word);
-    std::vector<std::string_view> SplitIntoWordsNoStop(std::string_view text) const;
     static int ComputeAverageRating(const std::vector<int>& ratings);
+    // Reused by every query of the calling thread, so scoring does not allocate once warmed up
+    static ScoreAccumulator& GetThreadScoreAccumulator();
+    // Tokenizer output of the calling thread, reused by every document and query it parses
+    static std::vector<std::string_view>& GetThreadWordBuffer();
+    static void SelectPage(const std::execution::sequenced_policy&, std::vector<Document>& documents,
+        ResultPage page);
+    static void SelectPage(const std::execution::parallel_policy&, std::vector<Document>& documents,
+        ResultPage page);
+    static void SelectPage(const SearchExecutor& executor, std::vector<Document>& documents, ResultPage page);
+    // for_each(first, last, function) runs function over the chunk begins in parallel
+    template <typename ForEach>
+    static void SelectPageInChunks(ForEach for_each, size_t chunk_count, std::vector<Document>& documents,
+        ResultPage page);
+    uint32_t InternTerm(std::string_view word);
+    static constexpr uint32_t NO_TERM_ID = std::numeric_limits<uint32_t>::max();
+    uint32_t FindTermId(std::string_view word) const;
+    // Throws std::out_of_range for an unknown document
+    int GetDocumentOrdinal(int document_id) const;
+    // Numbers from one counter shared by all servers, so no two states get the same one
+    static uint64_t NewVersion();
+
+    struct TermPosting {
+        uint32_t term_id;
+        int ordinal;
+        double term_freq;
+    };
+    // Frequencies of the words of a document, keyed by views into its text
+    std::map<std::string_view, double> ComputeWordFreqs(std::string_view document) const;
+    // Gives the document an ordinal and stores everything except its postings,
+    // which are appended to term_postings
+    void RegisterDocument(int document_id, const std::map<std::string_view, double>& word_freqs,
+        DocumentStatus status, int rating, std::vector<TermPosting>& term_postings);
+    // Adds postings of documents registered in ordinal order, each list by its own task
+    void AppendPostings(const std::vector<TermPosting>& term_postings);
+    // Marks the document removed once its terms no longer count it. Takes the id
+    // and ordinal out of document before the map is changed
+    void EraseDocument(int document_id, int ordinal);
+    CompactedIndex BuildCompactedIndex() const;
+    // Index may be built from an earlier state: documents removed since then are
+    // marked again and the ones added since then are appended after the live ones
+    void InstallCompactedIndex(CompactedIndex index);
+    // Does not wait for a compaction still running
+    void InstallFinishedCompaction();
+    const PostingList* FindPostings(std::string_view word) const;
     struct QueryWord {
         std::string_view data;
         bool is_minus;
         bool is_stop;
     };
 
-    QueryWord ParseQueryWord(std::string_view text) const;
+    // is_valid tells whether the tokenizer found no control characters in the word
+    QueryWord ParseQueryWord(std::string_view text, bool is_valid) const;
     struct Query {
         std::vector<std::string_view> plus_words;
         std::vector<std::string_view> minus_words;
     };
     Query ParseQuery(std::string_view text) const;
     Query ParseQueryPar(std::string_view text) const;
-    // Existence required
-    double ComputeWordInverseDocumentFreq(std::string_view word) const;
+    template <typename ExecutionPolicy>
+    Query ParseQueryUnique(ExecutionPolicy&& policy, std::string_view text) const;
+    // Term must have postings
+    double GetInverseDocumentFreq(uint32_t term_id) const;
+
+    struct QueryTerm {
+        const PostingList* postings;
+        double inverse_document_freq;
+        uint32_t term_id;
+    };
+    // Query words that occur in the index, plus terms in query word order
+    struct QueryTerms {
+        std::vector<QueryTerm> plus_terms;
+        std::vector<const PostingList*> minus_terms;
+    };
+    QueryTerms ResolveQuery(const Query& query, const CorpusStatistics* corpus) const;
+    QueryTerms ResolveQuery(const PreparedQuery& query, const CorpusStatistics* corpus = nullptr) const;
 
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocumentsInCorpus(ExecutionPolicy&& policy, std::string_view raw_query,
+        DocumentPredicate document_predicate, ResultPage page, const CorpusStatistics* corpus) const;
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocumentsResolved(ExecutionPolicy&& policy, const QueryTerms& query,
+        DocumentPredicate document_predicate, ResultPage page) const;
+
+    // Whether the document is live and passes the predicate
     template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(Query& query,
+    bool IsAccepted(int ordinal, DocumentPredicate& document_predicate) const;
+
+    // Best documents offered so far, at most capacity of them, kept as a heap in
+    // storage of the caller with the least relevant one in front
+    class TopDocumentHeap {
+    public:
+        TopDocumentHeap(Document* documents, size_t capacity);
+
+        bool IsFull() const;
+        const Document& GetLeastRelevant() const;
+        void Push(const Document& document);
+        // Sorts the documents, moves those past offset to the front of the storage
+        // and returns their count
+        size_t ExtractPage(size_t offset);
+
+    private:
+        Document* documents_;
+        size_t capacity_;
+        size_t size_ = 0;
+    };
+
+    // Scores every accepted document of the query into the accumulator of the thread
+    template <typename DocumentPredicate>
+    ScoreAccumulator& ScoreAllDocuments(const QueryTerms& query, DocumentPredicate document_predicate) const;
+
+    // The parallel version may leave out documents that cannot make it into the
+    // first top_count results; the sequential one returns every match
+    template <typename DocumentPredicate>
+    std::vector<Document> FindAllDocuments(const QueryTerms& query,
         DocumentPredicate document_predicate) const;
     template <typename DocumentPredicate>
     std::vector<Document> FindAllDocuments(
         const std::execution::sequenced_policy&,
-        Query& query,
-        DocumentPredicate document_predicate) const;
+        const QueryTerms& query,
+        DocumentPredicate document_predicate,
+        size_t top_count) const;
     template <typename DocumentPredicate>
     std::vector<Document> FindAllDocuments(
         const std::execution::parallel_policy&,
-        Query& query,
-        DocumentPredicate document_predicate) const;
+        const QueryTerms& query,
+        DocumentPredicate document_predicate,
+        size_t top_count) const;
+    template <typename DocumentPredicate>
+    std::vector<Document> FindAllDocuments(
+        const SearchExecutor& executor,
+        const QueryTerms& query,
+        DocumentPredicate document_predicate,
+        size_t top_count) const;
+    // for_each(first, last, function) runs function over the partitions in parallel
+    template <typename ForEach, typename DocumentPredicate>
+    std::vector<Document> FindAllDocumentsPartitioned(ForEach for_each, size_t thread_count,
+        const QueryTerms& query, DocumentPredicate document_predicate, size_t top_count) const;
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocumentsPruned(const QueryTerms& query,
+        DocumentPredicate document_predicate, ResultPage page) const;
+    template <typename DocumentPredicate>
+    void CollectTopDocumentsPruned(const QueryTerms& query, DocumentPredicate document_predicate,
+        TopDocumentHeap& top_documents) const;
+
+};
+
+// Read-only server published by SearchServer::PublishSnapshot. Queries on it never
+// lock and see nothing of later writes; document ids, word views and references
+// returned through it stay valid while it lives
+class SearchServer::Snapshot {
+public:
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, ResultPage page = {}) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+        ResultPage page = {}) const;
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate,
+        ResultPage page = {}) const;
+
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+        ResultPage page = {}) const;
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+        DocumentStatus status, ResultPage page = {}) const;
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+        DocumentPredicate document_predicate, ResultPage page = {}) const;
+
+    int GetDocumentCount() const;
+    // Ascending
+    std::vector<int> GetDocumentIds() const;
+    uint64_t GetGeneration() const;
+
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::string_view raw_query,
+        int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(
+        const std::execution::sequenced_policy&,
+        std::string_view raw_query,
+        int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(
+        const std::execution::parallel_policy&,
+        std::string_view raw_query,
+        int document_id) const;
+
+    const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
+
+private:
+    friend class SearchServer;
+    std::shared_ptr<const SearchServer> server_;
 
+    explicit Snapshot(std::shared_ptr<const SearchServer> server);
 };
 
 template <typename StringContainer>
 SearchServer::SearchServer(const StringContainer& stop_words)
-    : stop_words_(MakeUniqueNonEmptyStrings(stop_words))  // Extract non-empty stop words
+    : stop_words_(std::make_shared<const std::set<std::string>>(MakeUniqueNonEmptyStrings(stop_words)))  // Extract non-empty stop words
+    , stop_word_set_(std::make_shared<const StopWordSet>(*stop_words_))
 {
-    if (!all_of(stop_words_.begin(), stop_words_.end(), IsValidWord)) {
+    if (!all_of(stop_words_->begin(), stop_words_->end(), IsValidWord)) {
         throw std::invalid_argument("Some of stop words are invalid");
     }
+    PublishSnapshot();
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::Snapshot::FindTopDocuments(std::string_view raw_query,
+    DocumentPredicate document_predicate, ResultPage page) const {
+    return server_->FindTopDocuments(raw_query, document_predicate, page);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::Snapshot::FindTopDocuments(ExecutionPolicy&& policy,
+    std::string_view raw_query, ResultPage page) const {
+    return server_->FindTopDocuments(policy, raw_query, page);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::Snapshot::FindTopDocuments(ExecutionPolicy&& policy,
+    std::string_view raw_query, DocumentStatus status, ResultPage page) const {
+    return server_->FindTopDocuments(policy, raw_query, status, page);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::Snapshot::FindTopDocuments(ExecutionPolicy&& policy,
+    std::string_view raw_query, DocumentPredicate document_predicate, ResultPage page) const {
+    return server_->FindTopDocuments(policy, raw_query, document_predicate, page);
 }
 
 template <typename DocumentPredicate>
 std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query,
-    DocumentPredicate document_predicate) const {
-    return FindTopDocuments(std::execution::seq, raw_query, document_predicate);
+    DocumentPredicate document_predicate, ResultPage page) const {
+    return FindTopDocuments(std::execution::seq, raw_query, document_predicate, page);
 }
 template <typename ExecutionPolicy>
 std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy,
-    std::string_view raw_query) const {
-    return SearchServer::FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
+    std::string_view raw_query, ResultPage page) const {
+    return SearchServer::FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL, page);
 }
 template <typename ExecutionPolicy>
-std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query, DocumentStatus status) const {
-    return FindTopDocuments(
-        policy,
-        raw_query,
-        [status](int document_id, DocumentStatus document_status, int rating) {
-            return document_status == status;
-        });
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+    DocumentStatus status, ResultPage page) const {
+    return FindTopDocuments(policy, raw_query, DocumentStatusFilter{ status }, page);
 }
 
 template <typename ExecutionPolicy, typename DocumentPredicate>
 std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
-    DocumentPredicate document_predicate) const {
-    auto query = ParseQueryPar(raw_query);
+    DocumentPredicate document_predicate, ResultPage page) const {
+    return FindTopDocumentsInCorpus(policy, raw_query, document_predicate, page, nullptr);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+    DocumentPredicate document_predicate, ResultPage page, const CorpusStatistics& corpus) const {
+    return FindTopDocumentsInCorpus(policy, raw_query, document_predicate, page, &corpus);
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(const PreparedQuery& query,
+    DocumentPredicate document_predicate, ResultPage page) const {
+    return FindTopDocuments(std::execution::seq, query, document_predicate, page);
+}
 
-    std::sort(policy, query.minus_words.begin(), query.minus_words.end());
-    std::sort(policy, query.plus_words.begin(), query.plus_words.end());
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query,
+    ResultPage page) const {
+    return FindTopDocuments(policy, query, DocumentStatus::ACTUAL, page);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query,
+    DocumentStatus status, ResultPage page) const {
+    return FindTopDocuments(policy, query, DocumentStatusFilter{ status }, page);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query,
+    DocumentPredicate document_predicate, ResultPage page) const {
+    return FindTopDocumentsResolved(policy, ResolveQuery(query), document_predicate, page);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const PreparedQuery& query,
+    DocumentPredicate document_predicate, ResultPage page, const CorpusStatistics& corpus) const {
+    return FindTopDocumentsResolved(policy, ResolveQuery(query, &corpus), document_predicate, page);
+}
+
+template <typename ExecutionPolicy>
+SearchServer::Query SearchServer::ParseQueryUnique(ExecutionPolicy&& policy, std::string_view text) const {
+    auto query = ParseQueryPar(text);
+
+    // A handful of words is not worth the pool of an executor
+    if constexpr (std::is_execution_policy_v<std::decay_t<ExecutionPolicy>>) {
+        std::sort(policy, query.minus_words.begin(), query.minus_words.end());
+        std::sort(policy, query.plus_words.begin(), query.plus_words.end());
+    }
+    else {
+        std::sort(query.minus_words.begin(), query.minus_words.end());
+        std::sort(query.plus_words.begin(), query.plus_words.end());
+    }
     auto last = std::unique(query.minus_words.begin(), query.minus_words.end());
     query.minus_words.erase(last, query.minus_words.end());
     last = std::unique(query.plus_words.begin(), query.plus_words.end());
     query.plus_words.erase(last, query.plus_words.end());
+    return query;
+}
 
-    auto matched_documents = FindAllDocuments(policy, query, document_predicate);
-    std::sort(policy, matched_documents.begin(), matched_documents.end(),
-        [](const Document& lhs, const Document& rhs) {
-            if (std::abs(lhs.relevance - rhs.relevance) < TOLERANCE) {
-                return lhs.rating > rhs.rating;
-            }
-            else {
-                return lhs.relevance > rhs.relevance;
-            }
-        });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocumentsInCorpus(ExecutionPolicy&& policy, std::string_view raw_query,
+    DocumentPredicate document_predicate, ResultPage page, const CorpusStatistics* corpus) const {
+    return FindTopDocumentsResolved(policy, ResolveQuery(ParseQueryUnique(policy, raw_query), corpus),
+        document_predicate, page);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocumentsResolved(ExecutionPolicy&& policy, const QueryTerms& query,
+    DocumentPredicate document_predicate, ResultPage page) const {
+    if (query_evaluation_.value == QueryEvaluation::PRUNED) {
+        return FindTopDocumentsPruned(query, document_predicate, page);
     }
+    auto matched_documents = FindAllDocuments(policy, query, document_predicate, page.offset + page.count);
+    SelectPage(policy, matched_documents, page);
     return matched_documents;
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(Query& query,
+bool SearchServer::IsAccepted(int ordinal, DocumentPredicate& document_predicate) const {
+    if constexpr (std::is_same_v<std::decay_t<DocumentPredicate>, DocumentStatusFilter>) {
+        return status_bitmaps_[static_cast<size_t>(document_predicate.status)].Test(ordinal);
+    }
+    else if constexpr (IsExcludingFilter<std::decay_t<DocumentPredicate>>::value) {
+        return !document_predicate.excluded->Test(ordinal) && IsAccepted(ordinal, document_predicate.filter);
+    }
+    else {
+        const int document_id = ordinal_to_document_id_[ordinal];
+        return document_id >= 0
+            && document_predicate(document_id, document_statuses_[ordinal], document_ratings_[ordinal]);
+    }
+}
+
+template <typename DocumentPredicate>
+ScoreAccumulator& SearchServer::ScoreAllDocuments(const QueryTerms& query,
     DocumentPredicate document_predicate) const {
-    std::map<int, double> document_to_relevance;
+    ScoreAccumulator& document_to_relevance = GetThreadScoreAccumulator();
+    document_to_relevance.Reset(ordinal_to_document_id_.size());
 
-    for (std::string_view word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-        for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-            if (documents_.count(document_id)) {
-                const auto& document_data = documents_.at(document_id);
-                if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                    document_to_relevance[document_id] += term_freq * inverse_document_freq;
-                }
-            }
-        }
+    for (const PostingList* postings : query.minus_terms) {
+        postings->ForEach([&document_to_relevance](int ordinal, double) {
+            document_to_relevance.Exclude(ordinal);
+        });
     }
-    for (std::string_view word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-            document_to_relevance.erase(document_id);
-        }
+    for (const QueryTerm& term : query.plus_terms) {
+        term.postings->ForEach([&](int ordinal, double term_freq) {
+            if (IsAccepted(ordinal, document_predicate)) {
+                document_to_relevance.Add(ordinal, term_freq * term.inverse_document_freq);
+            }
+        });
     }
+    return document_to_relevance;
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindAllDocuments(const QueryTerms& query,
+    DocumentPredicate document_predicate) const {
     std::vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : document_to_relevance) {
+    ScoreAccumulator& document_to_relevance = ScoreAllDocuments(query, document_predicate);
+    document_to_relevance.ForEachScored([this, &matched_documents](int ordinal, double relevance) {
         matched_documents.push_back(
-            { document_id, relevance, documents_.at(document_id).rating });
-    }
+            { ordinal_to_document_id_[ordinal], relevance, document_ratings_[ordinal] });
+    });
     return matched_documents;
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const std::execution::sequenced_policy&, Query& query,
-    DocumentPredicate document_predicate) const {
+std::vector<Document> SearchServer::FindAllDocuments(const std::execution::sequenced_policy&, const QueryTerms& query,
+    DocumentPredicate document_predicate, size_t) const {
     return FindAllDocuments(query, document_predicate);
 }
 
 template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const std::execution::parallel_policy&, Query& query,
-    DocumentPredicate document_predicate) const {
-    ConcurrentMap<int, double> document_to_relevance(MAX_MAPS_TO_DIVIDE);
-    std::for_each(std::execution::par,
-        query.plus_words.begin(),
-        query.plus_words.end(),
-        [this, &document_to_relevance, document_predicate](std::string_view word)
-        {
-            if (word_to_document_freqs_.count(word) == 0) {
-                return;
+std::vector<Document> SearchServer::FindAllDocuments(const std::execution::parallel_policy&, const QueryTerms& query,
+    DocumentPredicate document_predicate, size_t top_count) const {
+    return FindAllDocumentsPartitioned([](auto first, auto last, auto function) {
+        std::for_each(std::execution::par, first, last, function);
+        }, std::thread::hardware_concurrency(), query, document_predicate, top_count);
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindAllDocuments(const SearchExecutor& executor, const QueryTerms& query,
+    DocumentPredicate document_predicate, size_t top_count) const {
+    return FindAllDocumentsPartitioned([&executor](auto first, auto last, auto function) {
+        executor.ForEach(first, last, function);
+        }, executor.GetThreadCount(), query, document_predicate, top_count);
+}
+
+template <typename ForEach, typename DocumentPredicate>
+std::vector<Document> SearchServer::FindAllDocumentsPartitioned(ForEach for_each, size_t thread_count,
+    const QueryTerms& query, DocumentPredicate document_predicate, size_t top_count) const {
+    // The ordinal space is cut into disjoint ranges. Each task scores its range into
+    // the thread's own accumulator and keeps only its local top, so tasks share nothing
+    const int ordinal_count = static_cast<int>(ordinal_to_document_id_.size());
+    const int max_partitions = std::max(1, ordinal_count / MIN_ORDINALS_PER_PARTITION);
+    const int partition_count = std::min(max_partitions, 4 * std::max(1, static_cast<int>(thread_count)));
+    const int partition_size = (ordinal_count + partition_count - 1) / std::max(1, partition_count);
+    std::vector<std::vector<Document>> partition_tops(partition_count);
+    std::vector<int> partitions(partition_count);
+    std::iota(partitions.begin(), partitions.end(), 0);
+
+    for_each(partitions.begin(), partitions.end(),
+        [&](int partition) {
+            const int first = partition * partition_size;
+            const int last = std::min(ordinal_count, first + partition_size);
+            ScoreAccumulator& document_to_relevance = GetThreadScoreAccumulator();
+            document_to_relevance.Reset(ordinal_to_document_id_.size());
+            for (const PostingList* postings : query.minus_terms) {
+                postings->ForEachInRange(first, last, [&document_to_relevance](int ordinal, double) {
+                    document_to_relevance.Exclude(ordinal);
+                });
             }
-            const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-
-            std::for_each(std::execution::par,
-                word_to_document_freqs_.at(word).begin(),
-                word_to_document_freqs_.at(word).end(),
-                [this, &document_to_relevance, document_predicate, inverse_document_freq](const auto pair) {
-                    if (documents_.count(pair.first)) {
-                        const auto document_data = documents_.at(pair.first);
-                        if (document_predicate(pair.first, document_data.status, document_data.rating)) {
-
-                            document_to_relevance[pair.first].ref_to_value += pair.second * inverse_document_freq;
-                        }
+            for (const QueryTerm& term : query.plus_terms) {
+                term.postings->ForEachInRange(first, last, [&](int ordinal, double term_freq) {
+                    if (IsAccepted(ordinal, document_predicate)) {
+                        document_to_relevance.Add(ordinal, term_freq * term.inverse_document_freq);
                     }
-                }
-            );
+                });
+            }
+            std::vector<Document>& matched_documents = partition_tops[partition];
+            document_to_relevance.ForEachScored([this, &matched_documents](int ordinal, double relevance) {
+                matched_documents.push_back(
+                    { ordinal_to_document_id_[ordinal], relevance, document_ratings_[ordinal] });
+            });
+            SelectPage(matched_documents, { 0, top_count });
+        });
+
+    std::vector<Document> matched_documents;
+    for (const auto& partition_top : partition_tops) {
+        matched_documents.insert(matched_documents.end(), partition_top.begin(), partition_top.end());
+    }
+    return matched_documents;
+}
+
+template <typename ForEach>
+void SearchServer::SelectPageInChunks(ForEach for_each, size_t chunk_count, std::vector<Document>& documents,
+    ResultPage page) {
+    const size_t top_count = std::min(documents.size(), page.offset + page.count);
+    const size_t chunk_size = (documents.size() + chunk_count - 1) / chunk_count;
+    if (chunk_size <= top_count) {
+        SelectPage(documents, page);
+        return;
+    }
+    // Every chunk moves its own best top_count documents to its front, then the
+    // chunk winners are merged into the final top
+    std::vector<size_t> chunk_begins;
+    for (size_t begin = 0; begin < documents.size(); begin += chunk_size) {
+        chunk_begins.push_back(begin);
+    }
+    for_each(chunk_begins.begin(), chunk_begins.end(),
+        [&documents, chunk_size, top_count](size_t begin) {
+            const auto first = documents.begin() + begin;
+            const auto last = documents.begin() + std::min(documents.size(), begin + chunk_size);
+            std::partial_sort(first, first + std::min<size_t>(top_count, last - first), last, IsMoreRelevant);
+        });
+    std::vector<Document> candidates;
+    candidates.reserve(chunk_begins.size() * top_count);
+    for (const size_t begin : chunk_begins) {
+        const auto first = documents.begin() + begin;
+        candidates.insert(candidates.end(), first, first + std::min(top_count, documents.size() - begin));
+    }
+    SelectPage(candidates, page);
+    documents = std::move(candidates);
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SearchServer::FindTopDocumentsPruned(const QueryTerms& query,
+    DocumentPredicate document_predicate, ResultPage page) const {
+    if (page.count == 0) {
+        return {};
+    }
+    std::vector<Document> top_documents(page.offset + page.count);
+    TopDocumentHeap top(top_documents.data(), top_documents.size());
+    CollectTopDocumentsPruned(query, document_predicate, top);
+    top_documents.resize(top.ExtractPage(page.offset));
+    return top_documents;
+}
+
+template <typename DocumentPredicate>
+void SearchServer::CollectTopDocumentsPruned(const QueryTerms& query, DocumentPredicate document_predicate,
+    TopDocumentHeap& top_documents) const {
+    struct TermCursor {
+        PostingCursor cursor;
+        double inverse_document_freq;
+        double max_score;
+        size_t term_index;
+    };
+    std::vector<TermCursor> terms;
+    for (size_t i = 0; i < query.plus_terms.size(); ++i) {
+        const QueryTerm& term = query.plus_terms[i];
+        terms.push_back({ PostingCursor(*term.postings), term.inverse_document_freq,
+            term.postings->GetMaxTermFreq() * term.inverse_document_freq, i });
+    }
+    std::vector<PostingCursor> minus_cursors;
+    for (const PostingList* postings : query.minus_terms) {
+        minus_cursors.emplace_back(*postings);
+    }
+
+    // Terms go from the least to the most impactful. While the summed maximum scores
+    // of a prefix stay below the entry threshold of the top, that prefix is
+    // non-essential: it is only probed for documents found in the other terms.
+    std::sort(terms.begin(), terms.end(), [](const TermCursor& lhs, const TermCursor& rhs) {
+        return lhs.max_score < rhs.max_score;
+        });
+    std::vector<double> prefix_max_scores(terms.size());
+    double max_score_sum = 0;
+    for (size_t i = 0; i < terms.size(); ++i) {
+        max_score_sum += terms[i].max_score;
+        prefix_max_scores[i] = max_score_sum;
+    }
+
+    // Per-term contributions are summed in query word order, so relevance is
+    // bit-identical to the exhaustive evaluation
+    std::vector<double> contributions(query.plus_terms.size());
+    double threshold = -std::numeric_limits<double>::infinity();
+    size_t first_essential = 0;
+
+    while (true) {
+        int ordinal = std::numeric_limits<int>::max();
+        bool has_document = false;
+        for (size_t i = first_essential; i < terms.size(); ++i) {
+            if (!terms[i].cursor.IsEnd()) {
+                ordinal = std::min(ordinal, terms[i].cursor.GetOrdinal());
+                has_document = true;
+            }
+        }
+        if (!has_document) {
+            break;
+        }
+
+        std::fill(contributions.begin(), contributions.end(), 0.0);
+        double score = 0;
+        for (size_t i = first_essential; i < terms.size(); ++i) {
+            PostingCursor& cursor = terms[i].cursor;
+            if (!cursor.IsEnd() && cursor.GetOrdinal() == ordinal) {
+                const double contribution = cursor.GetTermFreq() * terms[i].inverse_document_freq;
+                contributions[terms[i].term_index] = contribution;
+                score += contribution;
+                cursor.Next();
+            }
         }
-    );
-    for (std::string_view word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
+
+        double block_bound = score;
+        for (size_t i = 0; i < first_essential; ++i) {
+            block_bound += terms[i].cursor.GetMaxTermFreqAt(ordinal) * terms[i].inverse_document_freq;
+        }
+        bool is_candidate = block_bound >= threshold;
+        for (size_t i = first_essential; is_candidate && i-- > 0;) {
+            if (score + prefix_max_scores[i] < threshold) {
+                is_candidate = false;
+                break;
+            }
+            PostingCursor& cursor = terms[i].cursor;
+            cursor.Seek(ordinal);
+            if (!cursor.IsEnd() && cursor.GetOrdinal() == ordinal) {
+                const double contribution = cursor.GetTermFreq() * terms[i].inverse_document_freq;
+                contributions[terms[i].term_index] = contribution;
+                score += contribution;
+            }
+        }
+        if (!is_candidate || !IsAccepted(ordinal, document_predicate)) {
             continue;
         }
-        for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-            document_to_relevance.erase(document_id);
+        const bool has_minus_word = std::any_of(minus_cursors.begin(), minus_cursors.end(),
+            [ordinal](PostingCursor& cursor) {
+                cursor.Seek(ordinal);
+                return !cursor.IsEnd() && cursor.GetOrdinal() == ordinal;
+            });
+        if (has_minus_word) {
+            continue;
+        }
+
+        double relevance = 0;
+        for (const double contribution : contributions) {
+            relevance += contribution;
+        }
+        top_documents.Push({ ordinal_to_document_id_[ordinal], relevance, document_ratings_[ordinal] });
+        if (top_documents.IsFull()) {
+            // A document within TOLERANCE of the worst one may still win by rating;
+            // twice the tolerance leaves room for rounding in the bounds
+            threshold = top_documents.GetLeastRelevant().relevance - 2 * TOLERANCE;
+            while (first_essential < terms.size() && prefix_max_scores[first_essential] < threshold) {
+                ++first_essential;
+            }
         }
     }
-    std::vector<Document> matched_documents;
-    for (const auto& [document_id, relevance] : document_to_relevance.BuildOrdinaryMap()) {
-        matched_documents.push_back(
-            { document_id, relevance, documents_.at(document_id).rating });
-    }
-    return matched_documents;
 }
-
@@ -0,0 +1,557 @@
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+#include "string_processing.h"
+#include "segmented_search_server.h"
+
+SegmentedSearchServer::Memtable::Memtable(const std::vector<std::string>& stop_words)
+    : index(stop_words)
+{
+}
+
+SegmentedSearchServer::Snapshot::Snapshot(std::vector<Segment> segments, std::shared_ptr<Memtable> memtable)
+    : segments(std::move(segments))
+    , memtable(std::move(memtable))
+{
+    this->memtable->snapshot_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+SegmentedSearchServer::Snapshot::~Snapshot() {
+    // Reads of the memtable through this snapshot happen before the release
+    memtable->snapshot_count.fetch_sub(1, std::memory_order_release);
+}
+
+namespace {
+// Map no other tombstone version shares, copied first if another one does
+std::map<std::string_view, int>& ModifyDocumentFreqs(std::shared_ptr<std::map<std::string_view, int>>& freqs) {
+    if (!freqs) {
+        freqs = std::make_shared<std::map<std::string_view, int>>();
+    }
+    else if (freqs.use_count() > 1) {
+        freqs = std::make_shared<std::map<std::string_view, int>>(*freqs);
+    }
+    return *freqs;
+}
+}
+
+void SegmentedSearchServer::Tombstones::Add(const SearchServer& index, int document_id) {
+    index.MarkDocument(ordinals, document_id);
+    ++document_count;
+    auto& recent = ModifyDocumentFreqs(recent_document_freqs);
+    for (const auto& [word, term_freq] : index.GetWordFrequencies(document_id)) {
+        ++recent[word];
+    }
+    const size_t base_size = document_freqs ? document_freqs->size() : 0;
+    if (recent.size() > std::max(MIN_RECENT_TOMBSTONE_WORDS, static_cast<size_t>(std::sqrt(base_size)))) {
+        auto& base = ModifyDocumentFreqs(document_freqs);
+        for (const auto& [word, document_freq] : recent) {
+            base[word] += document_freq;
+        }
+        recent_document_freqs.reset();
+    }
+}
+
+int SegmentedSearchServer::Tombstones::GetDocumentFreq(std::string_view word) const {
+    int document_freq = 0;
+    for (const auto* freqs : { document_freqs.get(), recent_document_freqs.get() }) {
+        if (freqs != nullptr) {
+            const auto deleted_freq = freqs->find(word);
+            if (deleted_freq != freqs->end()) {
+                document_freq += deleted_freq->second;
+            }
+        }
+    }
+    return document_freq;
+}
+
+SegmentedSearchServer::View::View(std::shared_ptr<const Snapshot> snapshot)
+    : snapshot_(std::move(snapshot))
+{
+}
+
+std::vector<Document> SegmentedSearchServer::View::FindTopDocuments(std::string_view raw_query,
+    DocumentStatus status, ResultPage page) const {
+    return FindTopDocuments(std::execution::seq, raw_query, status, page);
+}
+
+std::vector<Document> SegmentedSearchServer::View::FindTopDocuments(std::string_view raw_query,
+    ResultPage page) const {
+    return FindTopDocuments(raw_query, DocumentStatus::ACTUAL, page);
+}
+
+int SegmentedSearchServer::View::GetDocumentCount() const {
+    int document_count = snapshot_->memtable->index.GetDocumentCount();
+    for (const Segment& segment : snapshot_->segments) {
+        document_count += segment.index->GetDocumentCount() - segment.tombstones->document_count;
+    }
+    return document_count;
+}
+
+std::vector<int> SegmentedSearchServer::View::GetDocumentIds() const {
+    const SearchServer& memtable = snapshot_->memtable->index;
+    std::vector<int> document_ids(memtable.begin(), memtable.end());
+    for (const Segment& segment : snapshot_->segments) {
+        std::copy_if(segment.index->begin(), segment.index->end(), std::back_inserter(document_ids),
+            [&segment](int document_id) {
+                return !segment.index->IsMarked(segment.tombstones->ordinals, document_id);
+            });
+    }
+    std::sort(document_ids.begin(), document_ids.end());
+    return document_ids;
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SegmentedSearchServer::View::MatchDocument(
+    std::string_view raw_query, int document_id) const {
+    return MatchDocument(std::execution::seq, raw_query, document_id);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SegmentedSearchServer::View::MatchDocument(
+    const std::execution::sequenced_policy&, std::string_view raw_query, int document_id) const {
+    return FindSegment(document_id).MatchDocument(std::execution::seq, raw_query, document_id);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SegmentedSearchServer::View::MatchDocument(
+    const std::execution::parallel_policy&, std::string_view raw_query, int document_id) const {
+    return FindSegment(document_id).MatchDocument(std::execution::par, raw_query, document_id);
+}
+
+const std::map<std::string_view, double>& SegmentedSearchServer::View::GetWordFrequencies(int document_id) const {
+    return FindSegment(document_id).GetWordFrequencies(document_id);
+}
+
+const SearchServer& SegmentedSearchServer::View::FindSegment(int document_id) const {
+    for (const Segment& segment : snapshot_->segments) {
+        if (segment.index->HasDocument(document_id)
+            && !segment.index->IsMarked(segment.tombstones->ordinals, document_id)) {
+            return *segment.index;
+        }
+    }
+    return snapshot_->memtable->index;
+}
+
+SegmentedSearchServer::SegmentedSearchServer(const std::string& stop_words_text)
+    : SegmentedSearchServer(std::string_view(stop_words_text))
+{
+}
+
+SegmentedSearchServer::SegmentedSearchServer(const std::string_view stop_words_text)
+    : SegmentedSearchServer(SplitIntoWords(stop_words_text))
+{
+}
+
+SegmentedSearchServer::~SegmentedSearchServer() {
+    {
+        std::lock_guard guard(merge_request_mutex_);
+        is_stopping_ = true;
+    }
+    merge_request_changed_.notify_all();
+    merge_thread_.join();
+}
+
+void SegmentedSearchServer::AddDocument(int document_id, std::string_view document, DocumentStatus status,
+    const std::vector<int>& ratings) {
+    std::lock_guard guard(write_mutex_);
+    if (document_segments_.count(document_id) > 0) {
+        throw std::invalid_argument("Invalid document_id");
+    }
+    UpdateMemtable([document_id, text = std::string(document), status, ratings](SearchServer& memtable) {
+        memtable.AddDocument(document_id, text, status, ratings);
+    });
+    document_segments_.emplace(document_id, nullptr);
+    memtable_document_ids_.insert(document_id);
+    document_ids_.insert(document_id);
+    SealMemtableIfFull();
+}
+
+std::vector<RejectedDocument> SegmentedSearchServer::AddDocuments(const std::vector<DocumentToAdd>& batch) {
+    std::lock_guard guard(write_mutex_);
+    // Ids of sealed documents are unknown to the memtable and are rejected here
+    std::vector<RejectedDocument> rejected;
+    auto texts = std::make_shared<std::deque<std::string>>();
+    auto memtable_batch = std::make_shared<std::vector<DocumentToAdd>>();
+    std::vector<size_t> memtable_positions;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (document_segments_.count(batch[i].document_id) > 0) {
+            rejected.push_back({ i, batch[i].document_id, "Invalid document_id" });
+            continue;
+        }
+        // The update is replayed on the spare memtable later, so it owns the texts
+        memtable_batch->push_back(batch[i]);
+        memtable_batch->back().document = texts->emplace_back(batch[i].document);
+        memtable_positions.push_back(i);
+    }
+
+    auto memtable_rejected = std::make_shared<std::vector<RejectedDocument>>();
+    UpdateMemtable([texts, memtable_batch, memtable_rejected](SearchServer& memtable) {
+        *memtable_rejected = memtable.AddDocuments(*memtable_batch);
+    });
+    auto next_rejected = memtable_rejected->begin();
+    for (size_t i = 0; i < memtable_batch->size(); ++i) {
+        if (next_rejected != memtable_rejected->end() && next_rejected->position == i) {
+            next_rejected->position = memtable_positions[i];
+            rejected.push_back(std::move(*next_rejected++));
+            continue;
+        }
+        const int document_id = (*memtable_batch)[i].document_id;
+        document_segments_.emplace(document_id, nullptr);
+        memtable_document_ids_.insert(document_id);
+        document_ids_.insert(document_id);
+    }
+    std::sort(rejected.begin(), rejected.end(), [](const RejectedDocument& lhs, const RejectedDocument& rhs) {
+        return lhs.position < rhs.position;
+        });
+    SealMemtableIfFull();
+    return rejected;
+}
+
+std::vector<Document> SegmentedSearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+    ResultPage page) const {
+    return GetView().FindTopDocuments(raw_query, status, page);
+}
+
+std::vector<Document> SegmentedSearchServer::FindTopDocuments(std::string_view raw_query, ResultPage page) const {
+    return GetView().FindTopDocuments(raw_query, page);
+}
+
+SegmentedSearchServer::View SegmentedSearchServer::GetView() const {
+    return View(GetSnapshot());
+}
+
+int SegmentedSearchServer::GetDocumentCount() const {
+    return GetView().GetDocumentCount();
+}
+
+size_t SegmentedSearchServer::GetSegmentCount() const {
+    return GetSnapshot()->segments.size();
+}
+
+std::set<int>::const_iterator SegmentedSearchServer::begin() const {
+    return document_ids_.begin();
+}
+
+std::set<int>::const_iterator SegmentedSearchServer::end() const {
+    return document_ids_.end();
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SegmentedSearchServer::MatchDocument(
+    std::string_view raw_query, int document_id) const {
+    return GetView().MatchDocument(raw_query, document_id);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SegmentedSearchServer::MatchDocument(
+    const std::execution::sequenced_policy&, std::string_view raw_query, int document_id) const {
+    return GetView().MatchDocument(std::execution::seq, raw_query, document_id);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SegmentedSearchServer::MatchDocument(
+    const std::execution::parallel_policy&, std::string_view raw_query, int document_id) const {
+    return GetView().MatchDocument(std::execution::par, raw_query, document_id);
+}
+
+const std::map<std::string_view, double>& SegmentedSearchServer::GetWordFrequencies(int document_id) const {
+    return GetView().GetWordFrequencies(document_id);
+}
+
+void SegmentedSearchServer::RemoveDocument(int document_id) {
+    RemoveDocument(std::execution::seq, document_id);
+}
+
+void SegmentedSearchServer::RemoveDocument(const std::execution::sequenced_policy&, int document_id) {
+    std::lock_guard guard(write_mutex_);
+    RemoveDocumentLocked(document_id, false);
+}
+
+void SegmentedSearchServer::RemoveDocument(const std::execution::parallel_policy&, int document_id) {
+    std::lock_guard guard(write_mutex_);
+    RemoveDocumentLocked(document_id, true);
+}
+
+void SegmentedSearchServer::CompressPostings() {
+    compress_postings_ = true;
+    MergeSegments();
+}
+
+void SegmentedSearchServer::SetQueryEvaluation(QueryEvaluation evaluation) {
+    std::lock_guard guard(write_mutex_);
+    query_evaluation_ = evaluation;
+    const std::shared_ptr<const Snapshot> snapshot = GetSnapshot();
+    for (const Segment& segment : snapshot->segments) {
+        segment.index->SetQueryEvaluation(evaluation);
+    }
+    snapshot->memtable->index.SetQueryEvaluation(evaluation);
+    if (spare_memtable_) {
+        spare_memtable_->index.SetQueryEvaluation(evaluation);
+    }
+}
+
+void SegmentedSearchServer::Flush() {
+    std::lock_guard guard(write_mutex_);
+    SealMemtable();
+}
+
+void SegmentedSearchServer::MergeSegments() {
+    std::lock_guard merge_guard(merge_mutex_);
+    // Only the segments are kept, a held snapshot would pin its memtable version
+    const std::vector<Segment> inputs = GetSnapshot()->segments;
+    const bool has_deleted = std::any_of(inputs.begin(), inputs.end(), [](const Segment& segment) {
+        return segment.tombstones->document_count > 0;
+        });
+    if (inputs.empty() || (inputs.size() == 1 && !has_deleted && !compress_postings_)) {
+        return;
+    }
+    MergeSegmentRange(inputs, 0, inputs.size());
+}
+
+void SegmentedSearchServer::WaitForMerges() {
+    std::unique_lock lock(merge_request_mutex_);
+    merge_request_changed_.wait(lock, [this] {
+        return !is_merge_requested_ && !is_merge_running_;
+        });
+}
+
+void SegmentedSearchServer::Initialize() {
+    Publish(std::make_shared<Snapshot>(std::vector<Segment>(), MakeMemtable()));
+    merge_thread_ = std::thread(&SegmentedSearchServer::RunMergeThread, this);
+}
+
+std::shared_ptr<const SegmentedSearchServer::Snapshot> SegmentedSearchServer::GetSnapshot() const {
+    return std::atomic_load(&snapshot_);
+}
+
+void SegmentedSearchServer::Publish(std::shared_ptr<const Snapshot> snapshot) {
+    std::atomic_store(&snapshot_, std::move(snapshot));
+}
+
+std::shared_ptr<SegmentedSearchServer::Memtable> SegmentedSearchServer::MakeMemtable() const {
+    auto memtable = std::make_shared<Memtable>(stop_words_);
+    memtable->index.SetQueryEvaluation(query_evaluation_);
+    return memtable;
+}
+
+void SegmentedSearchServer::RequestMerge() {
+    {
+        std::lock_guard guard(merge_request_mutex_);
+        is_merge_requested_ = true;
+    }
+    merge_request_changed_.notify_all();
+}
+
+void SegmentedSearchServer::RunMergeThread() {
+    std::unique_lock lock(merge_request_mutex_);
+    while (true) {
+        merge_request_changed_.wait(lock, [this] {
+            return is_merge_requested_ || is_stopping_;
+            });
+        if (is_stopping_) {
+            return;
+        }
+        is_merge_requested_ = false;
+        is_merge_running_ = true;
+        lock.unlock();
+        const bool merged = MergeByPolicy();
+        lock.lock();
+        is_merge_running_ = false;
+        // A merged segment may complete a group in the tier above
+        is_merge_requested_ = is_merge_requested_ || merged;
+        merge_request_changed_.notify_all();
+    }
+}
+
+namespace {
+int GetSizeTier(int document_count) {
+    int tier = 0;
+    for (; document_count >= static_cast<int>(SEGMENT_MERGE_FACTOR); document_count /= SEGMENT_MERGE_FACTOR) {
+        ++tier;
+    }
+    return tier;
+}
+}
+
+bool SegmentedSearchServer::MergeByPolicy() {
+    std::lock_guard merge_guard(merge_mutex_);
+    const std::vector<Segment> segments = GetSnapshot()->segments;
+    std::vector<int> tiers;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        const int document_count = segments[i].index->GetDocumentCount();
+        const int deleted_count = segments[i].tombstones->document_count;
+        if (deleted_count > MAX_DELETED_DOCUMENT_SHARE * document_count) {
+            MergeSegmentRange(segments, i, 1);
+            return true;
+        }
+        tiers.push_back(GetSizeTier(document_count - deleted_count));
+    }
+    // A whole run of adjacent segments of one tier is merged, so that no short run
+    // is left stranded between larger segments
+    for (size_t last = segments.size(); last > 0;) {
+        size_t first = last - 1;
+        while (first > 0 && tiers[first - 1] == tiers[last - 1]) {
+            --first;
+        }
+        if (last - first >= SEGMENT_MERGE_FACTOR) {
+            MergeSegmentRange(segments, first, last - first);
+            return true;
+        }
+        last = first;
+    }
+    return false;
+}
+
+void SegmentedSearchServer::MergeSegmentRange(const std::vector<Segment>& segments, size_t first, size_t count) {
+    const std::vector<Segment> inputs(segments.begin() + first, segments.begin() + first + count);
+    // Sealed segments never change, so the merge needs no write lock
+    auto merged = std::make_shared<SearchServer>(stop_words_);
+    for (const Segment& segment : inputs) {
+        merged->AddDocumentsFrom(*segment.index, segment.tombstones->ordinals);
+    }
+    if (compress_postings_) {
+        merged->CompressPostings();
+    }
+
+    std::lock_guard guard(write_mutex_);
+    merged->SetQueryEvaluation(query_evaluation_);
+    // Seals only append segments and merges are serialized, so the inputs are still
+    // at the same place. Documents removed from them during the merge become
+    // tombstones of the merged segment
+    const std::shared_ptr<const Snapshot> current = GetSnapshot();
+    auto tombstones = std::make_shared<Tombstones>();
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        const SearchServer& input = *inputs[i].index;
+        const Tombstones& current_tombstones = *current->segments[first + i].tombstones;
+        if (&current_tombstones == inputs[i].tombstones.get()) {
+            continue;
+        }
+        for (const int document_id : input) {
+            if (input.IsMarked(current_tombstones.ordinals, document_id)
+                && !input.IsMarked(inputs[i].tombstones->ordinals, document_id)) {
+                tombstones->Add(*merged, document_id);
+            }
+        }
+    }
+    std::vector<Segment> merged_segments(current->segments.begin(), current->segments.begin() + first);
+    // A segment whose documents are all deleted is dropped
+    if (merged->GetDocumentCount() > tombstones->document_count) {
+        merged_segments.push_back({ merged, std::move(tombstones) });
+    }
+    merged_segments.insert(merged_segments.end(), current->segments.begin() + first + count,
+        current->segments.end());
+    auto snapshot = std::make_shared<Snapshot>(std::move(merged_segments), current->memtable);
+
+    std::set<const SearchServer*> input_indexes;
+    for (const Segment& segment : inputs) {
+        input_indexes.insert(segment.index.get());
+    }
+    for (auto& [document_id, segment] : document_segments_) {
+        if (input_indexes.count(segment) > 0) {
+            segment = merged.get();
+        }
+    }
+    Publish(std::move(snapshot));
+}
+
+void SegmentedSearchServer::UpdateMemtable(const std::function<void(SearchServer&)>& update) {
+    const std::shared_ptr<const Snapshot> current = GetSnapshot();
+    std::shared_ptr<Memtable> memtable;
+    if (spare_memtable_) {
+        // Readers of older snapshots release the spare soon, and no new snapshot
+        // can count it; the acquire makes their reads happen before the update
+        std::atomic<int>& snapshot_count = spare_memtable_->snapshot_count;
+        for (int i = 0; i < MAX_SPARE_MEMTABLE_WAIT_YIELDS && snapshot_count.load(std::memory_order_acquire) > 0;
+            ++i) {
+            std::this_thread::yield();
+        }
+        if (snapshot_count.load(std::memory_order_acquire) == 0) {
+            memtable = std::move(spare_memtable_);
+            if (spare_memtable_backlog_) {
+                spare_memtable_backlog_(memtable->index);
+            }
+        }
+    }
+    if (!memtable) {
+        // A pinned spare is left to its readers and freed with their snapshots;
+        // the copy is bounded by MAX_MEMTABLE_DOCUMENT_COUNT documents
+        memtable = MakeMemtable();
+        memtable->index.AddDocumentsFrom(current->memtable->index, {});
+    }
+    spare_memtable_.reset();
+    spare_memtable_backlog_ = nullptr;
+    try {
+        update(memtable->index);
+    }
+    catch (...) {
+        // The version is still equal to the published one and stays the spare
+        spare_memtable_ = std::move(memtable);
+        throw;
+    }
+
+    Publish(std::make_shared<Snapshot>(current->segments, std::move(memtable)));
+    spare_memtable_ = current->memtable;
+    spare_memtable_backlog_ = update;
+}
+
+void SegmentedSearchServer::SealMemtableIfFull() {
+    if (GetSnapshot()->memtable->index.GetDocumentCount() >= MAX_MEMTABLE_DOCUMENT_COUNT) {
+        SealMemtable();
+    }
+}
+
+void SegmentedSearchServer::SealMemtable() {
+    const std::shared_ptr<const Snapshot> current = GetSnapshot();
+    std::shared_ptr<Memtable> sealed_memtable = current->memtable;
+    if (sealed_memtable->index.GetDocumentCount() == 0) {
+        return;
+    }
+    if (compress_postings_) {
+        // Readers may be scanning the memtable, so a compressed copy is sealed instead
+        sealed_memtable = MakeMemtable();
+        sealed_memtable->index.AddDocumentsFrom(current->memtable->index, {});
+        sealed_memtable->index.CompressPostings();
+    }
+    const std::shared_ptr<SearchServer> sealed(sealed_memtable, &sealed_memtable->index);
+    std::vector<Segment> segments = current->segments;
+    segments.push_back({ sealed, std::make_shared<const Tombstones>() });
+    Publish(std::make_shared<Snapshot>(std::move(segments), MakeMemtable()));
+    spare_memtable_.reset();
+    spare_memtable_backlog_ = nullptr;
+
+    for (const int document_id : memtable_document_ids_) {
+        document_segments_[document_id] = sealed.get();
+    }
+    memtable_document_ids_.clear();
+    RequestMerge();
+}
+
+void SegmentedSearchServer::RemoveDocumentLocked(int document_id, bool parallel) {
+    const auto document_segment = document_segments_.find(document_id);
+    if (document_segment == document_segments_.end()) {
+        return;
+    }
+    if (document_segment->second == nullptr) {
+        UpdateMemtable([document_id, parallel](SearchServer& memtable) {
+            if (parallel) {
+                memtable.RemoveDocument(std::execution::par, document_id);
+            }
+            else {
+                memtable.RemoveDocument(std::execution::seq, document_id);
+            }
+        });
+        memtable_document_ids_.erase(document_id);
+    }
+    else {
+        // Sealed segments are immutable: the new snapshot gets a tombstone instead
+        const std::shared_ptr<const Snapshot> current = GetSnapshot();
+        auto snapshot = std::make_shared<Snapshot>(current->segments, current->memtable);
+        for (Segment& segment : snapshot->segments) {
+            if (segment.index.get() == document_segment->second) {
+                auto tombstones = std::make_shared<Tombstones>(*segment.tombstones);
+                tombstones->Add(*segment.index, document_id);
+                if (tombstones->document_count > MAX_DELETED_DOCUMENT_SHARE * segment.index->GetDocumentCount()) {
+                    RequestMerge();
+                }
+                segment.tombstones = std::move(tombstones);
+            }
+        }
+        Publish(std::move(snapshot));
+    }
+    document_segments_.erase(document_segment);
+    document_ids_.erase(document_id);
+}
@@ -0,0 +1,345 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <execution>
+
+#include "document.h"
+#include "ordinal_bitmap.h"
+#include "search_server.h"
+
+// Documents are sealed into an immutable segment once the memtable holds this many
+constexpr int MAX_MEMTABLE_DOCUMENT_COUNT = 4096;
+// How long a writer waits for readers to leave the spare memtable before copying it
+constexpr int MAX_SPARE_MEMTABLE_WAIT_YIELDS = 64;
+// Deleted document frequencies of recent deletes are kept apart until they hold more
+// words than this and the square root of the others
+constexpr size_t MIN_RECENT_TOMBSTONE_WORDS = 64;
+// Sealed segments fall into size tiers, each this many times larger than the one
+// below; a run of at least this many adjacent segments of one tier is merged into one
+constexpr size_t SEGMENT_MERGE_FACTOR = 10;
+// A sealed segment is rewritten on its own once a larger share of it is deleted
+constexpr double MAX_DELETED_DOCUMENT_SHARE = 0.5;
+
+// SearchServer made of immutable sealed segments and one small memtable that
+// takes new documents. Readers never lock: they load the current snapshot (the
+// sealed segments with their tombstones plus a memtable version) and work on it
+// while writers publish new snapshots. The memtable has two versions, the one
+// readers see and a spare the writer updates and publishes next; a spare still
+// pinned by readers is replaced with a fresh copy instead of being waited for.
+// So while views outlive writes, every write copies the memtable, which holds at
+// most MAX_MEMTABLE_DOCUMENT_COUNT documents; short-lived views cost nothing.
+// Old versions are freed when the last snapshot using them is released.
+// A merge thread keeps the segment count logarithmic in the document count: it
+// merges runs of SEGMENT_MERGE_FACTOR or more adjacent segments of one size tier
+// and rewrites mostly deleted segments, while writers only seal and request it.
+// MergeSegments folds all sealed segments into one and drops deleted documents;
+// it may run on any thread.
+class SegmentedSearchServer {
+private:
+    struct Snapshot;
+
+public:
+    // Read-only view of one snapshot. Document ids, views and references returned
+    // through it stay valid while the view lives, whatever writers do meanwhile
+    class View {
+    public:
+        std::vector<Document> FindTopDocuments(std::string_view raw_query, ResultPage page = {}) const;
+        std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+            ResultPage page = {}) const;
+        template <typename DocumentPredicate>
+        std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate,
+            ResultPage page = {}) const;
+
+        // The parallel policy queries the segments concurrently
+        template <typename ExecutionPolicy>
+        std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+            ResultPage page = {}) const;
+        template <typename ExecutionPolicy>
+        std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+            DocumentStatus status, ResultPage page = {}) const;
+        template <typename ExecutionPolicy, typename DocumentPredicate>
+        std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+            DocumentPredicate document_predicate, ResultPage page = {}) const;
+
+        int GetDocumentCount() const;
+        // Ascending
+        std::vector<int> GetDocumentIds() const;
+
+        std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::string_view raw_query,
+            int document_id) const;
+        std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(
+            const std::execution::sequenced_policy&,
+            std::string_view raw_query,
+            int document_id) const;
+        std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(
+            const std::execution::parallel_policy&,
+            std::string_view raw_query,
+            int document_id) const;
+
+        const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
+
+    private:
+        friend class SegmentedSearchServer;
+        std::shared_ptr<const Snapshot> snapshot_;
+
+        explicit View(std::shared_ptr<const Snapshot> snapshot);
+        // Memtable when the document is absent, so that it fails as in SearchServer
+        const SearchServer& FindSegment(int document_id) const;
+    };
+
+    template <typename StringContainer>
+    explicit SegmentedSearchServer(const StringContainer& stop_words);
+    explicit SegmentedSearchServer(const std::string& stop_words_text);
+    explicit SegmentedSearchServer(const std::string_view stop_words_text);
+    // Waits for a running merge, the requested ones are dropped
+    ~SegmentedSearchServer();
+
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status,
+        const std::vector<int>& ratings);
+    std::vector<RejectedDocument> AddDocuments(const std::vector<DocumentToAdd>& batch);
+
+    // Queries and matches below run on the snapshot current at the call
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, ResultPage page = {}) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+        ResultPage page = {}) const;
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate,
+        ResultPage page = {}) const;
+
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+        ResultPage page = {}) const;
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+        DocumentStatus status, ResultPage page = {}) const;
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+        DocumentPredicate document_predicate, ResultPage page = {}) const;
+
+    View GetView() const;
+    int GetDocumentCount() const;
+    size_t GetSegmentCount() const;
+    // Not safe against concurrent writers; View::GetDocumentIds is
+    std::set<int>::const_iterator begin() const;
+    std::set<int>::const_iterator end() const;
+
+    // Views in the result may dangle after later writes, View keeps them alive
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::string_view raw_query,
+        int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(
+        const std::execution::sequenced_policy&,
+        std::string_view raw_query,
+        int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(
+        const std::execution::parallel_policy&,
+        std::string_view raw_query,
+        int document_id) const;
+
+    // The reference may dangle after later writes, View keeps it alive
+    const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
+
+    void RemoveDocument(int document_id);
+    void RemoveDocument(const std::execution::sequenced_policy&, int document_id);
+    void RemoveDocument(const std::execution::parallel_policy&, int document_id);
+
+    // Sealed segments are compressed from now on; the existing ones are merged
+    // into a compressed segment right away
+    void CompressPostings();
+    void SetQueryEvaluation(QueryEvaluation evaluation);
+
+    // Seals the memtable even if it is not full
+    void Flush();
+    // Replaces all sealed segments with one that has no deleted documents.
+    // Queries and writes proceed while the new segment is built
+    void MergeSegments();
+    // Blocks until the merge thread has done every merge its policy picks
+    void WaitForMerges();
+
+private:
+    // Servers in a published snapshot are never modified again, except for the
+    // atomic query evaluation mode
+    // Documents deleted from a segment after it was sealed. Their share of the
+    // document frequencies and their ordinals are recorded once when they are
+    // deleted, so queries neither visit them nor call a predicate to skip them.
+    // Every delete makes a new version, which shares most of the previous one:
+    // the bitmap copies only the chunk it changes and only the small map of
+    // recent frequencies is copied, the rest is rebuilt when it is folded in
+    struct Tombstones {
+        int document_count = 0;
+        ChunkedOrdinalBitmap ordinals;
+        // Keyed by views into the words of the segment; never changed once shared
+        std::shared_ptr<std::map<std::string_view, int>> document_freqs;
+        std::shared_ptr<std::map<std::string_view, int>> recent_document_freqs;
+
+        void Add(const SearchServer& index, int document_id);
+        int GetDocumentFreq(std::string_view word) const;
+    };
+    struct Segment {
+        std::shared_ptr<SearchServer> index;
+        std::shared_ptr<const Tombstones> tombstones;
+    };
+    // Memtable version with the number of snapshots using it. A snapshot releases
+    // its count once its last reader drops it and the writer acquires the count,
+    // so a version no snapshot counts is the writer's alone: only the writer makes
+    // snapshots, and never with the spare
+    struct Memtable {
+        explicit Memtable(const std::vector<std::string>& stop_words);
+
+        SearchServer index;
+        std::atomic<int> snapshot_count = 0;
+    };
+    struct Snapshot {
+        Snapshot(std::vector<Segment> segments, std::shared_ptr<Memtable> memtable);
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+        ~Snapshot();
+
+        std::vector<Segment> segments;
+        const std::shared_ptr<Memtable> memtable;
+    };
+
+    const std::vector<std::string> stop_words_;
+    // Read and replaced with std::atomic_load and std::atomic_store
+    std::shared_ptr<const Snapshot> snapshot_;
+    // Writers are serialized, merges too; the state below belongs to writers
+    std::mutex write_mutex_;
+    std::mutex merge_mutex_;
+    // Sealed segment of every document, null for the memtable
+    std::map<int, const SearchServer*> document_segments_;
+    std::set<int> memtable_document_ids_;
+    std::set<int> document_ids_;
+    // Previous memtable version and the update it lacks
+    std::shared_ptr<Memtable> spare_memtable_;
+    std::function<void(SearchServer&)> spare_memtable_backlog_;
+    std::atomic<QueryEvaluation> query_evaluation_ = QueryEvaluation::EXHAUSTIVE;
+    std::atomic<bool> compress_postings_ = false;
+    // Merges picked by the merge policy run on merge_thread_, off the writer path
+    std::mutex merge_request_mutex_;
+    std::condition_variable merge_request_changed_;
+    bool is_merge_requested_ = false;
+    bool is_merge_running_ = false;
+    bool is_stopping_ = false;
+    std::thread merge_thread_;
+
+    void Initialize();
+    std::shared_ptr<const Snapshot> GetSnapshot() const;
+    void Publish(std::shared_ptr<const Snapshot> snapshot);
+    std::shared_ptr<Memtable> MakeMemtable() const;
+
+    void RequestMerge();
+    void RunMergeThread();
+    // Does one merge the policy picks, false when there is none
+    bool MergeByPolicy();
+    // Merge lock must be held; segments are the sealed segments of a recent snapshot
+    void MergeSegmentRange(const std::vector<Segment>& segments, size_t first, size_t count);
+
+    // Write lock must be held by the functions below
+    // Applies update to a memtable version no reader uses and publishes it
+    void UpdateMemtable(const std::function<void(SearchServer&)>& update);
+    void SealMemtableIfFull();
+    void SealMemtable();
+    void RemoveDocumentLocked(int document_id, bool parallel);
+};
+
+template <typename StringContainer>
+SegmentedSearchServer::SegmentedSearchServer(const StringContainer& stop_words)
+    : stop_words_(stop_words.begin(), stop_words.end())
+{
+    Initialize();
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SegmentedSearchServer::View::FindTopDocuments(std::string_view raw_query,
+    DocumentPredicate document_predicate, ResultPage page) const {
+    return FindTopDocuments(std::execution::seq, raw_query, document_predicate, page);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SegmentedSearchServer::View::FindTopDocuments(ExecutionPolicy&& policy,
+    std::string_view raw_query, ResultPage page) const {
+    return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL, page);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SegmentedSearchServer::View::FindTopDocuments(ExecutionPolicy&& policy,
+    std::string_view raw_query, DocumentStatus status, ResultPage page) const {
+    return FindTopDocuments(policy, raw_query, DocumentStatusFilter{ status }, page);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SegmentedSearchServer::View::FindTopDocuments(ExecutionPolicy&& policy,
+    std::string_view raw_query, DocumentPredicate document_predicate, ResultPage page) const {
+    // The query is parsed once; each segment looks its words up in its own dictionary.
+    // Deleted documents still sit in the postings of sealed segments, so their
+    // share is taken out of the corpus statistics
+    const SearchServer& memtable = snapshot_->memtable->index;
+    const PreparedQuery query = memtable.Prepare(raw_query);
+    CorpusStatistics corpus = memtable.GetCorpusStatistics(query);
+    for (const Segment& segment : snapshot_->segments) {
+        corpus.Merge(segment.index->GetCorpusStatistics(query));
+        const Tombstones& tombstones = *segment.tombstones;
+        corpus.document_count -= tombstones.document_count;
+        for (auto& [word, document_freq] : corpus.document_freqs) {
+            document_freq -= tombstones.GetDocumentFreq(word);
+        }
+    }
+
+    const ResultPage segment_page{ 0, page.offset + page.count };
+    std::vector<const Segment*> segments;
+    for (const Segment& segment : snapshot_->segments) {
+        segments.push_back(&segment);
+    }
+    std::vector<std::vector<Document>> segment_documents(segments.size() + 1);
+    std::transform(policy, segments.begin(), segments.end(), segment_documents.begin(),
+        [&](const Segment* segment) {
+            if (segment->tombstones->document_count == 0) {
+                return segment->index->FindTopDocuments(std::execution::seq, query, document_predicate,
+                    segment_page, corpus);
+            }
+            return segment->index->FindTopDocuments(std::execution::seq, query,
+                ExcludingFilter<DocumentPredicate>{ &segment->tombstones->ordinals, document_predicate },
+                segment_page, corpus);
+        });
+    segment_documents.back() = memtable.FindTopDocuments(std::execution::seq, query, document_predicate,
+        segment_page, corpus);
+
+    std::vector<Document> matched_documents;
+    for (const auto& documents : segment_documents) {
+        matched_documents.insert(matched_documents.end(), documents.begin(), documents.end());
+    }
+    SearchServer::SelectPage(matched_documents, page);
+    return matched_documents;
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> SegmentedSearchServer::FindTopDocuments(std::string_view raw_query,
+    DocumentPredicate document_predicate, ResultPage page) const {
+    return GetView().FindTopDocuments(raw_query, document_predicate, page);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SegmentedSearchServer::FindTopDocuments(ExecutionPolicy&& policy,
+    std::string_view raw_query, ResultPage page) const {
+    return GetView().FindTopDocuments(policy, raw_query, page);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> SegmentedSearchServer::FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+    DocumentStatus status, ResultPage page) const {
+    return GetView().FindTopDocuments(policy, raw_query, status, page);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> SegmentedSearchServer::FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+    DocumentPredicate document_predicate, ResultPage page) const {
+    return GetView().FindTopDocuments(policy, raw_query, document_predicate, page);
+}
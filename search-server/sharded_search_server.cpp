@@ -0,0 +1,169 @@
+#include <cstdint>
+#include <numeric>
+#include "sharded_search_server.h"
+
+ShardedSearchServer::ShardedSearchServer(size_t shard_count, const std::string& stop_words_text)
+    : ShardedSearchServer(shard_count, std::string_view(stop_words_text))
+{
+}
+
+ShardedSearchServer::ShardedSearchServer(size_t shard_count, const std::string_view stop_words_text)
+    : shard_mutexes_(shard_count)
+{
+    CheckShardCount();
+    for (size_t i = 0; i < shard_count; ++i) {
+        shards_.push_back(std::make_unique<SearchServer>(stop_words_text));
+    }
+}
+
+void ShardedSearchServer::AddDocument(int document_id, std::string_view document, DocumentStatus status,
+    const std::vector<int>& ratings) {
+    const size_t shard = GetShardIndex(document_id);
+    {
+        std::unique_lock lock(shard_mutexes_[shard]);
+        shards_[shard]->AddDocument(document_id, document, status, ratings);
+    }
+    std::lock_guard guard(document_ids_mutex_);
+    document_ids_.insert(document_id);
+}
+
+std::vector<RejectedDocument> ShardedSearchServer::AddDocuments(const std::vector<DocumentToAdd>& batch) {
+    std::vector<std::vector<DocumentToAdd>> shard_batches(shards_.size());
+    std::vector<std::vector<size_t>> shard_positions(shards_.size());
+    for (size_t i = 0; i < batch.size(); ++i) {
+        const size_t shard = GetShardIndex(batch[i].document_id);
+        shard_batches[shard].push_back(batch[i]);
+        shard_positions[shard].push_back(i);
+    }
+    std::vector<std::vector<RejectedDocument>> shard_rejected(shards_.size());
+    std::vector<size_t> shard_indexes(shards_.size());
+    std::iota(shard_indexes.begin(), shard_indexes.end(), 0);
+    std::for_each(std::execution::par, shard_indexes.begin(), shard_indexes.end(),
+        [this, &shard_batches, &shard_rejected](size_t shard) {
+            std::unique_lock lock(shard_mutexes_[shard]);
+            shard_rejected[shard] = shards_[shard]->AddDocuments(shard_batches[shard]);
+        });
+
+    std::vector<RejectedDocument> rejected;
+    for (size_t shard = 0; shard < shards_.size(); ++shard) {
+        for (RejectedDocument& document : shard_rejected[shard]) {
+            document.position = shard_positions[shard][document.position];
+            rejected.push_back(std::move(document));
+        }
+    }
+    std::sort(rejected.begin(), rejected.end(), [](const RejectedDocument& lhs, const RejectedDocument& rhs) {
+        return lhs.position < rhs.position;
+        });
+
+    std::lock_guard guard(document_ids_mutex_);
+    auto next_rejected = rejected.begin();
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (next_rejected != rejected.end() && next_rejected->position == i) {
+            ++next_rejected;
+            continue;
+        }
+        document_ids_.insert(batch[i].document_id);
+    }
+    return rejected;
+}
+
+std::vector<Document> ShardedSearchServer::FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+    ResultPage page) const {
+    return FindTopDocuments(std::execution::seq, raw_query, status, page);
+}
+
+std::vector<Document> ShardedSearchServer::FindTopDocuments(std::string_view raw_query, ResultPage page) const {
+    return FindTopDocuments(raw_query, DocumentStatus::ACTUAL, page);
+}
+
+int ShardedSearchServer::GetDocumentCount() const {
+    std::lock_guard guard(document_ids_mutex_);
+    return document_ids_.size();
+}
+
+size_t ShardedSearchServer::GetShardCount() const {
+    return shards_.size();
+}
+
+std::set<int>::const_iterator ShardedSearchServer::begin() const {
+    return document_ids_.begin();
+}
+
+std::set<int>::const_iterator ShardedSearchServer::end() const {
+    return document_ids_.end();
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> ShardedSearchServer::MatchDocument(
+    std::string_view raw_query, int document_id) const {
+    return MatchDocument(std::execution::seq, raw_query, document_id);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> ShardedSearchServer::MatchDocument(
+    const std::execution::sequenced_policy&, std::string_view raw_query, int document_id) const {
+    const size_t shard = GetShardIndex(document_id);
+    std::shared_lock lock(shard_mutexes_[shard]);
+    return shards_[shard]->MatchDocument(std::execution::seq, raw_query, document_id);
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> ShardedSearchServer::MatchDocument(
+    const std::execution::parallel_policy&, std::string_view raw_query, int document_id) const {
+    const size_t shard = GetShardIndex(document_id);
+    std::shared_lock lock(shard_mutexes_[shard]);
+    return shards_[shard]->MatchDocument(std::execution::par, raw_query, document_id);
+}
+
+const std::map<std::string_view, double>& ShardedSearchServer::GetWordFrequencies(int document_id) const {
+    const size_t shard = GetShardIndex(document_id);
+    std::shared_lock lock(shard_mutexes_[shard]);
+    return shards_[shard]->GetWordFrequencies(document_id);
+}
+
+void ShardedSearchServer::RemoveDocument(int document_id) {
+    RemoveDocument(std::execution::seq, document_id);
+}
+
+void ShardedSearchServer::RemoveDocument(const std::execution::sequenced_policy&, int document_id) {
+    const size_t shard = GetShardIndex(document_id);
+    {
+        std::unique_lock lock(shard_mutexes_[shard]);
+        shards_[shard]->RemoveDocument(std::execution::seq, document_id);
+    }
+    std::lock_guard guard(document_ids_mutex_);
+    document_ids_.erase(document_id);
+}
+
+void ShardedSearchServer::RemoveDocument(const std::execution::parallel_policy&, int document_id) {
+    const size_t shard = GetShardIndex(document_id);
+    {
+        std::unique_lock lock(shard_mutexes_[shard]);
+        shards_[shard]->RemoveDocument(std::execution::par, document_id);
+    }
+    std::lock_guard guard(document_ids_mutex_);
+    document_ids_.erase(document_id);
+}
+
+void ShardedSearchServer::CompressPostings() {
+    for (size_t shard = 0; shard < shards_.size(); ++shard) {
+        std::unique_lock lock(shard_mutexes_[shard]);
+        shards_[shard]->CompressPostings();
+    }
+}
+
+void ShardedSearchServer::SetQueryEvaluation(QueryEvaluation evaluation) {
+    for (size_t shard = 0; shard < shards_.size(); ++shard) {
+        std::unique_lock lock(shard_mutexes_[shard]);
+        shards_[shard]->SetQueryEvaluation(evaluation);
+    }
+}
+
+size_t ShardedSearchServer::GetShardIndex(int document_id) const {
+    // Fibonacci hashing spreads consecutive ids over all shards
+    const uint32_t hash = static_cast<uint32_t>(document_id) * 2654435769u;
+    return (static_cast<uint64_t>(hash) * shards_.size()) >> 32;
+}
+
+void ShardedSearchServer::CheckShardCount() const {
+    if (shard_mutexes_.empty()) {
+        throw std::invalid_argument("Shard count must be positive");
+    }
+}
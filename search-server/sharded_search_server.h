@@ -0,0 +1,148 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <algorithm>
+#include <execution>
+#include <stdexcept>
+
+#include "document.h"
+#include "search_server.h"
+
+// SearchServer split into independent shards, each document lives in the shard
+// chosen by a hash of its id. Writes lock only the owning shard. Queries are sent
+// to every shard with corpus-wide statistics, so relevance matches a single server
+// holding all documents, and the per-shard tops are merged into one page.
+class ShardedSearchServer {
+public:
+    template <typename StringContainer>
+    ShardedSearchServer(size_t shard_count, const StringContainer& stop_words);
+    ShardedSearchServer(size_t shard_count, const std::string& stop_words_text);
+    ShardedSearchServer(size_t shard_count, const std::string_view stop_words_text);
+
+    void AddDocument(int document_id, std::string_view document, DocumentStatus status,
+        const std::vector<int>& ratings);
+    // Splits the batch by shard and loads the shards in parallel
+    std::vector<RejectedDocument> AddDocuments(const std::vector<DocumentToAdd>& batch);
+
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, ResultPage page = {}) const;
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentStatus status,
+        ResultPage page = {}) const;
+    template <typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate,
+        ResultPage page = {}) const;
+
+    // The parallel policy queries the shards concurrently
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+        ResultPage page = {}) const;
+    template <typename ExecutionPolicy>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+        DocumentStatus status, ResultPage page = {}) const;
+    template <typename ExecutionPolicy, typename DocumentPredicate>
+    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+        DocumentPredicate document_predicate, ResultPage page = {}) const;
+
+    int GetDocumentCount() const;
+    size_t GetShardCount() const;
+    // Not safe against concurrent writers
+    std::set<int>::const_iterator begin() const;
+    std::set<int>::const_iterator end() const;
+
+    // Views in the result point into the shard and may dangle after later writes to it
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::string_view raw_query,
+        int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(
+        const std::execution::sequenced_policy&,
+        std::string_view raw_query,
+        int document_id) const;
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(
+        const std::execution::parallel_policy&,
+        std::string_view raw_query,
+        int document_id) const;
+
+    // The map belongs to the shard and is read without its lock once returned, so it
+    // is not safe against concurrent writers to the shard
+    const std::map<std::string_view, double>& GetWordFrequencies(int document_id) const;
+
+    void RemoveDocument(int document_id);
+    void RemoveDocument(const std::execution::sequenced_policy&, int document_id);
+    void RemoveDocument(const std::execution::parallel_policy&, int document_id);
+
+    void CompressPostings();
+    void SetQueryEvaluation(QueryEvaluation evaluation);
+
+private:
+    std::vector<std::unique_ptr<SearchServer>> shards_;
+    mutable std::vector<std::shared_mutex> shard_mutexes_;
+    std::set<int> document_ids_;
+    mutable std::mutex document_ids_mutex_;
+
+    size_t GetShardIndex(int document_id) const;
+    void CheckShardCount() const;
+};
+
+template <typename StringContainer>
+ShardedSearchServer::ShardedSearchServer(size_t shard_count, const StringContainer& stop_words)
+    : shard_mutexes_(shard_count)
+{
+    CheckShardCount();
+    for (size_t i = 0; i < shard_count; ++i) {
+        shards_.push_back(std::make_unique<SearchServer>(stop_words));
+    }
+}
+
+template <typename DocumentPredicate>
+std::vector<Document> ShardedSearchServer::FindTopDocuments(std::string_view raw_query,
+    DocumentPredicate document_predicate, ResultPage page) const {
+    return FindTopDocuments(std::execution::seq, raw_query, document_predicate, page);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> ShardedSearchServer::FindTopDocuments(ExecutionPolicy&& policy,
+    std::string_view raw_query, ResultPage page) const {
+    return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL, page);
+}
+
+template <typename ExecutionPolicy>
+std::vector<Document> ShardedSearchServer::FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+    DocumentStatus status, ResultPage page) const {
+    return FindTopDocuments(policy, raw_query, DocumentStatusFilter{ status }, page);
+}
+
+template <typename ExecutionPolicy, typename DocumentPredicate>
+std::vector<Document> ShardedSearchServer::FindTopDocuments(ExecutionPolicy&& policy, std::string_view raw_query,
+    DocumentPredicate document_predicate, ResultPage page) const {
+    // Shards are locked in index order, writers hold a single shard lock, so this cannot deadlock
+    std::vector<std::shared_lock<std::shared_mutex>> locks;
+    locks.reserve(shard_mutexes_.size());
+    for (std::shared_mutex& mutex : shard_mutexes_) {
+        locks.emplace_back(mutex);
+    }
+
+    // Shards share the stop words, so the query is parsed once and each shard only
+    // looks its words up
+    const PreparedQuery query = shards_.front()->Prepare(raw_query);
+    CorpusStatistics corpus;
+    for (const auto& shard : shards_) {
+        corpus.Merge(shard->GetCorpusStatistics(query));
+    }
+
+    // Any document of the page is within the top offset + count of its own shard
+    const ResultPage shard_page{ 0, page.offset + page.count };
+    std::vector<std::vector<Document>> shard_documents(shards_.size());
+    std::transform(policy, shards_.begin(), shards_.end(), shard_documents.begin(),
+        [&](const std::unique_ptr<SearchServer>& shard) {
+            return shard->FindTopDocuments(std::execution::seq, query, document_predicate, shard_page, corpus);
+        });
+
+    std::vector<Document> matched_documents;
+    for (const auto& documents : shard_documents) {
+        matched_documents.insert(matched_documents.end(), documents.begin(), documents.end());
+    }
+    SearchServer::SelectPage(matched_documents, page);
+    return matched_documents;
+}
@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include "stop_word_set.h"
+
+namespace {
+
+// Average number of words per bucket: more makes the table smaller but slower to build
+constexpr size_t WORDS_PER_BUCKET = 4;
+// Displacements tried for one bucket before the build restarts with another seed
+constexpr uint32_t MAX_DISPLACEMENT = 1u << 16;
+constexpr int MAX_BUILD_ATTEMPTS = 64;
+
+}  // namespace
+
+StopWordSet::StopWordSet(const std::set<std::string>& words) {
+    if (words.empty()) {
+        return;
+    }
+    std::vector<std::string_view> word_views(words.begin(), words.end());
+    for (uint64_t seed = 0; seed < MAX_BUILD_ATTEMPTS; ++seed) {
+        if (TryBuild(word_views, seed)) {
+            for (const std::string_view word : word_views) {
+                length_mask_ |= uint64_t{ 1 } << std::min<size_t>(word.size(), 63);
+            }
+            return;
+        }
+    }
+    throw std::runtime_error("Cannot build perfect hash of stop words");
+}
+
+bool StopWordSet::TryBuild(const std::vector<std::string_view>& words, uint64_t seed) {
+    const size_t bucket_count = (words.size() + WORDS_PER_BUCKET - 1) / WORDS_PER_BUCKET;
+    std::vector<std::vector<size_t>> buckets(bucket_count);
+    std::vector<uint64_t> hashes(words.size());
+    for (size_t i = 0; i < words.size(); ++i) {
+        hashes[i] = Hash(words[i], seed);
+        buckets[hashes[i] % bucket_count].push_back(i);
+    }
+    // Large buckets are placed first, while most slots are still free
+    std::vector<size_t> bucket_order(bucket_count);
+    std::iota(bucket_order.begin(), bucket_order.end(), 0);
+    std::stable_sort(bucket_order.begin(), bucket_order.end(), [&buckets](size_t lhs, size_t rhs) {
+        return buckets[lhs].size() > buckets[rhs].size();
+    });
+
+    std::vector<uint32_t> displacements(bucket_count, 0);
+    std::vector<bool> is_taken(words.size(), false);
+    std::vector<size_t> slot_words(words.size());
+    std::vector<size_t> bucket_slots;
+    for (const size_t bucket : bucket_order) {
+        if (buckets[bucket].empty()) {
+            continue;
+        }
+        bool is_placed = false;
+        for (uint32_t displacement = 0; displacement < MAX_DISPLACEMENT && !is_placed; ++displacement) {
+            bucket_slots.clear();
+            for (const size_t word : buckets[bucket]) {
+                const size_t slot = Displace(hashes[word], displacement) % words.size();
+                if (is_taken[slot] || std::count(bucket_slots.begin(), bucket_slots.end(), slot) > 0) {
+                    break;
+                }
+                bucket_slots.push_back(slot);
+            }
+            if (bucket_slots.size() == buckets[bucket].size()) {
+                for (size_t i = 0; i < bucket_slots.size(); ++i) {
+                    is_taken[bucket_slots[i]] = true;
+                    slot_words[bucket_slots[i]] = buckets[bucket][i];
+                }
+                displacements[bucket] = displacement;
+                is_placed = true;
+            }
+        }
+        if (!is_placed) {
+            return false;
+        }
+    }
+
+    seed_ = seed;
+    displacements_ = std::move(displacements);
+    slots_.resize(words.size());
+    characters_.clear();
+    for (size_t slot = 0; slot < words.size(); ++slot) {
+        const std::string_view word = words[slot_words[slot]];
+        slots_[slot] = { static_cast<uint32_t>(characters_.size()), static_cast<uint32_t>(word.size()) };
+        characters_ += word;
+    }
+    return true;
+}
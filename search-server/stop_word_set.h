@@ -0,0 +1,63 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Stop words compiled into a minimal perfect hash (hash and displace): every word
+// of the set owns exactly one slot, found by one hash of the looked-up word and
+// one displacement of its bucket. A lookup reads the word once, compares it with
+// a single candidate and never allocates
+class StopWordSet {
+public:
+    StopWordSet() = default;
+    explicit StopWordSet(const std::set<std::string>& words);
+
+    bool Contains(std::string_view word) const {
+        // Most words are rejected by their length alone
+        if ((length_mask_ >> std::min<size_t>(word.size(), 63) & 1) == 0) {
+            return false;
+        }
+        const uint64_t hash = Hash(word, seed_);
+        const uint32_t displacement = displacements_[hash % displacements_.size()];
+        const Slot& slot = slots_[Displace(hash, displacement) % slots_.size()];
+        return slot.size == word.size() && std::memcmp(characters_.data() + slot.offset, word.data(), word.size()) == 0;
+    }
+
+private:
+    struct Slot {
+        uint32_t offset = 0;
+        uint32_t size = 0;
+    };
+
+    // Bit i is set when some word has i characters, bit 63 covers the longer ones
+    uint64_t length_mask_ = 0;
+    uint64_t seed_ = 0;
+    std::vector<uint32_t> displacements_;
+    std::vector<Slot> slots_;
+    // Words stored back to back, slots refer to them by offset so copies stay valid
+    std::string characters_;
+
+    static uint64_t Hash(std::string_view word, uint64_t seed) {
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ull ^ seed;
+        for (const char c : word) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    static uint64_t Displace(uint64_t hash, uint32_t displacement) {
+        // Finalizer of MurmurHash3, spreads the displaced hash over every bit
+        hash ^= displacement * 0x9e3779b97f4a7c15ull;
+        hash = (hash ^ (hash >> 33)) * 0xff51afd7ed558ccdull;
+        hash = (hash ^ (hash >> 33)) * 0xc4ceb9fe1a85ec53ull;
+        return hash ^ (hash >> 33);
+    }
+
+    // Places every word or returns false when some bucket finds no displacement
+    bool TryBuild(const std::vector<std::string_view>& words, uint64_t seed);
+};
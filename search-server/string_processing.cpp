@@ -1,44 +1,196 @@
+#include <cstdint>
 #include <string>
 #include <string_view>
 #include <vector>
 #include "string_processing.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAS_AVX2_TOKENIZER
+#endif
 
-std::vector<std::string> SplitIntoWords(const std::string& text) {
-    std::vector<std::string> words;
-    std::string word;
-    for (const char c : text) {
-        if (c == ' ') {
-            if (!word.empty()) {
-                words.push_back(word);
-                word.clear();
+namespace {
+
+// Bytes are classified in blocks of this size, one mask bit per byte
+constexpr size_t TOKENIZER_BLOCK_SIZE = 64;
+
+struct BlockMasks {
+    uint64_t spaces = 0;
+    uint64_t controls = 0;
+};
+
+// Control characters are the bytes below ' '; bytes of multibyte UTF-8 sequences are valid
+BlockMasks ClassifyScalar(const char* data, size_t size) {
+    BlockMasks masks;
+    for (size_t i = 0; i < size; ++i) {
+        masks.spaces |= static_cast<uint64_t>(data[i] == ' ') << i;
+        masks.controls |= static_cast<uint64_t>(data[i] >= '\0' && data[i] < ' ') << i;
+    }
+    return masks;
+}
+
+#if defined(__SSE2__)
+
+BlockMasks ClassifySse2(const char* data) {
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i zero = _mm_setzero_si128();
+    BlockMasks masks;
+    for (size_t offset = 0; offset < TOKENIZER_BLOCK_SIZE; offset += 16) {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + offset));
+        const __m128i controls = _mm_andnot_si128(_mm_cmplt_epi8(bytes, zero), _mm_cmplt_epi8(bytes, space));
+        masks.spaces |= static_cast<uint64_t>(static_cast<uint32_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, space)))) << offset;
+        masks.controls |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(controls))) << offset;
+    }
+    return masks;
+}
+
+#endif
+
+#ifdef HAS_AVX2_TOKENIZER
+
+__attribute__((target("avx2")))
+BlockMasks ClassifyAvx2(const char* data) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i zero = _mm256_setzero_si256();
+    BlockMasks masks;
+    for (size_t offset = 0; offset < TOKENIZER_BLOCK_SIZE; offset += 32) {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + offset));
+        const __m256i controls = _mm256_andnot_si256(_mm256_cmpgt_epi8(zero, bytes),
+            _mm256_cmpgt_epi8(space, bytes));
+        masks.spaces |= static_cast<uint64_t>(static_cast<uint32_t>(
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, space)))) << offset;
+        masks.controls |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(controls))) << offset;
+    }
+    return masks;
+}
+
+#endif
+
+using ClassifyBlock = BlockMasks (*)(const char* data);
+
+#if !defined(__SSE2__)
+
+BlockMasks ClassifyBlockScalar(const char* data) {
+    return ClassifyScalar(data, TOKENIZER_BLOCK_SIZE);
+}
+
+#endif
+
+// Picked once by the features of the running CPU
+ClassifyBlock SelectClassifyBlock() {
+#ifdef HAS_AVX2_TOKENIZER
+    if (__builtin_cpu_supports("avx2")) {
+        return ClassifyAvx2;
+    }
+#endif
+#if defined(__SSE2__)
+    return ClassifySse2;
+#else
+    return ClassifyBlockScalar;
+#endif
+}
+
+int CountTrailingZeros(uint64_t value) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(value);
+#else
+    int count = 0;
+    while ((value & 1) == 0) {
+        value >>= 1;
+        ++count;
+    }
+    return count;
+#endif
+}
+
+// Turns the masks of consecutive blocks into words: a word starts or ends
+// wherever a byte differs from the previous one in being a space
+class WordCollector {
+public:
+    WordCollector(std::string_view text, std::vector<std::string_view>& words)
+        : text_(text)
+        , words_(words)
+    {
+    }
+
+    void Consume(const BlockMasks& masks, size_t block_begin, size_t block_size) {
+        if (masks.controls != 0 && first_control_ == std::string_view::npos) {
+            first_control_ = block_begin + CountTrailingZeros(masks.controls);
+        }
+        const uint64_t block_mask = block_size == 64 ? ~uint64_t{ 0 } : (uint64_t{ 1 } << block_size) - 1;
+        uint64_t transitions = (masks.spaces ^ ((masks.spaces << 1) | previous_is_space_)) & block_mask;
+        while (transitions != 0) {
+            const size_t position = block_begin + CountTrailingZeros(transitions);
+            if (word_begin_ == std::string_view::npos) {
+                word_begin_ = position;
+            }
+            else {
+                words_.push_back(text_.substr(word_begin_, position - word_begin_));
+                word_begin_ = std::string_view::npos;
             }
+            transitions &= transitions - 1;
+        }
+        previous_is_space_ = (masks.spaces >> (block_size - 1)) & 1;
+    }
+
+    size_t Finish() {
+        if (word_begin_ != std::string_view::npos) {
+            words_.push_back(text_.substr(word_begin_));
         }
-        else {
-            word += c;
+        if (first_control_ == std::string_view::npos) {
+            return words_.size();
         }
+        // Control characters are never delimiters, so the first one lies in a word
+        size_t word = 0;
+        while (text_.data() + first_control_ >= words_[word].data() + words_[word].size()) {
+            ++word;
+        }
+        return word;
     }
-    if (!word.empty()) {
-        words.push_back(word);
+
+private:
+    std::string_view text_;
+    std::vector<std::string_view>& words_;
+    size_t word_begin_ = std::string_view::npos;
+    size_t first_control_ = std::string_view::npos;
+    // Text is treated as preceded by a space
+    uint64_t previous_is_space_ = 1;
+};
+
+}  // namespace
+
+std::vector<std::string> SplitIntoWords(const std::string& text) {
+    std::vector<std::string> words;
+    for (std::string_view word : SplitIntoWords(std::string_view(text))) {
+        words.emplace_back(word);
     }
     return words;
 }
 
-std::vector<std::string_view> SplitIntoWords(std::string_view text)
-{
-    std::string_view delims = " ";
-    std::vector<std::string_view> output;
-    size_t first = 0;
-    while (first < text.size())
-    {
-        const auto second = text.find_first_of(delims, first);
-        if (first != second) output.emplace_back(text.substr(first, second - first));
-        if (second == std::string_view::npos) break;
-        first = second + 1;
-    }
-    return output;
+std::vector<std::string_view> SplitIntoWords(std::string_view text) {
+    std::vector<std::string_view> words;
+    SplitIntoValidatedWords(text, words);
+    return words;
 }
 
+size_t SplitIntoValidatedWords(std::string_view text, std::vector<std::string_view>& words) {
+    static const ClassifyBlock classify_block = SelectClassifyBlock();
+    words.clear();
+    WordCollector collector(text, words);
+    size_t block_begin = 0;
+    for (; block_begin + TOKENIZER_BLOCK_SIZE <= text.size(); block_begin += TOKENIZER_BLOCK_SIZE) {
+        collector.Consume(classify_block(text.data() + block_begin), block_begin, TOKENIZER_BLOCK_SIZE);
+    }
+    if (block_begin < text.size()) {
+        const size_t tail_size = text.size() - block_begin;
+        collector.Consume(ClassifyScalar(text.data() + block_begin, tail_size), block_begin, tail_size);
+    }
+    return collector.Finish();
+}
 
 std::set<std::string> MakeUniqueNonEmptyStrings(std::vector<std::string_view> strings) {
     std::set<std::string> non_empty_strings;
@@ -8,6 +8,11 @@ std::vector<std::string> SplitIntoWords(const std::string& text);
 
 std::vector<std::string_view> SplitIntoWords(const std::string_view text);
 
+// Splits text at spaces into words, replacing the contents of words but reusing its
+// capacity. Control characters are searched in the same pass: returns the index of
+// the first word that contains one, or words.size() when every word is valid
+size_t SplitIntoValidatedWords(std::string_view text, std::vector<std::string_view>& words);
+
 std::set<std::string> MakeUniqueNonEmptyStrings(std::vector<std::string_view> strings);
 
 template <typename StringContainer>
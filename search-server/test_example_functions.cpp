@@ -1,10 +1,27 @@
 #include <string>
 #include <vector>
 #include <iostream>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <filesystem>
+#include <thread>
+#include <atomic>
 
 #include "document.h"
 #include "log_duration.h"
 #include "search_server.h"
+#include "request_queue.h"
+#include "string_processing.h"
+#include "stop_word_set.h"
+#include "posting_codec.h"
+#include "copy_on_write.h"
+#include "sharded_search_server.h"
+#include "segmented_search_server.h"
+#include "durable_search_server.h"
+#include "query_result_cache.h"
+#include "query_statistics.h"
+#include "process_queries.h"
 #include "test_example_functions.h"
 
 using namespace std::string_literals;
@@ -24,6 +41,20 @@ void TestAssert(bool t, const std::string& t_str, const std::string& file_name,
     abort();
 }
 
+// Servers may order documents of equal relevance and rating differently, so ids
+// are compared only when the caller asks for it
+void AssertSameDocuments(const std::vector<Document>& found, const std::vector<Document>& expected,
+    const std::string& hint, bool compare_ids = false) {
+    ASSERT_EQUAL_HINT(found.size(), expected.size(), hint);
+    for (size_t i = 0; i < found.size(); ++i) {
+        ASSERT_HINT(std::abs(found[i].relevance - expected[i].relevance) < TOLERANCE, hint);
+        ASSERT_EQUAL_HINT(found[i].rating, expected[i].rating, hint);
+        if (compare_ids) {
+            ASSERT_EQUAL_HINT(found[i].id, expected[i].id, hint);
+        }
+    }
+}
+
 void TestExcludeStopWordsFromAddedDocumentContent() {
     const int doc_id = 42;
     const std::string content = "cat in the city"s;
@@ -51,6 +82,23 @@ void TestExcludeStopWordsFromAddedDocumentContent() {
     }
 }
 
+void TestMoveConstructedServer() {
+    static_assert(std::is_move_constructible_v<SearchServer>, "SearchServer must stay movable");
+    SearchServer server("and with"s);
+    server.AddDocument(1, "white cat and fashionable collar"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    server.AddDocument(2, "fluffy cat fluffy tail"s, DocumentStatus::ACTUAL, { 5, -12, 2, 1 });
+    server.AddDocument(3, "groomed dog expressive eyes"s, DocumentStatus::ACTUAL, { 1, 2, 3 });
+    server.SetQueryEvaluation(QueryEvaluation::PRUNED);
+    const auto before_move = server.FindTopDocuments("fluffy groomed cat"s);
+    std::vector<SearchServer> servers;
+    servers.push_back(std::move(server));
+    const auto after_move = servers[0].FindTopDocuments("fluffy groomed cat"s);
+    ASSERT_EQUAL(after_move.size(), before_move.size());
+    for (size_t i = 0; i < after_move.size(); ++i) {
+        ASSERT_EQUAL_HINT(after_move[i].id, before_move[i].id, "Moved server must answer the same"s);
+    }
+}
+
 void TestFindAddedDocument() {
     const int doc_id = 42;
     const std::string content = "cat in the city"s;
@@ -112,8 +160,8 @@ void TestMatchingDocument() {
     {
         SearchServer server("none"s);
         server.AddDocument(doc_id, content, DocumentStatus::ACTUAL, ratings);
-        std::tuple<std::vector<std::string>, DocumentStatus> matching_doc = server.MatchDocument("cat in the night the"s, doc_id);
-        std::vector<std::string> first_of_tuple = std::get<0>(matching_doc);
+        std::tuple<std::vector<std::string_view>, DocumentStatus> matching_doc = server.MatchDocument("cat in the night the"s, doc_id);
+        std::vector<std::string_view> first_of_tuple = std::get<0>(matching_doc);
         ASSERT_EQUAL_HINT(count(first_of_tuple.begin(), first_of_tuple.end(), "cat"s), 1, "Didn't find all searched words from document"s);
         ASSERT_EQUAL_HINT(count(first_of_tuple.begin(), first_of_tuple.end(), "in"s), 1, "Didn't find all searched words from document"s);
         ASSERT_EQUAL_HINT(count(first_of_tuple.begin(), first_of_tuple.end(), "the"s), 1, "Didn't find all searched words from document"s);
@@ -220,10 +268,1143 @@ void TestCorrectCalculationRelevanceOfDocuments() {
     }
 }
 
+void TestPrunedEvaluationMatchesExhaustive() {
+    const std::vector<int> ratings = { 1, 2, 3 };
+    SearchServer server("and with"s);
+    server.AddDocument(1, "white cat and fashionable collar"s, DocumentStatus::ACTUAL, { 7, 2, 7 });
+    server.AddDocument(2, "fluffy cat fluffy tail"s, DocumentStatus::ACTUAL, { 5, -12, 2, 1 });
+    server.AddDocument(3, "groomed dog expressive eyes"s, DocumentStatus::ACTUAL, { 1, 2, 3 });
+    server.AddDocument(4, "groomed starling evgeny"s, DocumentStatus::BANNED, { 9 });
+    for (int id = 5; id < 300; ++id) {
+        server.AddDocument(id, (id % 3 == 0 ? "fluffy groomed cat"s : "dog with collar"s) + " number "s + std::to_string(id),
+            id % 7 == 0 ? DocumentStatus::IRRELEVANT : DocumentStatus::ACTUAL, { id % 11 });
+    }
+    const std::vector<std::string> queries = { "fluffy groomed cat"s, "curly dog -collar"s, "number fluffy 42"s, "evgeny"s };
+    for (const std::string& query : queries) {
+        server.SetQueryEvaluation(QueryEvaluation::EXHAUSTIVE);
+        const auto expected = server.FindTopDocuments(query);
+        const auto expected_irrelevant = server.FindTopDocuments(query, DocumentStatus::IRRELEVANT);
+        server.SetQueryEvaluation(QueryEvaluation::PRUNED);
+        const auto found = server.FindTopDocuments(query);
+        const auto found_irrelevant = server.FindTopDocuments(query, DocumentStatus::IRRELEVANT);
+        AssertSameDocuments(found, expected, "Pruned evaluation must rank as the exhaustive one: "s + query);
+        ASSERT_EQUAL_HINT(found_irrelevant.size(), expected_irrelevant.size(), query);
+    }
+}
+
+void TestResultPageOfTopDocuments() {
+    SearchServer server("none"s);
+    for (int id = 0; id < 40; ++id) {
+        server.AddDocument(id, "cat"s + std::string(id % 4, ' ') + " number"s + std::string(id, 'x'), DocumentStatus::ACTUAL, { id });
+    }
+    const auto all_docs = server.FindTopDocuments("cat"s, ResultPage{ 0, 100 });
+    ASSERT_EQUAL_HINT(all_docs.size(), 40u, "Page size must not be limited by MAX_RESULT_DOCUMENT_COUNT"s);
+    ASSERT_EQUAL(server.FindTopDocuments("cat"s).size(), static_cast<size_t>(MAX_RESULT_DOCUMENT_COUNT));
+    for (size_t offset : { 0u, 7u, 35u, 50u }) {
+        const auto page = server.FindTopDocuments(std::execution::par, "cat"s, ResultPage{ offset, 10 });
+        const size_t expected_size = offset >= all_docs.size() ? 0 : std::min<size_t>(10, all_docs.size() - offset);
+        ASSERT_EQUAL_HINT(page.size(), expected_size, "Page must start after the skipped documents"s);
+        for (size_t i = 0; i < page.size(); ++i) {
+            ASSERT_EQUAL(page[i].id, all_docs[offset + i].id);
+        }
+    }
+}
+
+void TestShardedServerMatchesSingleServer() {
+    SearchServer server("and with"s);
+    ShardedSearchServer sharded_server(3, "and with"s);
+    for (int id = 0; id < 200; ++id) {
+        const std::string text = (id % 3 == 0 ? "fluffy groomed cat"s : "dog with collar"s) + " number "s + std::to_string(id % 17);
+        const DocumentStatus status = id % 7 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        server.AddDocument(id, text, status, { id % 11 });
+        sharded_server.AddDocument(id, text, status, { id % 11 });
+    }
+    for (int id = 0; id < 200; id += 13) {
+        server.RemoveDocument(id);
+        sharded_server.RemoveDocument(id);
+    }
+    ASSERT_EQUAL(sharded_server.GetDocumentCount(), server.GetDocumentCount());
+    const std::vector<std::string> queries = { "fluffy cat"s, "dog -collar"s, "number 5 cat"s, "groomed -16"s };
+    for (const std::string& query : queries) {
+        const auto expected = server.FindTopDocuments(query, ResultPage{ 0, 30 });
+        const auto found = sharded_server.FindTopDocuments(std::execution::par, query, ResultPage{ 0, 30 });
+        AssertSameDocuments(found, expected, "Shards must rank with corpus-wide statistics: "s + query);
+        ASSERT_EQUAL(sharded_server.FindTopDocuments(query, DocumentStatus::BANNED).size(),
+            server.FindTopDocuments(query, DocumentStatus::BANNED).size());
+    }
+    const auto [words, status] = sharded_server.MatchDocument("groomed cat -dog"s, 3);
+    ASSERT_EQUAL(words.size(), 2u);
+    ASSERT(status == DocumentStatus::ACTUAL);
+}
+
+void TestInverseDocumentFreqFollowsUpdates() {
+    SearchServer server("and"s);
+    server.AddDocument(1, "cat"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(2, "dog"s, DocumentStatus::ACTUAL, { 1 });
+    ASSERT(std::abs(server.FindTopDocuments("cat"s)[0].relevance - std::log(2.0)) < TOLERANCE);
+    server.AddDocument(3, "parrot"s, DocumentStatus::ACTUAL, { 1 });
+    ASSERT_HINT(std::abs(server.FindTopDocuments("cat"s)[0].relevance - std::log(3.0)) < TOLERANCE,
+        "Cached IDF must follow the document count"s);
+    server.AddDocument(4, "cat"s, DocumentStatus::ACTUAL, { 1 });
+    ASSERT_HINT(std::abs(server.FindTopDocuments("cat"s)[0].relevance - std::log(2.0)) < TOLERANCE,
+        "Cached IDF must follow the document frequency"s);
+    server.RemoveDocument(3);
+    server.RemoveDocument(std::execution::par, 4);
+    ASSERT(std::abs(server.FindTopDocuments("cat"s)[0].relevance - std::log(2.0)) < TOLERANCE);
+    server.RemoveDocument(2);
+    ASSERT(std::abs(server.FindTopDocuments("cat"s)[0].relevance) < TOLERANCE);
+
+    // Unknown ids are ignored by every overload
+    server.RemoveDocument(42);
+    server.RemoveDocument(std::execution::seq, 42);
+    server.RemoveDocument(std::execution::par, 42);
+    server.RemoveDocument(SearchExecutor(2), 42);
+    server.RemoveDocument(std::execution::par, 4);
+    ASSERT_EQUAL(server.GetDocumentCount(), 1);
+}
+
+void TestDocumentAttributesAfterRemoval() {
+    SearchServer server("and"s);
+    server.AddDocument(1, "cat tail"s, DocumentStatus::BANNED, { 1 });
+    server.AddDocument(2, "cat collar"s, DocumentStatus::BANNED, { 2 });
+    server.AddDocument(3, "cat eyes"s, DocumentStatus::ACTUAL, { 3 });
+    server.RemoveDocument(1);
+    const auto banned = server.FindTopDocuments("cat"s, DocumentStatus::BANNED);
+    ASSERT_EQUAL_HINT(banned.size(), 1u, "Removed documents must leave the status bitmap"s);
+    ASSERT_EQUAL(banned[0].id, 2);
+    server.AddDocument(1, "cat tail"s, DocumentStatus::ACTUAL, { 4 });
+    ASSERT_EQUAL(server.FindTopDocuments("cat"s, DocumentStatus::BANNED).size(), 1u);
+    const auto found = server.FindTopDocuments("cat"s, [](int document_id, DocumentStatus status, int rating) {
+        return status == DocumentStatus::ACTUAL && rating == document_id + 3;
+        });
+    ASSERT_EQUAL_HINT(found.size(), 1u, "Predicate must see the attributes of the re-added document"s);
+    ASSERT_EQUAL(found[0].id, 1);
+    ASSERT_EQUAL(found[0].rating, 4);
+}
+
+void TestAddDocumentsBatch() {
+    const std::vector<std::string> texts = { "white cat and collar"s, "fluffy cat fluffy tail"s, "groomed dog"s, "bad do\x12g"s };
+    const std::vector<DocumentToAdd> batch = {
+        { 1, texts[0], DocumentStatus::ACTUAL, { 8, -3 } },
+        { 2, texts[1], DocumentStatus::ACTUAL, { 7, 2, 7 } },
+        { -5, texts[2], DocumentStatus::ACTUAL, { 1 } },
+        { 1, texts[2], DocumentStatus::ACTUAL, { 1 } },
+        { 4, texts[3], DocumentStatus::ACTUAL, { 1 } },
+        { 3, texts[2], DocumentStatus::BANNED, { 5, -12, 2, 1 } },
+    };
+    SearchServer batch_server("and"s);
+    const auto rejected = batch_server.AddDocuments(batch);
+    ASSERT_EQUAL_HINT(rejected.size(), 3u, "Negative, duplicate and invalid documents must be reported"s);
+    ASSERT_EQUAL(rejected[0].position, 2u);
+    ASSERT_EQUAL(rejected[1].position, 3u);
+    ASSERT_EQUAL(rejected[2].position, 4u);
+    ASSERT_EQUAL(rejected[2].document_id, 4);
+
+    SearchServer server("and"s);
+    for (const DocumentToAdd& document : batch) {
+        try {
+            server.AddDocument(document.document_id, document.document, document.status, document.ratings);
+        }
+        catch (const std::invalid_argument&) {
+        }
+    }
+    ASSERT_EQUAL(batch_server.GetDocumentCount(), server.GetDocumentCount());
+    for (const std::string& query : { "fluffy cat"s, "groomed -collar"s }) {
+        const auto expected = server.FindTopDocuments(query);
+        const auto found = batch_server.FindTopDocuments(query);
+        AssertSameDocuments(found, expected, query, true);
+    }
+    ASSERT_EQUAL(batch_server.FindTopDocuments("groomed"s, DocumentStatus::BANNED).size(), 1u);
+}
+
+void TestSegmentedServerMatchesSingleServer() {
+    SearchServer server("and with"s);
+    SegmentedSearchServer segmented_server("and with"s);
+    for (int id = 0; id < 200; ++id) {
+        const std::string text = (id % 3 == 0 ? "fluffy groomed cat"s : "dog with collar"s) + " number "s + std::to_string(id % 17);
+        server.AddDocument(id, text, DocumentStatus::ACTUAL, { id % 11 });
+        segmented_server.AddDocument(id, text, DocumentStatus::ACTUAL, { id % 11 });
+        if (id % 50 == 49) {
+            segmented_server.Flush();
+        }
+    }
+    ASSERT_EQUAL(segmented_server.GetSegmentCount(), 4u);
+    for (int id = 0; id < 200; id += 9) {
+        server.RemoveDocument(id);
+        segmented_server.RemoveDocument(id);
+    }
+    ASSERT_EQUAL(segmented_server.GetDocumentCount(), server.GetDocumentCount());
+    const std::vector<std::string> queries = { "fluffy cat"s, "dog -collar"s, "number 5 cat"s, "groomed -16"s };
+    for (int pass = 0; pass < 2; ++pass) {
+        for (const std::string& query : queries) {
+            const auto expected = server.FindTopDocuments(query, ResultPage{ 0, 30 });
+            const auto found = segmented_server.FindTopDocuments(std::execution::par, query, ResultPage{ 0, 30 });
+            AssertSameDocuments(found, expected, "Deleted documents must not count in IDF: "s + query);
+            const auto is_even = [](int document_id, DocumentStatus, int) {
+                return document_id % 2 == 0;
+            };
+            const auto expected_even = server.FindTopDocuments(query, is_even, ResultPage{ 0, 30 });
+            const auto found_even = segmented_server.FindTopDocuments(query, is_even, ResultPage{ 0, 30 });
+            AssertSameDocuments(found_even, expected_even, "Tombstones must combine with predicates: "s + query);
+            for (const Document& document : found_even) {
+                ASSERT_EQUAL_HINT(document.id % 2, 0, query);
+            }
+        }
+        segmented_server.MergeSegments();
+        ASSERT_EQUAL_HINT(segmented_server.GetSegmentCount(), 1u, "Merge must leave a single segment"s);
+    }
+    ASSERT_EQUAL(segmented_server.GetDocumentCount(), server.GetDocumentCount());
+    ASSERT(segmented_server.FindTopDocuments("groomed"s).size() > 0);
+    segmented_server.AddDocument(0, "groomed parrot"s, DocumentStatus::ACTUAL, { 1 });
+    const auto [words, status] = segmented_server.MatchDocument("parrot cat"s, 0);
+    ASSERT_EQUAL_HINT(words.size(), 1u, "Removed id may be added again"s);
+}
+
+void TestSegmentedTombstonesAcrossManyDeletes() {
+    SearchServer server("and with"s);
+    SegmentedSearchServer segmented_server("and with"s);
+    for (int id = 0; id < 600; ++id) {
+        const std::string text = "word"s + std::to_string(id) + (id % 2 == 0 ? " cat"s : " dog"s)
+            + (id % 5 == 0 ? " collar"s : ""s);
+        server.AddDocument(id, text, DocumentStatus::ACTUAL, { id % 7 });
+        segmented_server.AddDocument(id, text, DocumentStatus::ACTUAL, { id % 7 });
+    }
+    segmented_server.Flush();
+    std::vector<SegmentedSearchServer::View> views;
+    for (int id = 0; id < 600; id += 2) {
+        server.RemoveDocument(id);
+        segmented_server.RemoveDocument(id);
+        if (id % 200 == 0) {
+            views.push_back(segmented_server.GetView());
+        }
+    }
+    // Every word of a deleted document is unique, so the recent frequencies are folded in many times
+    for (const std::string& query : { "cat collar"s, "dog collar"s, "word301 dog"s }) {
+        AssertSameDocuments(segmented_server.FindTopDocuments(query, ResultPage{ 0, 20 }),
+            server.FindTopDocuments(query, ResultPage{ 0, 20 }), "Deleted documents must not count in IDF: "s + query);
+    }
+    ASSERT_EQUAL(segmented_server.GetDocumentCount(), 300);
+    for (size_t i = 0; i < views.size(); ++i) {
+        ASSERT_EQUAL_HINT(views[i].GetDocumentCount(), 599 - 200 * static_cast<int>(i) / 2,
+            "Later deletes must not change the tombstones of a view"s);
+        ASSERT_EQUAL_HINT(views[i].GetDocumentIds().size(), static_cast<size_t>(views[i].GetDocumentCount()),
+            "Later deletes must not change the tombstones of a view"s);
+    }
+}
+
+void TestSegmentedViewIsStable() {
+    SegmentedSearchServer server("and with"s);
+    server.AddDocument(1, "fluffy cat"s, DocumentStatus::ACTUAL, { 5 });
+    server.AddDocument(2, "dog with collar"s, DocumentStatus::ACTUAL, { 3 });
+    server.Flush();
+    server.AddDocument(3, "groomed cat"s, DocumentStatus::ACTUAL, { 4 });
+
+    const SegmentedSearchServer::View view = server.GetView();
+    const std::map<std::string_view, double>& word_freqs = view.GetWordFrequencies(3);
+    server.RemoveDocument(1);
+    server.RemoveDocument(3);
+    server.AddDocument(4, "white cat"s, DocumentStatus::ACTUAL, { 1 });
+    server.MergeSegments();
+
+    ASSERT_EQUAL_HINT(view.GetDocumentCount(), 3, "Writes must not change a view"s);
+    ASSERT_HINT((view.GetDocumentIds() == std::vector<int>{ 1, 2, 3 }), "Writes must not change a view"s);
+    ASSERT_EQUAL(view.FindTopDocuments("cat"s).size(), 2u);
+    ASSERT_EQUAL_HINT(word_freqs.count("groomed"s), 1u, "References taken from a view must stay valid"s);
+    ASSERT_EQUAL(server.GetDocumentCount(), 2);
+    ASSERT_HINT((server.GetView().GetDocumentIds() == std::vector<int>{ 2, 4 }), "New views must see the writes"s);
+}
+
+void TestSegmentedMergePolicy() {
+    SearchServer server("and with"s);
+    SegmentedSearchServer segmented_server("and with"s);
+    for (int id = 0; id < 300; ++id) {
+        const std::string text = (id % 3 == 0 ? "fluffy groomed cat"s : "dog with collar"s) + " number "s + std::to_string(id % 13);
+        server.AddDocument(id, text, DocumentStatus::ACTUAL, { id % 5 });
+        segmented_server.AddDocument(id, text, DocumentStatus::ACTUAL, { id % 5 });
+        if (id % 2 == 1) {
+            segmented_server.Flush();
+        }
+    }
+    segmented_server.WaitForMerges();
+    // 150 seals of two documents fit in three size tiers
+    ASSERT_HINT(segmented_server.GetSegmentCount() <= 3 * (SEGMENT_MERGE_FACTOR - 1),
+        "Sealed segments must be merged by size tier"s);
+    const std::vector<std::string> queries = { "fluffy cat"s, "dog -collar"s, "number 5 cat"s, "groomed -12"s };
+    for (const std::string& query : queries) {
+        AssertSameDocuments(segmented_server.FindTopDocuments(std::execution::par, query, ResultPage{ 0, 30 }),
+            server.FindTopDocuments(query, ResultPage{ 0, 30 }), "Merges must not change results: "s + query);
+    }
+
+    for (int id = 0; id < 300; ++id) {
+        if (id % 4 != 0) {
+            server.RemoveDocument(id);
+            segmented_server.RemoveDocument(id);
+        }
+    }
+    segmented_server.WaitForMerges();
+    const SegmentedSearchServer::View view = segmented_server.GetView();
+    ASSERT_EQUAL(view.GetDocumentCount(), server.GetDocumentCount());
+    ASSERT_HINT(view.GetDocumentIds() == std::vector<int>(server.begin(), server.end()),
+        "Mostly deleted segments must be rewritten without their deleted documents"s);
+    for (const std::string& query : queries) {
+        AssertSameDocuments(view.FindTopDocuments(query, ResultPage{ 0, 30 }),
+            server.FindTopDocuments(query, ResultPage{ 0, 30 }), "Deleted documents must not count in IDF: "s + query);
+    }
+}
+
+void TestCompactionAfterRemoval() {
+    SearchServer server("and"s);
+    SearchServer expected_server("and"s);
+    for (int id = 0; id < 40; ++id) {
+        const std::string text = "cat word"s + std::to_string(id) + (id % 2 == 0 ? " fluffy"s : " tail"s);
+        server.AddDocument(id, text, DocumentStatus::ACTUAL, { id });
+        if (id % 4 == 0) {
+            expected_server.AddDocument(id, text, DocumentStatus::ACTUAL, { id });
+        }
+    }
+    server.CompressPostings();
+    for (int id = 0; id < 40; ++id) {
+        if (id % 4 != 0) {
+            server.RemoveDocument(id);
+        }
+    }
+    ASSERT_EQUAL(server.GetDocumentCount(), 10);
+    ASSERT_HINT(server.FindTopDocuments("tail word1"s).empty(), "Removed documents must not be found"s);
+    ASSERT_EQUAL_HINT(server.GetCorpusStatistics("tail"s).document_freqs.at("tail"s), 0,
+        "Removed documents must not count in document frequencies"s);
+
+    server.AddDocument(100, "parrot tail"s, DocumentStatus::ACTUAL, { 1 });
+    expected_server.AddDocument(100, "parrot tail"s, DocumentStatus::ACTUAL, { 1 });
+    for (const std::string& query : { "cat fluffy"s, "parrot word8"s, "tail -word12"s }) {
+        const auto found = server.FindTopDocuments(query, ResultPage{ 0, 20 });
+        const auto expected = expected_server.FindTopDocuments(query, ResultPage{ 0, 20 });
+        AssertSameDocuments(found, expected, query, true);
+    }
+    const auto [words, status] = server.MatchDocument("cat word8 tail"s, 8);
+    ASSERT_EQUAL_HINT(words.size(), 2u, "Compaction must keep the words of live documents"s);
+}
+
+void TestCompactionRunsInBackground() {
+    SearchServer server("and"s);
+    SearchServer expected_server("and"s);
+    for (int id = 0; id < 40; ++id) {
+        const std::string text = "cat word"s + std::to_string(id) + (id % 2 == 0 ? " fluffy"s : " tail"s);
+        server.AddDocument(id, text, DocumentStatus::ACTUAL, { id });
+        if (id % 4 == 0) {
+            expected_server.AddDocument(id, text, DocumentStatus::ACTUAL, { id });
+        }
+    }
+    const auto assert_same = [&server, &expected_server](const std::string& hint) {
+        for (const std::string& query : { "cat fluffy"s, "parrot word8"s, "tail -word12"s, "word0"s }) {
+            const auto found = server.FindTopDocuments(query, ResultPage{ 0, 40 });
+            const auto expected = expected_server.FindTopDocuments(query, ResultPage{ 0, 40 });
+            AssertSameDocuments(found, expected, hint + ": "s + query, true);
+        }
+    };
+
+    // The eleventh removal passes a quarter of the 40 ordinals
+    int removed = 0;
+    for (int id = 0; removed < 11; ++id) {
+        if (id % 4 != 0) {
+            server.RemoveDocument(id);
+            ++removed;
+        }
+    }
+    ASSERT_HINT(server.IsCompacting(), "RemoveDocument must not compact the index inline"s);
+    ASSERT_HINT(server.FindTopDocuments("word1 word14"s).empty(), "Removed documents must not be found"s);
+    ASSERT_EQUAL(server.FindTopDocuments("word4 word15"s).size(), 2u);
+
+    // Updates made meanwhile are carried over when the compaction is installed
+    for (int id = 15; id < 40; ++id) {
+        if (id % 4 != 0) {
+            server.RemoveDocument(id);
+        }
+    }
+    server.RemoveDocument(0);
+    expected_server.RemoveDocument(0);
+    for (SearchServer* target : { &server, &expected_server }) {
+        target->AddDocument(0, "parrot word0"s, DocumentStatus::ACTUAL, { 2 });
+        target->AddDocument(100, "parrot tail"s, DocumentStatus::BANNED, { 1 });
+    }
+    server.WaitForCompaction();
+    ASSERT(!server.IsCompacting());
+    assert_same("Compaction must keep the updates made while it ran"s);
+    ASSERT_EQUAL(server.GetDocumentCount(), expected_server.GetDocumentCount());
+    ASSERT_EQUAL(server.FindTopDocuments("parrot"s, DocumentStatus::BANNED).size(), 1u);
+
+    server.Compact();
+    assert_same("Compacting again must drop the rest of the removed documents"s);
+    const auto [words, status] = server.MatchDocument("parrot word0 cat"s, 0);
+    ASSERT_EQUAL(words.size(), 2u);
+}
+
+void TestSnapshotIsStableUnderWrites() {
+    SearchServer server("and"s);
+    ASSERT_HINT(server.GetSnapshot().GetDocumentIds().empty(), "A new server publishes its empty state"s);
+    for (int id = 0; id < 20; ++id) {
+        server.AddDocument(id, "cat word"s + std::to_string(id), DocumentStatus::ACTUAL, { id });
+    }
+    server.PublishSnapshot();
+    const auto snapshot = server.GetSnapshot();
+    const std::map<std::string_view, double>& frequencies = snapshot.GetWordFrequencies(3);
+    const auto expected = snapshot.FindTopDocuments("cat word3"s);
+
+    std::atomic_bool done{ false };
+    std::atomic_bool stable{ true };
+    std::thread reader([&] {
+        while (!done) {
+            const auto found = snapshot.FindTopDocuments("cat word3"s);
+            if (found.size() != expected.size() || found.front().id != 3) {
+                stable = false;
+            }
+        }
+    });
+    // Removing most documents compacts the index and frees their words for reuse
+    for (int id = 0; id < 20; ++id) {
+        if (id != 7) {
+            server.RemoveDocument(id);
+        }
+    }
+    for (int id = 20; id < 40; ++id) {
+        server.AddDocument(id, "dog word"s + std::to_string(id), DocumentStatus::ACTUAL, { id });
+    }
+    done = true;
+    reader.join();
+
+    ASSERT_HINT(stable, "Snapshot queries must not see later writes"s);
+    ASSERT_EQUAL(snapshot.GetDocumentIds().size(), 20u);
+    ASSERT_EQUAL(frequencies.size(), 2u);
+    ASSERT_EQUAL(frequencies.count("word3"s), 1u);
+    AssertSameDocuments(snapshot.FindTopDocuments("cat word3"s), expected, "cat word3"s, true);
+    ASSERT_HINT(server.GetSnapshot().FindTopDocuments("dog"s).empty(), "Writes are seen only after publishing"s);
+
+    server.PublishSnapshot();
+    ASSERT_EQUAL(server.GetSnapshot().GetDocumentCount(), 21);
+    ASSERT_EQUAL(server.GetSnapshot().FindTopDocuments("dog"s, ResultPage{ 0, 20 }).size(), 20u);
+    ASSERT_EQUAL(snapshot.GetDocumentCount(), 20);
+}
+
+void TestChunkedColumnsAreCopiedByChunk() {
+    ChunkedMap<int, int> map;
+    std::map<int, int> expected_map;
+    ChunkedVector<int> column;
+    std::vector<int> expected_column;
+    for (int i = 0; i < 20000; ++i) {
+        const int key = (i * 7919) % 30011;
+        map.Set(key, i);
+        expected_map[key] = i;
+        column.push_back(key);
+        expected_column.push_back(key);
+    }
+    const ChunkedMap<int, int> map_copy = map;
+    const ChunkedVector<int> column_copy = column;
+    for (int key = 0; key < 30011; key += 3) {
+        map.Erase(key);
+        expected_map.erase(key);
+    }
+    map.Set(7919, -5);
+    expected_map[7919] = -5;
+    for (size_t i = 0; i < expected_column.size(); i += 1000) {
+        column.Modify(i) = -1;
+        expected_column[i] = -1;
+    }
+
+    std::vector<std::pair<int, int>> entries;
+    map.ForEach([&entries](int key, int value) {
+        entries.push_back({ key, value });
+        });
+    const std::vector<std::pair<int, int>> expected_entries(expected_map.begin(), expected_map.end());
+    ASSERT_HINT(entries == expected_entries, "Chunked map must iterate in key order"s);
+    ASSERT_EQUAL(map.size(), expected_map.size());
+    ASSERT(map.Find(3 * 7919) == nullptr);
+    ASSERT_HINT(column.ToVector() == expected_column, "Chunked column must keep its elements"s);
+    ASSERT_EQUAL_HINT(map_copy.size(), 20000u, "Writes must not change a copy"s);
+    ASSERT_HINT(map_copy.Find(3 * 7919) != nullptr && *map_copy.Find(7919) == 1, "Writes must not change a copy"s);
+    ASSERT_EQUAL_HINT(column_copy[1000], 1000 * 7919 % 30011, "Writes must not change a copy"s);
+
+    // Documents span several chunks of every column
+    SearchServer server("and"s);
+    for (int id = 0; id < 9000; ++id) {
+        server.AddDocument(id * 2, "cat number"s + std::to_string(id % 97), DocumentStatus::ACTUAL, { id % 5 });
+    }
+    server.PublishSnapshot();
+    const auto snapshot = server.GetSnapshot();
+    for (int id = 0; id < 9000; id += 3) {
+        server.RemoveDocument(id * 2);
+    }
+    server.AddDocument(1, "cat number7"s, DocumentStatus::BANNED, { 1 });
+    server.PublishSnapshot();
+    ASSERT_EQUAL(snapshot.GetDocumentCount(), 9000);
+    ASSERT_EQUAL(snapshot.GetDocumentIds().size(), 9000u);
+    ASSERT_EQUAL(snapshot.FindTopDocuments("number7"s, ResultPage{ 0, 200 }).size(), 93u);
+    const std::vector<int> document_ids = server.GetSnapshot().GetDocumentIds();
+    ASSERT_EQUAL(server.GetDocumentCount(), 6001);
+    ASSERT_HINT(document_ids == std::vector<int>(server.begin(), server.end()), "Snapshot ids must be ascending"s);
+    ASSERT_EQUAL(server.GetSnapshot().FindTopDocuments("number7"s, DocumentStatus::BANNED).size(), 1u);
+    ASSERT(std::get<1>(server.MatchDocument("cat"s, 1)) == DocumentStatus::BANNED);
+}
+
+void TestSaveAndOpenMapped() {
+    const std::string path = "test_search_server.index"s;
+    {
+        SearchServer server("and with"s);
+        for (int id = 0; id < 300; ++id) {
+            server.AddDocument(id, "cat with word"s + std::to_string(id % 23) + (id % 3 == 0 ? " fluffy"s : " tail"s),
+                id % 5 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL, { id % 7 });
+        }
+        server.RemoveDocument(4);
+        server.CompressPostings();
+        server.AddDocument(1000, "parrot tail"s, DocumentStatus::ACTUAL, { 9 });
+        server.Save(path);
+    }
+    SearchServer server("and with"s);
+    for (int id = 0; id < 300; ++id) {
+        server.AddDocument(id, "cat with word"s + std::to_string(id % 23) + (id % 3 == 0 ? " fluffy"s : " tail"s),
+            id % 5 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL, { id % 7 });
+    }
+    server.RemoveDocument(4);
+    server.AddDocument(1000, "parrot tail"s, DocumentStatus::ACTUAL, { 9 });
+
+    SearchServer mapped_server = SearchServer::OpenMapped(path);
+    ASSERT_EQUAL(mapped_server.GetDocumentCount(), server.GetDocumentCount());
+    for (const std::string& query : { "fluffy cat"s, "parrot word4 -fluffy"s, "tail and word7"s }) {
+        const auto expected = server.FindTopDocuments(query, ResultPage{ 0, 50 });
+        const auto found = mapped_server.FindTopDocuments(query, ResultPage{ 0, 50 });
+        AssertSameDocuments(found, expected, query);
+    }
+    ASSERT_EQUAL(mapped_server.FindTopDocuments("cat"s, DocumentStatus::BANNED, ResultPage{ 0, 100 }).size(), 60u);
+    ASSERT_HINT(mapped_server.GetWordFrequencies(4).empty(), "Removed documents must stay removed"s);
+    ASSERT(mapped_server.GetWordFrequencies(7) == server.GetWordFrequencies(7));
+    const auto [words, status] = mapped_server.MatchDocument("with fluffy word7"s, 7);
+    ASSERT_EQUAL(words.size(), 1u);
+
+    mapped_server.AddDocument(2000, "fluffy parrot"s, DocumentStatus::ACTUAL, { 1 });
+    mapped_server.RemoveDocument(1000);
+    ASSERT_EQUAL_HINT(mapped_server.FindTopDocuments("parrot"s)[0].id, 2000, "Mapped index must accept updates"s);
+
+    // Saving over the mapped file must leave the mapped server reading the old one
+    const auto before_save = mapped_server.FindTopDocuments("fluffy cat word7"s, ResultPage{ 0, 50 });
+    SearchServer other_server("and"s);
+    other_server.AddDocument(1, "grey dog"s, DocumentStatus::ACTUAL, { 1 });
+    other_server.Save(path);
+    AssertSameDocuments(mapped_server.FindTopDocuments("fluffy cat word7"s, ResultPage{ 0, 50 }), before_save,
+        "Save over a mapped file"s);
+    ASSERT_EQUAL(SearchServer::OpenMapped(path).GetDocumentCount(), 1);
+    ASSERT(!std::filesystem::exists(path + ".tmp"s));
+
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(100);
+        file.put('#');
+    }
+    bool is_rejected = false;
+    try {
+        SearchServer::OpenMapped(path);
+    }
+    catch (const std::runtime_error&) {
+        is_rejected = true;
+    }
+    ASSERT_HINT(is_rejected, "Corrupted index file must be rejected"s);
+    std::remove(path.c_str());
+}
+
+void TestDurableServerRecovers() {
+    const std::string snapshot_path = "test_durable_search_server.index"s;
+    const std::string log_path = "test_durable_search_server.log"s;
+    std::remove(snapshot_path.c_str());
+    std::remove(log_path.c_str());
+    {
+        DurableSearchServer server(snapshot_path, log_path, "and"s);
+        server.AddDocument(1, "fluffy cat"s, DocumentStatus::ACTUAL, { 5 });
+        server.AddDocument(2, "dog and collar"s, DocumentStatus::BANNED, { 3 });
+        server.AddDocument(3, "groomed cat"s, DocumentStatus::ACTUAL, { 4, 6 });
+        server.RemoveDocument(1);
+    }
+    {
+        DurableSearchServer server(snapshot_path, log_path, "and"s);
+        ASSERT_EQUAL_HINT(server.GetDocumentCount(), 2, "Logged updates must be replayed"s);
+        ASSERT_EQUAL(server.FindTopDocuments("collar"s, DocumentStatus::BANNED).size(), 1u);
+        ASSERT_EQUAL(server.FindTopDocuments("cat"s)[0].rating, 5);
+        server.Sync();
+        std::filesystem::copy_file(log_path, log_path + ".old"s, std::filesystem::copy_options::overwrite_existing);
+        server.Checkpoint();
+        ASSERT_EQUAL(std::filesystem::file_size(log_path), 0u);
+        server.AddDocument(4, "white parrot"s, DocumentStatus::ACTUAL, { 1 });
+        server.RemoveDocument(std::execution::par, 2);
+        server.RemoveDocument(42);
+        server.RemoveDocument(std::execution::par, 42);
+        ASSERT_EQUAL_HINT(server.GetDocumentCount(), 2, "Unknown ids must be ignored by every overload"s);
+    }
+    {
+        DurableSearchServer server(snapshot_path, log_path, "and"s);
+        ASSERT_EQUAL_HINT(server.GetDocumentCount(), 2, "Log must be replayed on the snapshot"s);
+        ASSERT_EQUAL(server.FindTopDocuments("parrot cat"s).size(), 2u);
+        ASSERT(server.FindTopDocuments("collar"s, DocumentStatus::BANNED).empty());
+    }
+    // A crash between saving the snapshot and truncating the log leaves the old log
+    std::filesystem::copy_file(log_path + ".old"s, log_path, std::filesystem::copy_options::overwrite_existing);
+    {
+        std::ofstream log(log_path, std::ios::binary | std::ios::app);
+        log << "torn record"s;
+    }
+    {
+        DurableSearchServer server(snapshot_path, log_path, "and"s);
+        ASSERT_EQUAL_HINT(server.GetDocumentCount(), 2, "Replay on a newer snapshot must be idempotent"s);
+        server.AddDocument(5, "black cat"s, DocumentStatus::ACTUAL, { 2 });
+    }
+    {
+        DurableSearchServer server(snapshot_path, log_path, "and"s);
+        ASSERT_EQUAL_HINT(server.GetDocumentCount(), 3, "Torn tail must be cut off before new records"s);
+    }
+    std::remove(snapshot_path.c_str());
+    std::remove(log_path.c_str());
+    std::remove((log_path + ".old"s).c_str());
+}
+
+void TestSplitIntoValidatedWords() {
+    std::vector<std::string_view> words;
+    ASSERT_EQUAL(SplitIntoValidatedWords(""s, words), 0u);
+    ASSERT(words.empty());
+    ASSERT_EQUAL(SplitIntoValidatedWords("   "s, words), 0u);
+    ASSERT(words.empty());
+    const std::string short_text = "  cat  in\xd0\xb3 city "s;
+    ASSERT_EQUAL(SplitIntoValidatedWords(short_text, words), 3u);
+    ASSERT(words == std::vector<std::string_view>({ "cat", "in\xd0\xb3", "city" }));
+    // Words crossing the 64-byte blocks of the vectorized scan
+    std::string text;
+    std::vector<std::string> expected;
+    for (int i = 0; i < 40; ++i) {
+        expected.push_back(std::string(i % 7 + 1, static_cast<char>('a' + i % 26)));
+        text += expected.back() + std::string(i % 3 + 1, ' ');
+    }
+    ASSERT_EQUAL(SplitIntoValidatedWords(text, words), expected.size());
+    ASSERT_EQUAL(words.size(), expected.size());
+    for (size_t i = 0; i < words.size(); ++i) {
+        ASSERT_EQUAL(std::string(words[i]), expected[i]);
+    }
+    text[text.size() - 70] = '\x12';
+    const size_t first_invalid = SplitIntoValidatedWords(text, words);
+    ASSERT_EQUAL_HINT(words.size(), expected.size(), "Control characters must not split words"s);
+    ASSERT(first_invalid < words.size());
+    ASSERT(words[first_invalid].find('\x12') != std::string_view::npos);
+    for (size_t i = 0; i < first_invalid; ++i) {
+        ASSERT_EQUAL(std::string(words[i]), expected[i]);
+    }
+
+    SearchServer server("and"s);
+    int rejected_count = 0;
+    try {
+        server.AddDocument(1, "cat and d\x12og"s, DocumentStatus::ACTUAL, { 1 });
+    }
+    catch (const std::invalid_argument&) {
+        ++rejected_count;
+    }
+    try {
+        server.FindTopDocuments("cat d\x12og"s);
+    }
+    catch (const std::invalid_argument&) {
+        ++rejected_count;
+    }
+    ASSERT_EQUAL_HINT(rejected_count, 2, "Words with control characters must be rejected"s);
+}
+
+void TestUnpackKernelsAgree() {
+    const std::vector<UnpackKernel> kernels = GetSupportedUnpackKernels();
+    ASSERT(kernels.front() == UnpackKernel::SCALAR);
+    // One jump of 2^width in otherwise dense ids gives blocks of every bit width
+    for (int width = 0; width <= 30; ++width) {
+        std::vector<int> ids;
+        for (int i = 0; i < 3 * static_cast<int>(POSTING_BLOCK_SIZE) + 17; ++i) {
+            ids.push_back(i * (width % 3 + 1) + (i >= 70 ? (1 << width) : 0));
+        }
+        const std::vector<double> term_freqs(ids.size(), 0.5);
+        const CompressedPostingList postings(ids.data(), term_freqs.data(), ids.size());
+        for (const UnpackKernel kernel : kernels) {
+            for (size_t block = 0; block < postings.GetBlockCount(); ++block) {
+                int decoded[POSTING_BLOCK_SIZE];
+                const size_t count = postings.DecodeDocumentIds(block, decoded, kernel);
+                for (size_t i = 0; i < count; ++i) {
+                    ASSERT_EQUAL_HINT(decoded[i], ids[block * POSTING_BLOCK_SIZE + i],
+                        "Kernel "s + std::to_string(static_cast<int>(kernel)) + ", width "s + std::to_string(width));
+                }
+            }
+        }
+    }
+}
+
+void TestStopWordSet() {
+    ASSERT(!StopWordSet().Contains("in"s));
+    ASSERT(!StopWordSet(std::set<std::string>()).Contains(""s));
+    std::set<std::string> words;
+    for (int i = 0; i < 600; ++i) {
+        words.insert("w"s + std::to_string(i * 7));
+    }
+    words.insert(std::string(100, 'x'));
+    const StopWordSet stop_words(words);
+    for (const std::string& word : words) {
+        ASSERT_HINT(stop_words.Contains(word), word);
+    }
+    for (int i = 0; i < 600; ++i) {
+        ASSERT(!stop_words.Contains("w"s + std::to_string(i * 7 + 1)));
+    }
+    ASSERT(!stop_words.Contains(""s));
+    ASSERT(!stop_words.Contains("w"s));
+    ASSERT(!stop_words.Contains(std::string(99, 'x')));
+    ASSERT(!stop_words.Contains(std::string(101, 'x')));
+    const StopWordSet copy = stop_words;
+    ASSERT(copy.Contains("w7"s));
+}
+
+void TestPreparedQuery() {
+    SearchServer server("and in"s);
+    server.AddDocument(1, "fluffy cat and fluffy tail"s, DocumentStatus::ACTUAL, { 7 });
+    server.AddDocument(2, "groomed dog in collar"s, DocumentStatus::ACTUAL, { 5 });
+    server.AddDocument(3, "groomed cat"s, DocumentStatus::BANNED, { 3 });
+    const std::string raw_query = "cat fluffy -collar cat in parrot"s;
+    const PreparedQuery query = server.Prepare(raw_query);
+    ASSERT(query.GetPlusWords() == std::vector<std::string>({ "cat"s, "fluffy"s, "parrot"s }));
+    ASSERT(query.GetMinusWords() == std::vector<std::string>({ "collar"s }));
+
+    const auto assert_same = [&raw_query, &query](const SearchServer& server, const std::string& hint) {
+        const auto expected = server.FindTopDocuments(raw_query);
+        const auto found = server.FindTopDocuments(query);
+        AssertSameDocuments(found, expected, hint, true);
+        ASSERT_EQUAL_HINT(server.FindTopDocuments(std::execution::par, query, DocumentStatus::BANNED).size(),
+            server.FindTopDocuments(std::execution::par, raw_query, DocumentStatus::BANNED).size(), hint);
+    };
+    assert_same(server, "Prepared query must rank as the raw one"s);
+    const auto even = server.FindTopDocuments(query, [](int document_id, DocumentStatus, int) {
+        return document_id % 2 == 0;
+        });
+    ASSERT(even.empty());
+
+    server.AddDocument(4, "white parrot and collar"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(5, "grey parrot"s, DocumentStatus::ACTUAL, { 2 });
+    assert_same(server, "Words added after Prepare must be found"s);
+    server.RemoveDocument(1);
+    server.Compact();
+    assert_same(server, "Term ids freed by Compact must not be reused"s);
+    SearchServer other(""s);
+    other.AddDocument(1, "parrot cat"s, DocumentStatus::ACTUAL, { 1 });
+    assert_same(other, "Query prepared by another server must be resolved again"s);
+
+    RequestQueue request_queue(server);
+    ASSERT_EQUAL(request_queue.AddFindRequest(query).size(), 1u);
+    request_queue.AddFindRequest(server.Prepare("dog"s), DocumentStatus::BANNED);
+    ASSERT_EQUAL(request_queue.GetNoResultRequests(), 1);
+}
+
+void TestQueryResultCache() {
+    SearchServer server("and in"s);
+    server.AddDocument(1, "fluffy cat and fluffy tail"s, DocumentStatus::ACTUAL, { 7 });
+    server.AddDocument(2, "groomed dog in collar"s, DocumentStatus::ACTUAL, { 5 });
+    server.AddDocument(3, "groomed cat"s, DocumentStatus::BANNED, { 3 });
+    QueryResultCache cache(1 << 20);
+    const auto expected = server.FindTopDocuments("fluffy cat"s);
+    auto found = cache.FindTopDocuments(server, "fluffy cat"s);
+    ASSERT_EQUAL(found.size(), expected.size());
+    ASSERT_EQUAL(cache.GetMissCount(), 1u);
+    found = cache.FindTopDocuments(server, "cat  fluffy cat in"s);
+    ASSERT_EQUAL_HINT(cache.GetHitCount(), 1u, "Equal normalized queries must share an entry"s);
+    ASSERT_EQUAL(found.size(), expected.size());
+    for (size_t i = 0; i < found.size(); ++i) {
+        ASSERT_EQUAL(found[i].id, expected[i].id);
+        ASSERT(found[i].relevance == expected[i].relevance);
+    }
+    ASSERT_EQUAL(cache.FindTopDocuments(server, "fluffy cat"s, DocumentStatus::BANNED).size(), 1u);
+    ASSERT_EQUAL(cache.FindTopDocuments(server, "fluffy cat"s, ResultPage{ 1, 5 }).size(), 0u);
+    ASSERT_EQUAL(cache.GetMissCount(), 3u);
+
+    server.AddDocument(4, "black cat"s, DocumentStatus::ACTUAL, { 1 });
+    ASSERT_EQUAL_HINT(cache.FindTopDocuments(server, "fluffy cat"s).size(), 2u, "Updates must invalidate entries"s);
+    server.RemoveDocument(1);
+    ASSERT_EQUAL(cache.FindTopDocuments(std::execution::par, server, "fluffy cat"s).size(), 1u);
+    ASSERT_EQUAL(cache.GetHitCount(), 1u);
+
+    QueryResultCache small_cache(1024, 1);
+    for (int i = 0; i < 100; ++i) {
+        small_cache.FindTopDocuments(server, "cat w"s + std::to_string(i));
+    }
+    ASSERT_HINT(small_cache.GetMemoryUsage() <= 1024u, "Memory budget must be kept"s);
+    small_cache.FindTopDocuments(server, "cat w99"s);
+    ASSERT_EQUAL_HINT(small_cache.GetHitCount(), 1u, "Recently used entries must stay"s);
+
+    const std::vector<std::string> queries = { "cat"s, "groomed dog"s, "cat"s, "tail"s, "cat"s };
+    const auto cached = ProcessQueries(server, queries, cache);
+    const auto direct = ProcessQueries(server, queries);
+    ASSERT_EQUAL(cached.size(), direct.size());
+    for (size_t i = 0; i < cached.size(); ++i) {
+        ASSERT_EQUAL(cached[i].size(), direct[i].size());
+    }
+    cache.Clear();
+    ASSERT_EQUAL(cache.GetMemoryUsage(), 0u);
+}
+
+void TestQueryStatistics() {
+    using namespace std::chrono;
+    QueryStatistics statistics(100);
+    ASSERT_EQUAL(statistics.GetReport(size_t{ 100 }).request_count, 0u);
+    for (int i = 0; i < 250; ++i) {
+        statistics.Record(i % 10, microseconds(i));
+    }
+    QueryStatisticsReport report = statistics.GetReport(size_t{ 50 });
+    ASSERT_EQUAL(report.request_count, 50u);
+    ASSERT_EQUAL(report.empty_result_count, 5u);
+    ASSERT(std::abs(report.empty_result_rate - 0.1) < 1e-9);
+    ASSERT_EQUAL_HINT(report.latency_max.count(), 249000, "Only the last requests count"s);
+    ASSERT_EQUAL(report.latency_p50.count(), 224000);
+    ASSERT_EQUAL(report.result_count_histogram.size(), MAX_RESULT_DOCUMENT_COUNT + 1);
+    ASSERT_EQUAL(report.result_count_histogram[1], 5u);
+    ASSERT_EQUAL_HINT(report.result_count_histogram.back(), 25u, "Large result counts share the last bucket"s);
+    ASSERT_EQUAL_HINT(statistics.GetReport(size_t{ 1000 }).request_count, 100u, "The ring holds the capacity"s);
+    ASSERT_EQUAL(statistics.GetReport(hours(1)).request_count, 100u);
+
+    SearchServer server("and"s);
+    server.AddDocument(1, "fluffy cat"s, DocumentStatus::ACTUAL, { 5 });
+    RequestQueue request_queue(server);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&request_queue] {
+            for (int i = 0; i < 100; ++i) {
+                request_queue.AddFindRequest(i % 2 == 0 ? "cat"s : "dog"s);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    ASSERT_EQUAL_HINT(request_queue.GetNoResultRequests(), 200, "Requests from every thread must be counted"s);
+    report = request_queue.GetStatistics().GetReport(size_t{ 1440 });
+    ASSERT_EQUAL(report.request_count, 400u);
+    ASSERT_EQUAL(report.result_count_histogram[1], 200u);
+}
+
+void TestFindTopDocumentsBatch() {
+    SearchServer server("and with"s);
+    const std::vector<std::string> words = { "cat"s, "dog"s, "parrot"s, "collar"s, "tail"s, "fluffy"s, "white"s };
+    for (int id = 0; id < 300; ++id) {
+        std::string text;
+        for (size_t i = 0; i < words.size(); ++i) {
+            if ((id + 1) % (i + 2) == 0 || id % (i + 3) == 1) {
+                text += words[i] + " "s;
+            }
+        }
+        server.AddDocument(id, text + "and"s, id % 5 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL, { id % 11 });
+    }
+    std::vector<std::string> queries;
+    for (size_t i = 0; i < words.size(); ++i) {
+        queries.push_back(words[i] + " "s + words[(i + 1) % words.size()]);
+        queries.push_back(words[i] + " -"s + words[(i + 2) % words.size()] + " and"s);
+    }
+    queries.push_back("unknown"s);
+    const auto expected = ProcessQueries(server, queries);
+    const auto found = ProcessQueriesBatched(server, queries);
+    ASSERT_EQUAL(found.size(), queries.size());
+    for (size_t i = 0; i < queries.size(); ++i) {
+        ASSERT_EQUAL_HINT(found[i].size(), expected[i].size(), queries[i]);
+        for (size_t j = 0; j < found[i].size(); ++j) {
+            ASSERT_EQUAL_HINT(found[i][j].id, expected[i][j].id, queries[i]);
+            ASSERT_HINT(found[i][j].relevance == expected[i][j].relevance, queries[i]);
+        }
+    }
+    const auto banned = server.FindTopDocumentsBatch(queries, DocumentStatus::BANNED, { 2, 10 });
+    for (size_t i = 0; i < queries.size(); ++i) {
+        ASSERT_EQUAL_HINT(banned[i].size(),
+            server.FindTopDocuments(queries[i], DocumentStatus::BANNED, { 2, 10 }).size(), queries[i]);
+    }
+    bool is_rejected = false;
+    try {
+        server.FindTopDocumentsBatch({ "cat"s, "--dog"s });
+    }
+    catch (const std::invalid_argument&) {
+        is_rejected = true;
+    }
+    ASSERT_HINT(is_rejected, "Invalid query must fail the batch"s);
+}
+
+void TestProcessQueriesJoined() {
+    SearchServer server("and with"s);
+    for (int id = 0; id < 40; ++id) {
+        server.AddDocument(id, (id % 2 == 0 ? "white cat "s : "black dog "s) + (id % 3 == 0 ? "collar"s : "tail"s),
+            DocumentStatus::ACTUAL, { id });
+    }
+    const std::vector<std::string> queries = { "cat"s, "unknown"s, "dog -tail"s, "collar tail"s, "white"s };
+    const auto expected = ProcessQueries(server, queries);
+    const JoinedDocuments joined = ProcessQueriesJoined(server, queries);
+    ASSERT_EQUAL(joined.GetQueryCount(), queries.size());
+    std::vector<int> flat_ids;
+    for (const Document& document : joined) {
+        flat_ids.push_back(document.id);
+    }
+    std::vector<int> expected_ids;
+    for (size_t i = 0; i < queries.size(); ++i) {
+        const auto documents = joined.GetQueryDocuments(i);
+        ASSERT_EQUAL_HINT(documents.size(), expected[i].size(), queries[i]);
+        auto document = documents.begin();
+        for (const Document& expected_document : expected[i]) {
+            ASSERT_EQUAL_HINT(document->id, expected_document.id, queries[i]);
+            ASSERT_HINT(document->relevance == expected_document.relevance, queries[i]);
+            expected_ids.push_back(expected_document.id);
+            ++document;
+        }
+    }
+    ASSERT_EQUAL(joined.size(), expected_ids.size());
+    ASSERT_HINT(flat_ids == expected_ids, "Flat range must be the results of the queries in order"s);
+    const JoinedDocuments none = ProcessQueriesJoined(server, {});
+    ASSERT_EQUAL(none.GetQueryCount(), 0u);
+    ASSERT_EQUAL(none.size(), 0u);
+
+    for (const QueryEvaluation evaluation : { QueryEvaluation::EXHAUSTIVE, QueryEvaluation::PRUNED }) {
+        server.SetQueryEvaluation(evaluation);
+        const ResultPage page{ 2, 4 };
+        std::vector<Document> output(page.offset + page.count);
+        const size_t count = server.FindTopDocumentsInto("white collar"s, DocumentStatus::ACTUAL, page,
+            output.data());
+        output.resize(count);
+        AssertSameDocuments(output, server.FindTopDocuments("white collar"s, page),
+            "Documents ranked in place must be the page FindTopDocuments returns"s, true);
+    }
+}
+
+void TestSearchExecutor() {
+    const SearchExecutor executor(3, { 0 });
+    ASSERT_EQUAL(executor.GetThreadCount(), 3u);
+    std::vector<int> values(1000);
+    executor.ForEachIndex(0, values.size(), [&values](size_t i) {
+        values[i] = static_cast<int>(i);
+        });
+    ASSERT_EQUAL(std::accumulate(values.begin(), values.end(), 0), 999 * 1000 / 2);
+    // Nested calls run on the same pool and must finish without deadlock
+    std::vector<std::vector<int>> nested(20, std::vector<int>(50, 0));
+    executor.ForEach(nested.begin(), nested.end(), [&executor](std::vector<int>& row) {
+        executor.ForEach(row.begin(), row.end(), [](int& value) {
+            ++value;
+            });
+        });
+    for (const auto& row : nested) {
+        ASSERT_EQUAL(std::accumulate(row.begin(), row.end(), 0), 50);
+    }
+    bool is_rethrown = false;
+    try {
+        executor.ForEachIndex(0, 100, [](size_t i) {
+            if (i == 42) {
+                throw std::out_of_range("42"s);
+            }
+            });
+    }
+    catch (const std::out_of_range&) {
+        is_rethrown = true;
+    }
+    ASSERT_HINT(is_rethrown, "Exception of a task must reach the caller"s);
+    bool is_rejected = false;
+    try {
+        SearchExecutor invalid(1, { -1 });
+    }
+    catch (const std::invalid_argument&) {
+        is_rejected = true;
+    }
+    ASSERT_HINT(is_rejected, "Invalid CPU must be rejected"s);
+
+    SearchServer server("and with"s);
+    for (int id = 0; id < 10000; ++id) {
+        server.AddDocument(id, (id % 2 == 0 ? "white cat "s : "black dog "s) + (id % 7 == 0 ? "collar"s : "tail"s),
+            DocumentStatus::ACTUAL, { id });
+    }
+    const std::vector<std::string> queries = { "cat"s, "dog -tail"s, "collar tail"s, "white -cat"s };
+    std::vector<std::vector<Document>> found(queries.size());
+    executor.ForEachIndex(0, queries.size(), [&](size_t i) {
+        found[i] = server.FindTopDocuments(executor, queries[i]);
+        });
+    const auto document_ids = [](const std::vector<Document>& documents) {
+        std::vector<int> ids;
+        for (const Document& document : documents) {
+            ids.push_back(document.id);
+        }
+        return ids;
+    };
+    const auto expected = ProcessQueries(server, queries);
+    const auto processed = ProcessQueries(executor, server, queries);
+    for (size_t i = 0; i < queries.size(); ++i) {
+        ASSERT_HINT(document_ids(found[i]) == document_ids(expected[i]), queries[i]);
+        ASSERT_HINT(document_ids(processed[i]) == document_ids(expected[i]), queries[i]);
+    }
+    ASSERT_HINT(server.MatchDocument(executor, "cat collar"s, 14) == server.MatchDocument("cat collar"s, 14),
+        "Executor must match the same words"s);
+    ASSERT_EQUAL(std::get<0>(server.MatchDocument(executor, "cat -collar"s, 14)).size(), 0u);
+    server.RemoveDocument(executor, 14);
+    ASSERT_EQUAL(server.GetDocumentCount(), 9999);
+    ASSERT_HINT(document_ids(server.FindTopDocuments(executor, "collar"s))
+        == document_ids(server.FindTopDocuments("collar"s)), "Removal must be seen by both"s);
+}
+
+#ifdef SEARCH_SERVER_HAS_COROUTINES
+
+namespace {
+
+// Coroutine started at once and never awaited, which reports through its arguments
+struct DetachedCoroutine {
+    struct promise_type {
+        DetachedCoroutine get_return_object() {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+        void return_void() {
+        }
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+};
+
+DetachedCoroutine FindTopDocumentsCoroutine(const SearchServer& server, AsyncQueryExecutor& executor,
+    std::string query, std::promise<std::vector<Document>>& result) {
+    try {
+        result.set_value(co_await server.FindTopDocumentsAwaitable(executor, query));
+    }
+    catch (...) {
+        result.set_exception(std::current_exception());
+    }
+}
+
+}  // namespace
+
+#endif
+
+void TestFindTopDocumentsAsync() {
+    SearchServer server("and with"s);
+    server.AddDocument(1, "white cat and fluffy tail"s, DocumentStatus::ACTUAL, { 1 });
+    server.AddDocument(2, "black dog with collar"s, DocumentStatus::ACTUAL, { 2 });
+    server.AddDocument(3, "fluffy dog"s, DocumentStatus::BANNED, { 3 });
+    AsyncQueryExecutor executor(2, 4);
+    ASSERT_EQUAL(executor.GetThreadCount(), 2u);
+    ASSERT_EQUAL(executor.GetQueueCapacity(), 4u);
+    std::future<std::vector<Document>> dogs = server.FindTopDocumentsAsync(executor, "dog"s);
+    std::future<std::vector<Document>> banned = server.FindTopDocumentsAsync(executor, "fluffy"s,
+        DocumentStatus::BANNED);
+    std::future<std::vector<Document>> invalid = server.FindTopDocumentsAsync(executor, "cat --dog"s);
+    std::vector<Document> documents = dogs.get();
+    ASSERT_EQUAL(documents.size(), 1u);
+    ASSERT_EQUAL(documents[0].id, 2);
+    documents = banned.get();
+    ASSERT_EQUAL(documents.size(), 1u);
+    ASSERT_EQUAL(documents[0].id, 3);
+    bool is_rethrown = false;
+    try {
+        invalid.get();
+    }
+    catch (const std::invalid_argument&) {
+        is_rethrown = true;
+    }
+    ASSERT_HINT(is_rethrown, "Invalid query must fail its future"s);
+    ASSERT_EQUAL(server.FindTopDocumentsAsync("cat"s).get().size(), 1u);
+
+    // Both threads wait on the gate, so the queue fills up
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    std::array<std::promise<void>, 2> started;
+    std::vector<std::future<void>> is_started;
+    for (std::promise<void>& thread_started : started) {
+        is_started.push_back(thread_started.get_future());
+        ASSERT(executor.TrySubmit([opened, &thread_started] {
+            thread_started.set_value();
+            opened.wait();
+            }));
+    }
+    for (const std::future<void>& thread_started : is_started) {
+        thread_started.wait();
+    }
+    std::array<std::promise<void>, 4> finished;
+    for (std::promise<void>& task_finished : finished) {
+        ASSERT(executor.TrySubmit([opened, &task_finished] {
+            opened.wait();
+            task_finished.set_value();
+            }));
+    }
+    ASSERT_EQUAL(executor.GetQueuedCount(), 4u);
+    bool is_refused = false;
+    try {
+        server.FindTopDocumentsAsync(executor, "dog"s);
+    }
+    catch (const std::runtime_error&) {
+        is_refused = true;
+    }
+    ASSERT_HINT(is_refused, "Full queue must refuse a query at once"s);
+    gate.set_value();
+    // Queued tasks leave the queue before they run, so the queue is empty once they finish
+    for (std::promise<void>& task_finished : finished) {
+        task_finished.get_future().wait();
+    }
+    ASSERT_EQUAL(server.FindTopDocumentsAsync(executor, "dog"s).get().size(), 1u);
+
+#ifdef SEARCH_SERVER_HAS_COROUTINES
+    std::promise<std::vector<Document>> awaited;
+    FindTopDocumentsCoroutine(server, executor, "fluffy cat"s, awaited);
+    documents = awaited.get_future().get();
+    ASSERT_EQUAL(documents.size(), 1u);
+    ASSERT_EQUAL(documents[0].id, 1);
+#endif
+}
+
+void TestFindTopDocumentsWithinBudget() {
+    SearchServer server("and with"s);
+    for (int id = 0; id < 2000; ++id) {
+        std::string text = "common"s;
+        if (id % 3 == 0) {
+            text += " frequent"s;
+        }
+        if (id % 50 == 0) {
+            text += " rare"s;
+        }
+        if (id % 100 == 0) {
+            text += " excluded"s;
+        }
+        server.AddDocument(id, text, id % 7 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL, { id });
+    }
+    const std::string query = "common frequent rare -excluded"s;
+    BudgetedDocuments found = server.FindTopDocuments(query, QueryBudget{});
+    std::vector<Document> expected = server.FindTopDocuments(query);
+    ASSERT_HINT(!found.is_partial, "Unlimited query must be complete"s);
+    ASSERT_EQUAL(found.documents.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        ASSERT_EQUAL(found.documents[i].id, expected[i].id);
+        ASSERT_HINT(found.documents[i].relevance == expected[i].relevance, "Complete result must be exact"s);
+    }
+    found = server.FindTopDocuments(query, QueryBudget{}, DocumentStatus::BANNED, { 1, 3 });
+    expected = server.FindTopDocuments(query, DocumentStatus::BANNED, { 1, 3 });
+    ASSERT_EQUAL(found.documents.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        ASSERT_EQUAL(found.documents[i].id, expected[i].id);
+    }
+
+    // Only the rare word fits in the budget, the frequent ones are left out
+    QueryBudget budget;
+    budget.max_postings = 100;
+    found = server.FindTopDocuments(query, budget, { 0, 100 });
+    ASSERT_HINT(found.is_partial, "Query over its budget must be partial"s);
+    ASSERT_EQUAL(found.documents.size(), 17u);
+    for (const Document& document : found.documents) {
+        ASSERT_EQUAL(document.id % 50, 0);
+        ASSERT_HINT(document.id % 100 != 0, "Minus words must apply to partial results"s);
+        ASSERT_HINT(document.id % 7 != 0, "Status must apply to partial results"s);
+    }
+
+    budget = {};
+    budget.deadline = std::chrono::steady_clock::now() - std::chrono::seconds(1);
+    found = server.FindTopDocuments(query, budget);
+    ASSERT_HINT(found.is_partial, "Query past its deadline must be partial"s);
+    ASSERT(found.documents.empty());
+}
+
 void TestSearchServer() {
     LOG_DURATION("Tests for SearchServer"s);
     RUN_TEST(TestFindAddedDocument);
     RUN_TEST(TestExcludeStopWordsFromAddedDocumentContent);
+    RUN_TEST(TestMoveConstructedServer);
     RUN_TEST(TestExcludeMinusDocumentFromResults);
     RUN_TEST(TestMatchingDocument);
     RUN_TEST(TestSortingDocumentsInRelevantOrder);
@@ -231,4 +1412,31 @@ void TestSearchServer() {
     RUN_TEST(TestFilterWithPredicateOfUser);
     RUN_TEST(TestFilterWithDocumentsStatus);
     RUN_TEST(TestCorrectCalculationRelevanceOfDocuments);
+    RUN_TEST(TestPrunedEvaluationMatchesExhaustive);
+    RUN_TEST(TestResultPageOfTopDocuments);
+    RUN_TEST(TestShardedServerMatchesSingleServer);
+    RUN_TEST(TestInverseDocumentFreqFollowsUpdates);
+    RUN_TEST(TestDocumentAttributesAfterRemoval);
+    RUN_TEST(TestAddDocumentsBatch);
+    RUN_TEST(TestSegmentedServerMatchesSingleServer);
+    RUN_TEST(TestSegmentedTombstonesAcrossManyDeletes);
+    RUN_TEST(TestSegmentedViewIsStable);
+    RUN_TEST(TestSegmentedMergePolicy);
+    RUN_TEST(TestCompactionAfterRemoval);
+    RUN_TEST(TestCompactionRunsInBackground);
+    RUN_TEST(TestSnapshotIsStableUnderWrites);
+    RUN_TEST(TestChunkedColumnsAreCopiedByChunk);
+    RUN_TEST(TestSaveAndOpenMapped);
+    RUN_TEST(TestDurableServerRecovers);
+    RUN_TEST(TestSplitIntoValidatedWords);
+    RUN_TEST(TestUnpackKernelsAgree);
+    RUN_TEST(TestStopWordSet);
+    RUN_TEST(TestPreparedQuery);
+    RUN_TEST(TestQueryResultCache);
+    RUN_TEST(TestQueryStatistics);
+    RUN_TEST(TestFindTopDocumentsBatch);
+    RUN_TEST(TestProcessQueriesJoined);
+    RUN_TEST(TestSearchExecutor);
+    RUN_TEST(TestFindTopDocumentsAsync);
+    RUN_TEST(TestFindTopDocumentsWithinBudget);
 }
@@ -34,6 +34,7 @@ void RunTestFunction(T& func, const std::string& func_str) {
 #define RUN_TEST(function) RunTestFunction((function), #function)
 
 void TestExcludeStopWordsFromAddedDocumentContent();
+void TestMoveConstructedServer();
 void TestFindAddedDocument();
 void TestExcludeMinusDocumentFromResults();
 void TestMatchingDocument();
@@ -42,5 +43,32 @@ void TestAverageRatingOfAddedDocument();
 void TestFilterWithPredicateOfUser();
 void TestFilterWithDocumentsStatus();
 void TestCorrectCalculationRelevanceOfDocuments();
+void TestPrunedEvaluationMatchesExhaustive();
+void TestResultPageOfTopDocuments();
+void TestShardedServerMatchesSingleServer();
+void TestInverseDocumentFreqFollowsUpdates();
+void TestDocumentAttributesAfterRemoval();
+void TestAddDocumentsBatch();
+void TestSegmentedServerMatchesSingleServer();
+void TestSegmentedTombstonesAcrossManyDeletes();
+void TestSegmentedViewIsStable();
+void TestSegmentedMergePolicy();
+void TestCompactionAfterRemoval();
+void TestCompactionRunsInBackground();
+void TestSnapshotIsStableUnderWrites();
+void TestChunkedColumnsAreCopiedByChunk();
+void TestSaveAndOpenMapped();
+void TestDurableServerRecovers();
+void TestSplitIntoValidatedWords();
+void TestUnpackKernelsAgree();
+void TestStopWordSet();
+void TestPreparedQuery();
+void TestQueryResultCache();
+void TestQueryStatistics();
+void TestFindTopDocumentsBatch();
+void TestProcessQueriesJoined();
+void TestSearchExecutor();
+void TestFindTopDocumentsAsync();
+void TestFindTopDocumentsWithinBudget();
 
 void TestSearchServer();
@@ -0,0 +1,289 @@
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include "index_file.h"
+#include "write_ahead_log.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr char ADD_RECORD = 'A';
+constexpr char REMOVE_RECORD = 'R';
+
+// A record is its payload size (4 bytes), the payload checksum (8 bytes) and the payload
+constexpr size_t RECORD_HEADER_SIZE = sizeof(uint32_t) + sizeof(uint64_t);
+
+template <typename T>
+void AppendValue(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+std::string MakeRecord(const std::string& payload) {
+    IndexChecksum checksum;
+    checksum.Update(payload.data(), payload.size());
+    std::string record;
+    record.reserve(RECORD_HEADER_SIZE + payload.size());
+    AppendValue(record, static_cast<uint32_t>(payload.size()));
+    AppendValue(record, checksum.Get());
+    record += payload;
+    return record;
+}
+
+// Reads values of a record payload, failing instead of reading past its end
+class PayloadReader {
+public:
+    explicit PayloadReader(std::string_view payload)
+        : payload_(payload)
+    {
+    }
+
+    template <typename T>
+    bool Read(T& value) {
+        if (payload_.size() < sizeof(value)) {
+            return false;
+        }
+        std::memcpy(&value, payload_.data(), sizeof(value));
+        payload_.remove_prefix(sizeof(value));
+        return true;
+    }
+
+    bool ReadText(size_t size, std::string_view& text) {
+        if (payload_.size() < size) {
+            return false;
+        }
+        text = payload_.substr(0, size);
+        payload_.remove_prefix(size);
+        return true;
+    }
+
+    bool IsEnd() const {
+        return payload_.empty();
+    }
+
+private:
+    std::string_view payload_;
+};
+
+// Applies one record payload, false if it is malformed
+bool ApplyRecord(std::string_view payload, SearchServer& server) {
+    PayloadReader reader(payload);
+    char type;
+    int32_t document_id;
+    if (!reader.Read(type) || !reader.Read(document_id)) {
+        return false;
+    }
+    if (type == REMOVE_RECORD) {
+        if (!reader.IsEnd()) {
+            return false;
+        }
+        server.RemoveDocument(document_id);
+        return true;
+    }
+    int32_t status;
+    uint32_t rating_count;
+    if (type != ADD_RECORD || !reader.Read(status) || !reader.Read(rating_count)
+        || status < 0 || static_cast<size_t>(status) >= DOCUMENT_STATUS_COUNT
+        || rating_count > payload.size() / sizeof(int32_t)) {
+        return false;
+    }
+    std::vector<int> ratings(rating_count);
+    for (int& rating : ratings) {
+        int32_t value;
+        if (!reader.Read(value)) {
+            return false;
+        }
+        rating = value;
+    }
+    uint32_t text_size;
+    std::string_view text;
+    if (!reader.Read(text_size) || !reader.ReadText(text_size, text) || !reader.IsEnd()) {
+        return false;
+    }
+    if (!server.HasDocument(document_id)) {
+        server.AddDocument(document_id, text, static_cast<DocumentStatus>(status), ratings);
+    }
+    return true;
+}
+
+bool FlushToDisk(std::FILE* file) {
+    if (std::fflush(file) != 0) {
+        return false;
+    }
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+}  // namespace
+
+WriteAheadLog::WriteAheadLog(const std::string& path, std::chrono::milliseconds sync_interval)
+    : path_(path)
+    , sync_interval_(sync_interval)
+{
+    if (sync_interval_.count() > 0) {
+        sync_thread_ = std::thread([this] { SyncLoop(); });
+    }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    {
+        std::lock_guard guard(pending_mutex_);
+        is_stopping_ = true;
+    }
+    stop_condition_.notify_one();
+    if (sync_thread_.joinable()) {
+        sync_thread_.join();
+    }
+    std::lock_guard guard(file_mutex_);
+    WriteLocked();
+    if (file_ != nullptr) {
+        std::fclose(file_);
+    }
+}
+
+size_t WriteAheadLog::Replay(SearchServer& server) {
+    std::lock_guard guard(file_mutex_);
+    std::ifstream in(path_, std::ios::binary);
+    if (!in) {
+        return 0;
+    }
+    const std::string log((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+
+    size_t position = 0;
+    size_t record_count = 0;
+    while (log.size() - position >= RECORD_HEADER_SIZE) {
+        uint32_t payload_size;
+        uint64_t expected_checksum;
+        std::memcpy(&payload_size, log.data() + position, sizeof(payload_size));
+        std::memcpy(&expected_checksum, log.data() + position + sizeof(payload_size), sizeof(expected_checksum));
+        if (payload_size > log.size() - position - RECORD_HEADER_SIZE) {
+            break;
+        }
+        const std::string_view payload(log.data() + position + RECORD_HEADER_SIZE, payload_size);
+        IndexChecksum checksum;
+        checksum.Update(payload.data(), payload.size());
+        if (checksum.Get() != expected_checksum || !ApplyRecord(payload, server)) {
+            break;
+        }
+        position += RECORD_HEADER_SIZE + payload_size;
+        ++record_count;
+    }
+    // Whatever follows the last intact record was being written during a crash
+    if (position < log.size()) {
+        std::filesystem::resize_file(path_, position);
+    }
+    return record_count;
+}
+
+void WriteAheadLog::AppendAdd(int document_id, std::string_view document, DocumentStatus status,
+    const std::vector<int>& ratings) {
+    std::string payload;
+    AppendValue(payload, ADD_RECORD);
+    AppendValue(payload, static_cast<int32_t>(document_id));
+    AppendValue(payload, static_cast<int32_t>(status));
+    AppendValue(payload, static_cast<uint32_t>(ratings.size()));
+    for (const int rating : ratings) {
+        AppendValue(payload, static_cast<int32_t>(rating));
+    }
+    AppendValue(payload, static_cast<uint32_t>(document.size()));
+    payload += document;
+    Append(MakeRecord(payload));
+}
+
+void WriteAheadLog::AppendRemove(int document_id) {
+    std::string payload;
+    AppendValue(payload, REMOVE_RECORD);
+    AppendValue(payload, static_cast<int32_t>(document_id));
+    Append(MakeRecord(payload));
+}
+
+void WriteAheadLog::Sync() {
+    std::lock_guard guard(file_mutex_);
+    if (!WriteLocked()) {
+        throw std::runtime_error("Cannot write log " + path_);
+    }
+}
+
+void WriteAheadLog::Truncate() {
+    std::lock_guard guard(file_mutex_);
+    {
+        std::lock_guard pending_guard(pending_mutex_);
+        pending_records_.clear();
+    }
+    if (file_ != nullptr) {
+        std::fclose(file_);
+    }
+    file_ = std::fopen(path_.c_str(), "wb");
+    if (file_ == nullptr || !FlushToDisk(file_)) {
+        throw std::runtime_error("Cannot truncate log " + path_);
+    }
+}
+
+void WriteAheadLog::Append(const std::string& record) {
+    {
+        std::lock_guard guard(pending_mutex_);
+        if (has_failed_) {
+            throw std::runtime_error("Cannot write log " + path_);
+        }
+        pending_records_ += record;
+    }
+    if (sync_interval_.count() == 0) {
+        Sync();
+    }
+}
+
+void WriteAheadLog::SyncLoop() {
+    std::unique_lock lock(pending_mutex_);
+    while (!is_stopping_) {
+        stop_condition_.wait_for(lock, sync_interval_, [this] { return is_stopping_; });
+        // The file mutex is taken first everywhere, so the pending one is released
+        lock.unlock();
+        {
+            std::lock_guard guard(file_mutex_);
+            WriteLocked();
+        }
+        lock.lock();
+    }
+}
+
+bool WriteAheadLog::OpenLocked() {
+    if (file_ == nullptr) {
+        file_ = std::fopen(path_.c_str(), "ab");
+    }
+    return file_ != nullptr;
+}
+
+bool WriteAheadLog::WriteLocked() {
+    std::string records;
+    {
+        std::lock_guard guard(pending_mutex_);
+        if (has_failed_) {
+            return false;
+        }
+        records.swap(pending_records_);
+    }
+    if (records.empty()) {
+        return true;
+    }
+    if (OpenLocked() && std::fwrite(records.data(), 1, records.size(), file_) == records.size()
+        && FlushToDisk(file_)) {
+        return true;
+    }
+    // Later records must not land after a gap, so the log stops accepting them
+    std::lock_guard guard(pending_mutex_);
+    has_failed_ = true;
+    return false;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "document.h"
+#include "mapped_file.h"
+#include "search_server.h"
+
+// How often appended records are written and fsync'd by default
+constexpr std::chrono::milliseconds DEFAULT_LOG_SYNC_INTERVAL{ 100 };
+
+// Append-only log of AddDocument and RemoveDocument calls. Records collect in
+// memory and a background thread writes and fsyncs them every sync interval,
+// so one fsync commits a whole group; a zero interval commits every record at
+// once. Each record carries its size and checksum, so a record torn by a crash
+// is detected and cut off on replay.
+class WriteAheadLog {
+public:
+    WriteAheadLog(const std::string& path, std::chrono::milliseconds sync_interval = DEFAULT_LOG_SYNC_INTERVAL);
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+    // Commits the records still in memory
+    ~WriteAheadLog();
+
+    // Applies the logged calls to server in order and returns their count. Adds of
+    // documents the server already has are skipped, so a log may be replayed on
+    // a snapshot that already contains some of its records. Call before appending
+    size_t Replay(SearchServer& server);
+
+    void AppendAdd(int document_id, std::string_view document, DocumentStatus status,
+        const std::vector<int>& ratings);
+    void AppendRemove(int document_id);
+
+    // Returns once every appended record is on disk
+    void Sync();
+    // Drops every record, for a checkpoint that has saved them in a snapshot
+    void Truncate();
+
+private:
+    const std::string path_;
+    const std::chrono::milliseconds sync_interval_;
+    // Records not written yet
+    std::string pending_records_;
+    std::mutex pending_mutex_;
+    // Serializes writes to the file
+    std::mutex file_mutex_;
+    std::FILE* file_ = nullptr;
+    bool has_failed_ = false;
+    bool is_stopping_ = false;
+    std::condition_variable stop_condition_;
+    std::thread sync_thread_;
+
+    void Append(const std::string& record);
+    void SyncLoop();
+    // File mutex must be held
+    bool OpenLocked();
+    bool WriteLocked();
+};